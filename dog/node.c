@@ -235,12 +235,33 @@ static int node_recovery_info(int argc, char **argv)
 	return EXIT_SUCCESS;
 }
 
+static int exec_recovery_req(int opcode, struct recovery_throttling *rt)
+{
+	struct sd_req req;
+	struct sd_rsp *rsp = (struct sd_rsp *)&req;
+	int ret;
+
+	sd_init_req(&req, opcode);
+	req.data_length = sizeof(*rt);
+	if (opcode == SD_OP_SET_RECOVERY)
+		req.flags = SD_FLAG_CMD_WRITE;
+	else
+		/* the older sheep doesn't return latency_slo */
+		memset(rt, 0, sizeof(*rt));
+
+	ret = dog_exec_req(&sd_nid, &req, rt);
+	if (ret < 0 || rsp->result != SD_RES_SUCCESS) {
+		sd_err("Failed to execute request");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int node_recovery_set(int argc, char **argv)
 {
 	char *p;
-	struct recovery_throttling *rthrottling;
-
-	rthrottling = xmalloc(sizeof(struct recovery_throttling));
+	struct recovery_throttling rthrottling;
 
 	if (!argv[optind] || !argv[optind + 1]) {
 		sd_err("Invalid interval max (%s), interval (%s)",
@@ -248,6 +269,10 @@ static int node_recovery_set(int argc, char **argv)
 		exit(EXIT_USAGE);
 	}
 
+	/* keep the latency target */
+	if (exec_recovery_req(SD_OP_GET_RECOVERY, &rthrottling) < 0)
+		return -1;
+
 	/* clear errno before calling strtol */
 	errno = 0;
 
@@ -257,7 +282,7 @@ static int node_recovery_set(int argc, char **argv)
 		sd_err("Invalid max (%s)", argv[optind]);
 		exit(EXIT_USAGE);
 	}
-	rthrottling->max_exec_count = (uint32_t)max;
+	rthrottling.max_exec_count = (uint32_t)max;
 
 	optind++;
 
@@ -266,89 +291,58 @@ static int node_recovery_set(int argc, char **argv)
 		sd_err("Invalid interval (%s)", argv[optind]);
 		exit(EXIT_USAGE);
 	}
-	rthrottling->queue_work_interval = (uint64_t)interval;
+	rthrottling.queue_work_interval = (uint64_t)interval;
 
-	if ((rthrottling->max_exec_count == 0 &&
-	 rthrottling->queue_work_interval != 0) ||
-	 (rthrottling->max_exec_count != 0 &&
-	 rthrottling->queue_work_interval == 0)) {
+	if ((rthrottling.max_exec_count == 0 &&
+	 rthrottling.queue_work_interval != 0) ||
+	 (rthrottling.max_exec_count != 0 &&
+	 rthrottling.queue_work_interval == 0)) {
 		sd_err("Invalid interval max (%"PRIu32"), interval (%"PRIu64")",
-		rthrottling->max_exec_count, rthrottling->queue_work_interval);
+		rthrottling.max_exec_count, rthrottling.queue_work_interval);
 		exit(EXIT_USAGE);
 	}
 
-	int ret = 0;
-	struct sd_req req;
-	struct sd_rsp *rsp = (struct sd_rsp *)&req;
-
-	sd_init_req(&req, SD_OP_SET_RECOVERY);
-	req.flags = SD_FLAG_CMD_WRITE;
-	req.data_length = sizeof(struct recovery_throttling);
-	ret = dog_exec_req(&sd_nid, &req, rthrottling);
+	return exec_recovery_req(SD_OP_SET_RECOVERY, &rthrottling);
+}
 
-	if (ret < 0)
-		ret = EXIT_SYSFAIL;
+static int node_recovery_set_slo(int argc, char **argv)
+{
+	char *p;
+	struct recovery_throttling rthrottling;
 
-	if (rsp->result == SD_RES_SUCCESS)
-		ret = EXIT_SUCCESS;
-	else
-		ret = EXIT_FAILURE;
+	if (!argv[optind]) {
+		sd_err("Invalid latency target");
+		exit(EXIT_USAGE);
+	}
 
-	switch (ret) {
-	case EXIT_FAILURE:
-	case EXIT_SYSFAIL:
-		sd_err("Failed to execute request");
-		ret = -1;
-		break;
-	case EXIT_SUCCESS:
-		/* do nothing */
-		break;
-	default:
-		sd_err("unknown return code: %d", ret);
-		ret = -1;
-		break;
+	errno = 0;
+	const unsigned long long slo = strtoull(argv[optind], &p, 10);
+	if (argv[optind] == p || errno != 0 || *p != '\0' ||
+	    argv[optind][0] == '-') {
+		sd_err("Invalid latency target (%s)", argv[optind]);
+		exit(EXIT_USAGE);
 	}
 
-	free(rthrottling);
-	return ret;
+	/* keep the static throttling, max caps the adaptive one */
+	if (exec_recovery_req(SD_OP_GET_RECOVERY, &rthrottling) < 0)
+		return -1;
+	rthrottling.latency_slo = (uint64_t)slo;
+
+	return exec_recovery_req(SD_OP_SET_RECOVERY, &rthrottling);
 }
 
 static int node_recovery_get(int argc, char **argv)
 {
 	struct recovery_throttling rthrottling;
-	int ret = 0;
-
-	struct sd_req req;
-	struct sd_rsp *rsp = (struct sd_rsp *)&req;
-
-	sd_init_req(&req, SD_OP_GET_RECOVERY);
-	req.data_length = sizeof(rthrottling);
 
-	ret = dog_exec_req(&sd_nid, &req, &rthrottling);
-	if (ret < 0)
-		ret = EXIT_SYSFAIL;
+	if (exec_recovery_req(SD_OP_GET_RECOVERY, &rthrottling) < 0)
+		return -1;
 
-	if (rsp->result == SD_RES_SUCCESS)
-		ret = EXIT_SUCCESS;
-	else
-		ret = EXIT_FAILURE;
+	sd_info("max (%"PRIu32"), interval (%"PRIu64"), latency target (%"
+		PRIu64"us)", rthrottling.max_exec_count,
+		rthrottling.queue_work_interval, rthrottling.latency_slo);
 
-	switch (ret) {
-	case EXIT_FAILURE:
-	case EXIT_SYSFAIL:
-		sd_err("Failed to execute request");
-		ret = -1;
-		break;
-	case EXIT_SUCCESS:
-		sd_info("max (%"PRIu32"), interval (%"PRIu64")",
-		 rthrottling.max_exec_count, rthrottling.queue_work_interval);
-		break;
-	default:
-		sd_err("unknown return code: %d", ret);
-		ret = -1;
-		break;
-	}
-	return ret;
+	return 0;
 }
 
 static struct sd_node *idx_to_node(struct rb_root *nroot, int idx)
@@ -414,7 +408,7 @@ static int node_stat(int argc, char **argv)
 {
 	struct sd_req hdr;
 	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
-	struct sd_stat stat, last = { { 0 } };
+	struct sd_stat stat = { { 0 } }, last = { { 0 } };
 	int ret;
 	bool watch = node_cmd_data.watch ? true : false, first = true;
 
@@ -484,6 +478,32 @@ again:
 		       stat.r.peer_total_remove_nr, 0UL,
 		       strnumber(stat.r.peer_total_rx),
 		       strnumber(stat.r.peer_total_tx));
+		if (stat.c.hit_nr || stat.c.miss_nr)
+			printf("%s%"PRIu64"\t%"PRIu64"\t%s\n",
+			       raw_output ? "" :
+			       "Read cache\tHit\tMiss\tSize\n\t\t",
+			       stat.c.hit_nr, stat.c.miss_nr,
+			       strnumber(stat.c.cache_size));
+		if (stat.j.checkpoint_nr)
+			printf("%s%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n",
+			       raw_output ? "" :
+			       "Journal\tCkpt\tObjects\tAvg(us)\tMax(us)\n\t\t",
+			       stat.j.checkpoint_nr, stat.j.checkpoint_obj_nr,
+			       stat.j.checkpoint_time / stat.j.checkpoint_nr,
+			       stat.j.max_checkpoint_time);
+		if (stat.o.nr_objs)
+			printf("%s%"PRIu64"\t%s\n",
+			       raw_output ? "" :
+			       "Objlist\tObjects\tMemory\n\t",
+			       stat.o.nr_objs, strnumber(stat.o.mem_size));
+		if (stat.w.batch_nr)
+			printf("%s%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n",
+			       raw_output ? "" :
+			       "Workqueue\tDone\tBatches\tAvg(us)\t"
+			       "Max(us)\n\t\t",
+			       stat.w.done_nr, stat.w.batch_nr,
+			       stat.w.total_latency / stat.w.batch_nr,
+			       stat.w.max_latency);
 	}
 
 	return EXIT_SUCCESS;
@@ -659,6 +679,9 @@ static struct subcommand node_recovery_cmd[] = {
 	 NULL, CMD_NEED_NODELIST, node_recovery_info, node_options},
 	{"set-throttle", "<max> <interval>", NULL, "set new throttling", NULL,
 	 CMD_NEED_ARG|CMD_NEED_NODELIST, node_recovery_set, node_options},
+	{"set-slo", "<latency>", NULL,
+	 "set foreground latency target (usec, 0 to disable)", NULL,
+	 CMD_NEED_ARG|CMD_NEED_NODELIST, node_recovery_set_slo, node_options},
 	{"get-throttle", NULL, NULL, "get current throttling", NULL,
 	 CMD_NEED_NODELIST, node_recovery_get, node_options},
 	{NULL},
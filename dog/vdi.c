@@ -2030,7 +2030,7 @@ static void check_erasure_object(struct vdi_check_info *info)
 {
 	int d = 0, p = 0, i, j, k;
 	int dp = ec_policy_to_dp(info->copy_policy, &d, &p);
-	struct fec *ctx = ec_init(d, dp);
+	struct fec *ctx = ec_get(d, dp);
 	int miss_idx[dp], input_idx[dp];
 	uint64_t oid = info->oid;
 	uint32_t object_size = (UINT32_C(1) << info->block_size_shift);
@@ -2052,23 +2052,25 @@ static void check_erasure_object(struct vdi_check_info *info)
 		}
 
 	if (!j) { /* No object missing */
-		int idx[d];
+		const uint8_t *ds[d];
+		uint8_t *ps[p];
+		char *parity = xmalloc(len * p);
 
+		/* Encode all the parity strips at once and compare them */
 		for (i = 0; i < d; i++)
-			idx[i] = i;
+			ds[i] = info->vcw[i].buf;
+		for (k = 0; k < p; k++)
+			ps[k] = (uint8_t *)parity + len * k;
+		ec_encode_buffer(ctx, ds, ps, len);
 
 		for (k = 0; k < p; k++) {
-			uint8_t *ds[d];
-			for (j = 0; j < d; j++)
-				ds[j] = info->vcw[j].buf;
-			ec_decode_buffer(ctx, ds, idx, obj, d + k,
-					 object_size);
-			if (memcmp(obj, info->vcw[d + k].buf, len) != 0) {
+			if (memcmp(ps[k], info->vcw[d + k].buf, len) != 0) {
 				/* TODO repair the inconsistency */
 				sd_err("object %016"PRIx64" is inconsistent", oid);
-				goto out;
+				break;
 			}
 		}
+		free(parity);
 	} else if (j > p) {
 		sd_err("failed to rebuild object %016"PRIx64". %d copies get "
 		       "lost, more than %d", oid, j, p);
@@ -2092,7 +2094,6 @@ out:
 	for (i = 0; i < dp; i++)
 		free(info->vcw[i].buf);
 	free(obj);
-	ec_destroy(ctx);
 }
 
 static void vote_majority_object(struct vdi_check_info *info)
@@ -67,11 +67,33 @@
 #include "sheepdog_proto.h"
 #include "../lib/isa-l/include/erasure_code.h"
 
+/* Set data stripe as sector size to make VM happy */
+#define SD_EC_DATA_STRIPE_SIZE (512) /* 512 Byte */
+#define SD_EC_MAX_STRIP (16)
+
+/*
+ * Decode coefficients to rebuild the strip 'idx' from the input strips in
+ * 'in_mask', which are passed in numeric order
+ */
+struct fec_decode_entry {
+	uint32_t in_mask;
+	int idx;
+	uint8_t coef[SD_EC_MAX_STRIP];
+	unsigned char ec_tbl[SD_EC_MAX_STRIP * 32];  /* for isa-l */
+};
+
+#define FEC_NR_DECODE_ENTRIES 16
+
 struct fec {
 	unsigned long magic;
 	unsigned short d, dp;                     /* parameters of the code */
 	uint8_t *enc_matrix;
 	unsigned char *ec_tbl;                    /* for isa-l */
+
+	/* cache of the decode coefficients, replaced in round robin */
+	struct sd_mutex dec_lock;
+	struct fec_decode_entry dec_cache[FEC_NR_DECODE_ENTRIES];
+	int nr_dec_cache, next_dec_entry;
 };
 
 void init_fec(void);
@@ -96,16 +118,6 @@ void fec_encode(const struct fec *code,
 		const int *const block_nums,
 		size_t num_block_nums, size_t sz);
 
-void fec_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
-		       char *buf, int idx, uint32_t object_size);
-
-/* for isa-l */
-
-#if defined __x86_64__ && defined(ENABLE_ISAL)
-void isa_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
-		       char *buf, int idx, uint32_t object_size);
-#endif
-
 /*
  * @param inpkts an array of packets (size k); If a primary block, i, is present
  * then it must be at index i. Secondary blocks can appear anywhere.
@@ -120,10 +132,6 @@ void fec_decode(const struct fec *code,
 		uint8_t *const *const outpkts,
 		const int *const index, size_t sz);
 
-/* Set data stripe as sector size to make VM happy */
-#define SD_EC_DATA_STRIPE_SIZE (512) /* 512 Byte */
-#define SD_EC_MAX_STRIP (16)
-
 static inline int ec_policy_to_dp(uint8_t policy, int *d, int *p)
 {
 	int ed = 0, ep = 0;
@@ -165,13 +173,23 @@ static inline struct fec *ec_init(int d, int dp)
 }
 
 /*
- * This function decodes the data strips and return the parity strips
+ * Return the shared erasure code context of the policy.  It is created on the
+ * first use and never freed, so don't call ec_destroy() for it.
+ */
+struct fec *ec_get(int d, int dp);
+
+/*
+ * This function encodes the data strips and return the parity strips
  *
  * @ds: data strips to generate parity strips
  * @ps: parity strips to return
+ * @len: length of each strip
+ *
+ * The strips of the consecutive stripes can be encoded at once, if they are
+ * contiguous in ds and ps.
  */
-static inline void ec_encode(struct fec *ctx, const uint8_t *ds[],
-			     uint8_t *ps[])
+static inline void ec_encode_buffer(struct fec *ctx, const uint8_t *ds[],
+				    uint8_t *ps[], size_t len)
 {
 	int p = ctx->dp - ctx->d;
 
@@ -183,14 +201,20 @@ static inline void ec_encode(struct fec *ctx, const uint8_t *ds[],
 #endif
 
 #if defined __x86_64__ && defined(ENABLE_ISAL)
-		ec_encode_data(SD_EC_DATA_STRIPE_SIZE / ctx->d, ctx->d, p,
-				   ctx->ec_tbl, (unsigned char **)ds, ps);
+		ec_encode_data(len, ctx->d, p, ctx->ec_tbl,
+			       (unsigned char **)ds, ps);
 #else
-		fec_encode(ctx, ds, ps, pidx, p, SD_EC_DATA_STRIPE_SIZE /
-			   ctx->d);
+		fec_encode(ctx, ds, ps, pidx, p, len);
 #endif
 }
 
+/* Encode one stripe */
+static inline void ec_encode(struct fec *ctx, const uint8_t *ds[],
+			     uint8_t *ps[])
+{
+	ec_encode_buffer(ctx, ds, ps, SD_EC_DATA_STRIPE_SIZE / ctx->d);
+}
+
 /*
  * This function takes input strips and return the lost strip
  *
@@ -210,14 +234,12 @@ static inline void ec_destroy(struct fec *ctx)
 	fec_free(ctx);
 }
 
-static inline void ec_decode_buffer(struct fec *ctx, uint8_t *input[],
-				    const int in_idx[], char *buf,
-				    int idx, uint32_t object_size)
-{
-#if defined __x86_64__ && defined(ENABLE_ISAL)
-		isa_decode_buffer(ctx, input, in_idx, buf, idx, object_size);
-#else
-		fec_decode_buffer(ctx, input, in_idx, buf, idx, object_size);
-#endif
-}
+/*
+ * Rebuild the strips of the object at 'idx' into buf
+ *
+ * @input: the d object strips which are used to rebuild
+ * @in_idx: indexes of the input strips, must be in numeric order
+ */
+void ec_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
+		      char *buf, int idx, uint32_t object_size);
 #endif
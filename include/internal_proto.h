@@ -115,6 +115,9 @@
 #define SD_OP_SET_RECOVERY      0xCB
 #define SD_OP_SET_VNODES 0xCC
 #define SD_OP_GET_VNODES 0xCD
+#define SD_OP_GET_OBJ_LIST_RANGE 0xCE
+#define SD_OP_READ_DELTA_PEER 0xCF
+#define SD_OP_READ_BATCH_PEER 0xD0
 
 /* internal flags for hdr.flags, must be above 0x80 */
 #define SD_FLAG_CMD_RECOVERY 0x0080
@@ -335,6 +338,17 @@ struct recovery_state {
 	uint64_t nr_total;
 };
 
+/* The maximum reply length of SD_OP_READ_BATCH_PEER */
+#define SD_READ_BATCH_MAX_LEN (UINT32_C(1) << 20)
+
+/* An object in the reply of SD_OP_READ_BATCH_PEER */
+struct obj_batch_entry {
+	uint64_t oid;
+	uint32_t result;
+	uint32_t length;	/* length of the data which follows */
+	uint64_t offset;	/* offset of the data, zeros around it are cut */
+};
+
 #define CACHE_MAX	1024
 struct cache_info {
 	uint32_t vid;
@@ -368,6 +382,27 @@ struct sd_stat {
 		uint64_t peer_total_read_nr;
 		uint64_t peer_total_write_nr;
 	} r;
+	struct s_cache {
+		uint64_t hit_nr; /* nr of reads served by the read cache */
+		uint64_t miss_nr;
+		uint64_t cache_size; /* Bytes of the cached objects */
+	} c;
+	struct s_journal {
+		uint64_t checkpoint_nr; /* nr of committed journal files */
+		uint64_t checkpoint_obj_nr; /* nr of synced objects */
+		uint64_t checkpoint_time; /* Total checkpoint time in usec */
+		uint64_t max_checkpoint_time;
+	} j;
+	struct s_objlist {
+		uint64_t nr_objs; /* nr of objects in the object list cache */
+		uint64_t mem_size; /* Bytes of the sorted arrays of the cache */
+	} o;
+	struct s_workqueue {
+		uint64_t done_nr; /* nr of the done callbacks called */
+		uint64_t batch_nr; /* nr of the batches of finished works */
+		uint64_t total_latency; /* Total delivery latency in usec */
+		uint64_t max_latency;
+	} w;
 };
 
 void sd_inode_stat(const struct sd_inode *inode, uint64_t *, uint64_t *);
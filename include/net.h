@@ -63,6 +63,8 @@ int send_req(int sockfd, struct sd_req *hdr, void *data, unsigned int wlen,
 	     bool (*need_retry)(uint32_t), uint32_t, uint32_t);
 int exec_req(int sockfd, struct sd_req *hdr, void *,
 	     bool (*need_retry)(uint32_t), uint32_t, uint32_t);
+int send_file(int sockfd, int fd, off_t offset, size_t len,
+	      bool (*need_retry)(uint32_t), uint32_t, uint32_t);
 int do_read(int sockfd, void *buf, uint32_t len,
 	    bool (*need_retry)(uint32_t), uint32_t, uint32_t);
 int create_listen_ports(const char *bindaddr, int port,
@@ -33,6 +33,17 @@ struct vnode_info {
 	int nr_nodes;
 	int nr_zones;
 	refcnt_t refcnt;
+
+	/*
+	 * Flat placement table built from vroot by alloc_vnode_info().  vhash
+	 * is the sorted hashes of the vnodes, and placement[i * width + k] is
+	 * the k-th vnode of the objects whose first vnode is the i-th one.
+	 * width is min(nr_zones, SD_MAX_COPIES), the most vnodes we look up.
+	 */
+	int nr_vnodes;
+	int width;
+	uint64_t *vhash;
+	const struct sd_vnode **placement;
 };
 
 static inline void sd_init_req(struct sd_req *req, uint8_t opcode)
@@ -117,6 +128,68 @@ static inline void oid_to_nodes(uint64_t oid, struct rb_root *root,
 		nodes[i] = vnodes[i]->node;
 }
 
+/* Return the index in the placement table of the first vnode of the oid */
+static inline int oid_to_placement_idx(uint64_t oid,
+				       const struct vnode_info *vinfo)
+{
+	uint64_t hash = sd_hash_oid(oid);
+	int lo = 0, hi = vinfo->nr_vnodes, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (vinfo->vhash[mid] < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo == vinfo->nr_vnodes ? 0 : lo; /* Wrap around */
+}
+
+/* Same as oid_to_vnodes(), but look up the placement table of 'vinfo' */
+static inline void vinfo_oid_to_vnodes(uint64_t oid, struct vnode_info *vinfo,
+				       int nr_copies,
+				       const struct sd_vnode **vnodes)
+{
+	int idx;
+
+	if (unlikely(!vinfo->nr_vnodes || nr_copies > vinfo->width)) {
+		oid_to_vnodes(oid, &vinfo->vroot, nr_copies, vnodes);
+		return;
+	}
+
+	idx = oid_to_placement_idx(oid, vinfo);
+	memcpy(vnodes, vinfo->placement + (size_t)idx * vinfo->width,
+	       nr_copies * sizeof(*vnodes));
+}
+
+static inline const struct sd_vnode *
+vinfo_oid_to_vnode(uint64_t oid, struct vnode_info *vinfo, int copy_idx)
+{
+	if (unlikely(!vinfo->nr_vnodes || copy_idx >= vinfo->width))
+		return oid_to_vnode(oid, &vinfo->vroot, copy_idx);
+
+	return vinfo->placement[(size_t)oid_to_placement_idx(oid, vinfo) *
+				vinfo->width + copy_idx];
+}
+
+static inline const struct sd_node *
+vinfo_oid_to_node(uint64_t oid, struct vnode_info *vinfo, int copy_idx)
+{
+	return vinfo_oid_to_vnode(oid, vinfo, copy_idx)->node;
+}
+
+static inline void vinfo_oid_to_nodes(uint64_t oid, struct vnode_info *vinfo,
+				      int nr_copies,
+				      const struct sd_node **nodes)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+
+	vinfo_oid_to_vnodes(oid, vinfo, nr_copies, vnodes);
+	for (int i = 0; i < nr_copies; i++)
+		nodes[i] = vnodes[i]->node;
+}
+
 static inline const char *sd_strerror(int err)
 {
 	static const char *descs[256] = {
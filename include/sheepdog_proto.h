@@ -196,6 +196,11 @@ struct sd_req {
 			uint8_t		addr[16];
 			uint16_t	port;
 		} forw;
+		struct {
+			uint64_t	start; /* the first oid to return */
+			uint8_t		addr[16]; /* the node to recover */
+			uint16_t	port;
+		} obj_list;
 		struct {
 			uint32_t        get; /* 0 means free, 1 means get */
 			uint32_t        tgt_epoch;
@@ -333,6 +338,8 @@ struct recovery_throttling {
 	uint32_t max_exec_count;
 	uint64_t queue_work_interval;
 	bool throttling;
+	/* foreground latency target in usec, 0 disables adaptive throttling */
+	uint64_t latency_slo;
 };
 
 struct sd_inode {
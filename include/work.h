@@ -22,10 +22,20 @@ struct work_queue {
 	struct list_head pending_list;
 };
 
+/* Statistics of the completion delivery to the main thread */
+struct wq_stat {
+	uint64_t nr_done;	/* number of the done callbacks called */
+	uint64_t nr_batches;	/* number of the batches of finished works */
+	/* time from the completion of a batch to the main thread (usec) */
+	uint64_t total_latency;
+	uint64_t max_latency;
+};
+
 enum wq_thread_control {
 	WQ_ORDERED, /* Only 1 thread created for work queue */
 	WQ_DYNAMIC, /* # of threads proportional to nr_nodes created */
 	WQ_FIXED, /* Fixed # of threads created */
+	WQ_LOCKFREE, /* Fixed # of threads with lock-free per-thread queues */
 };
 
 static inline bool is_main_thread(void)
@@ -63,8 +73,13 @@ int init_work_queue(size_t (*get_nr_nodes)(void));
 struct work_queue *create_work_queue(const char *name, enum wq_thread_control);
 struct work_queue *create_ordered_work_queue(const char *name);
 struct work_queue *create_fixed_work_queue(const char *name, int nr_threads);
+struct work_queue *create_lockfree_work_queue(const char *name,
+					      int nr_threads);
 void queue_work(struct work_queue *q, struct work *work);
 bool work_queue_empty(struct work_queue *q);
+size_t work_queue_length(struct work_queue *q);
+void work_queue_get_stat(struct work_queue *q, struct wq_stat *stat);
+void work_queue_get_total_stat(struct wq_stat *stat);
 int wq_trace_init(void);
 void set_max_dynamic_threads(size_t nr_max);
 
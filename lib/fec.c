@@ -59,6 +59,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 #include "fec.h"
 #include "logger.h"
 #include "util.h"
@@ -211,7 +215,7 @@ static void generate_gf(void)
  */
 #define addmul(dst, src, c, sz)                 \
 	if (c != 0)				\
-		_addmul1(dst, src, c, sz)
+		addmul_fn(dst, src, c, sz)
 
 #define UNROLL 16               /* 1, 4, 8, 16 */
 static void _addmul1(register uint8_t *dst,
@@ -252,6 +256,80 @@ static void _addmul1(register uint8_t *dst,
 		GF_ADDMULC(*dst, *src);
 }
 
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/*
+ * SIMD versions of _addmul1(), selected at run time by init_fec()
+ *
+ * c * x = c * (x & 0x0f) ^ c * (x & 0xf0), so we look up the products of the
+ * low and high nibbles in two 16 byte tables with pshufb.
+ */
+static void gf_nibble_tables(uint8_t c, uint8_t lo[16], uint8_t hi[16])
+{
+	for (int i = 0; i < 16; i++) {
+		lo[i] = gf_mul(c, i);
+		hi[i] = gf_mul(c, i << 4);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void _addmul1_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c,
+			   size_t sz)
+{
+	uint8_t lo[16], hi[16];
+	__m128i tlo, thi, mask = _mm_set1_epi8(0x0f);
+	size_t i;
+
+	gf_nibble_tables(c, lo, hi);
+	tlo = _mm_loadu_si128((const __m128i *)lo);
+	thi = _mm_loadu_si128((const __m128i *)hi);
+	for (i = 0; i + 16 <= sz; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(x, mask));
+		__m128i h = _mm_shuffle_epi8(thi,
+				_mm_and_si128(_mm_srli_epi64(x, 4), mask));
+
+		d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+	if (i < sz)
+		_addmul1(dst + i, src + i, c, sz - i);
+}
+
+__attribute__((target("avx2")))
+static void _addmul1_avx2(uint8_t *dst, const uint8_t *src, uint8_t c,
+			  size_t sz)
+{
+	uint8_t lo[16], hi[16];
+	__m256i tlo, thi, mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+
+	gf_nibble_tables(c, lo, hi);
+	/* vpshufb looks up in each 128 bit lane */
+	tlo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)lo));
+	thi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)hi));
+	for (i = 0; i + 32 <= sz; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask));
+		__m256i h = _mm256_shuffle_epi8(thi,
+			_mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+
+		d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+	if (i < sz)
+		_addmul1(dst + i, src + i, c, sz - i);
+}
+
+#endif
+
+static void (*addmul_fn)(uint8_t *dst, const uint8_t *src, uint8_t c,
+			 size_t sz) = _addmul1;
+
 /* computes C = AB where A is dp*d, B is d*m, C is dp*m */
 static void _matmul(uint8_t *a, uint8_t *b, uint8_t *c, unsigned dp, unsigned d,
 		    unsigned m)
@@ -440,6 +518,14 @@ void init_fec(void)
 {
 	generate_gf();
 	_init_mul_table();
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		addmul_fn = _addmul1_avx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		addmul_fn = _addmul1_ssse3;
+#endif
 }
 
 /*
@@ -458,6 +544,7 @@ void fec_free(struct fec *p)
 #if defined __x86_64__ && defined(ENABLE_ISAL)
 		free(p->ec_tbl);
 #endif
+	sd_destroy_mutex(&p->dec_lock);
 	free(p);
 }
 
@@ -468,7 +555,8 @@ struct fec *fec_new(unsigned short d, unsigned short dp)
 
 	struct fec *retval;
 
-	retval = (struct fec *)xmalloc(sizeof(struct fec));
+	retval = (struct fec *)xzalloc(sizeof(struct fec));
+	sd_init_mutex(&retval->dec_lock);
 	retval->d = d;
 	retval->dp = dp;
 	retval->enc_matrix = NEW_GF_MATRIX(dp, d);
@@ -698,50 +786,97 @@ out:
 	memcpy(output, dp[idx], strip_size);
 }
 
-void fec_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
-		      char *buf, int idx, uint32_t object_size)
+/* Shared contexts indexed by the number of data and parity strips */
+static struct fec *ec_contexts[SD_EC_MAX_STRIP + 1][SD_EC_MAX_STRIP];
+
+struct fec *ec_get(int d, int dp)
 {
-	int i, j, d = ctx->d;
-	size_t strip_size = SD_EC_DATA_STRIPE_SIZE / d;
-	uint32_t nr_stripe_per_object = object_size / SD_EC_DATA_STRIPE_SIZE;
-
-	for (i = 0; i < nr_stripe_per_object; i++) {
-		const uint8_t *in[d];
-		uint8_t out[strip_size];
-
-		for (j = 0; j < d; j++)
-			in[j] = input[j] + strip_size * i;
-		ec_decode(ctx, in, in_idx, out, idx);
-		memcpy(buf + strip_size * i, out, strip_size);
+	struct fec **slot, *ctx, *old;
+
+	sd_assert(d > 0 && d <= SD_EC_MAX_STRIP);
+	sd_assert(dp > d && dp - d < SD_EC_MAX_STRIP);
+
+	slot = &ec_contexts[d][dp - d];
+	ctx = uatomic_read(slot);
+	if (likely(ctx))
+		return ctx;
+
+	ctx = fec_new(d, dp);
+	old = uatomic_cmpxchg(slot, NULL, ctx);
+	if (old) {
+		/* Somebody else created it in the meantime */
+		fec_free(ctx);
+		return old;
 	}
+
+	return ctx;
 }
 
-#if defined __x86_64__ && defined(ENABLE_ISAL)
-void isa_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
-		       char *buf, int idx, uint32_t object_size)
+/*
+ * Copy the cached decode coefficients to 'out', computing them if necessary.
+ * The cache entry can be replaced by other threads as soon as we release the
+ * lock, so the caller must not use it directly.
+ */
+static void get_decode_entry(struct fec *ctx, const int in_idx[], int idx,
+			     struct fec_decode_entry *out)
 {
-	int ed = ctx->d, edp = ctx->dp, len = object_size / ed, i;
-	unsigned char ec_tbl[ed * edp * 32];
-	unsigned char bm[ed * ed];
-	unsigned char cm[ed];
-	unsigned char dm[ed * ed];
-	unsigned char em[ed * ed];
-	unsigned char *lost[1];
+	int ed = ctx->d, i;
+	uint32_t in_mask = 0;
+	struct fec_decode_entry *ent = NULL;
+	uint8_t m[ed * ed];
 
 	for (i = 0; i < ed; i++)
-		memcpy(bm + (i * ed), ctx->enc_matrix + (in_idx[i] * ed), ed);
-
-	gf_invert_matrix(bm, dm, ed);
+		in_mask |= 1U << in_idx[i];
 
-	if (idx < ed)
-		memcpy(cm, dm + (idx * ed), ed);
-	else {
-		memcpy(em, ctx->enc_matrix + (idx * ed), ed);
-		_matmul(em, dm, cm, 1, ed, ed);
+	sd_mutex_lock(&ctx->dec_lock);
+	for (i = 0; i < ctx->nr_dec_cache; i++) {
+		ent = ctx->dec_cache + i;
+		if (ent->in_mask == in_mask && ent->idx == idx)
+			goto out;
 	}
 
-	lost[0] = (unsigned char *)buf;
-	ec_init_tables(ed, 1, cm, ec_tbl);
-	ec_encode_data(len, ed, 1, ec_tbl, input, lost);
+	ent = ctx->dec_cache + ctx->next_dec_entry;
+	ctx->next_dec_entry = (ctx->next_dec_entry + 1) % FEC_NR_DECODE_ENTRIES;
+	ctx->nr_dec_cache = min(ctx->nr_dec_cache + 1, FEC_NR_DECODE_ENTRIES);
+
+	for (i = 0; i < ed; i++)
+		memcpy(m + i * ed, ctx->enc_matrix + in_idx[i] * ed, ed);
+	_invert_mat(m, ed);
+
+	if (idx < ed)
+		memcpy(ent->coef, m + idx * ed, ed);
+	else
+		_matmul(ctx->enc_matrix + idx * ed, m, ent->coef, 1, ed, ed);
+#if defined __x86_64__ && defined(ENABLE_ISAL)
+	ec_init_tables(ed, 1, ent->coef, ent->ec_tbl);
+#endif
+	ent->in_mask = in_mask;
+	ent->idx = idx;
+out:
+	*out = *ent;
+	sd_mutex_unlock(&ctx->dec_lock);
 }
+
+/*
+ * The strips of the object are decoded at once with the same coefficients, so
+ * we don't have to invert the matrix for each stripe.
+ */
+void ec_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
+		      char *buf, int idx, uint32_t object_size)
+{
+	struct fec_decode_entry ent;
+	int ed = ctx->d;
+	size_t len = object_size / ed;
+
+	get_decode_entry(ctx, in_idx, idx, &ent);
+
+#if defined __x86_64__ && defined(ENABLE_ISAL)
+	unsigned char *lost[1] = { (unsigned char *)buf };
+
+	ec_encode_data(len, ed, 1, (unsigned char *)ent.ec_tbl, input, lost);
+#else
+	memset(buf, 0, len);
+	for (int i = 0; i < ed; i++)
+		addmul((uint8_t *)buf, input[i], ent.coef[i], len);
 #endif
+}
@@ -21,6 +21,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -324,6 +325,54 @@ int send_req(int sockfd, struct sd_req *hdr, void *data, unsigned int wlen,
 	return ret;
 }
 
+/*
+ * Send 'len' bytes of the file 'fd' at 'offset' to the socket without copying
+ * them to the user space.  If the file is shorter than that, the rest is
+ * padded with zeros so that the peer always receives 'len' bytes.
+ */
+int send_file(int sockfd, int fd, off_t offset, size_t len,
+	      bool (*need_retry)(uint32_t epoch), uint32_t epoch,
+	      uint32_t max_count)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t ret;
+	int repeat = max_count;
+
+	while (len) {
+		ret = sendfile(sockfd, fd, &offset, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN && repeat &&
+			    (need_retry == NULL || need_retry(epoch))) {
+				repeat--;
+				continue;
+			}
+
+			sd_err("failed to send file to socket: %m");
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		len -= ret;
+	}
+
+	if (len == 0)
+		return 0;
+
+	sd_debug("pad %zu bytes after the end of file", len);
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = xzalloc(len);
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	ret = do_write(sockfd, &msg, len, need_retry, epoch, max_count);
+	free(iov.iov_base);
+
+	return ret ? -1 : 0;
+}
+
 int exec_req(int sockfd, struct sd_req *hdr, void *data,
 	     bool (*need_retry)(uint32_t epoch), uint32_t epoch,
 	     uint32_t max_count)
@@ -24,6 +24,7 @@
 #include <syscall.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <linux/types.h>
 #include <signal.h>
 
@@ -47,6 +48,54 @@ static size_t max_dynamic_threads = 0;
  */
 #define WQ_PROTECTION_PERIOD 1000 /* ms */
 
+/*
+ * Lock-free work queue (WQ_LOCKFREE)
+ *
+ * Each worker has its own bounded MPMC ring.  queue_work() distributes works
+ * to the rings in round-robin order and the workers steal works from the
+ * other rings when their own one is empty, so neither producers nor consumers
+ * take a lock in the common case.  Only when all the rings are full, works are
+ * queued to the pending list under pending_lock.
+ *
+ * Finished works are pushed onto a lock-free stack and the main thread picks
+ * up the whole stack at once.
+ */
+#define LF_RING_SIZE 1024 /* must be a power of 2 */
+
+/*
+ * Completion delivery
+ *
+ * Each work queue has a slot in wq_table and a bit in wq_dirty_map.  A worker
+ * which finishes a work marks the queue dirty and writes the event fd only if
+ * the queue was clean, so the main thread visits only the queues which have
+ * finished works and is woken up once per batch of completions.  The main
+ * thread runs at most WQ_DONE_BATCH done callbacks of a queue at a time, and
+ * marks the queue dirty again if more are left, so that a busy queue doesn't
+ * starve the other events.
+ */
+#define WQ_MAX_QUEUES 256
+#define WQ_DONE_BATCH 128
+
+struct lf_cell {
+	unsigned long seq;
+	struct work *work;
+};
+
+struct lf_ring {
+	unsigned long enq_pos;
+	unsigned long deq_pos;
+	struct lf_cell cells[LF_RING_SIZE];
+};
+
+struct lf_worker {
+	struct wq_info *wi;
+	int idx;
+	/* the idle worker sleeps on this */
+	int efd;
+	unsigned long idle;
+	struct lf_ring ring;
+};
+
 struct wq_info {
 	const char *name;
 
@@ -69,6 +118,24 @@ struct wq_info {
 	/* we cannot shrink work queue till this time */
 	uint64_t tm_end_of_protection;
 	enum wq_thread_control tc;
+
+	/* for WQ_LOCKFREE */
+	struct lf_worker *workers;
+	unsigned long next_worker;
+	/* number of the works in pending_list */
+	unsigned long nr_overflow;
+	/* stack of the finished works, linked by w_list.next */
+	struct list_node *finished_stack;
+
+	/* index in wq_table */
+	int idx;
+	/* set when there are finished works the main thread hasn't seen */
+	unsigned long dirty;
+	/* when the oldest unseen work finished, in microseconds */
+	uint64_t tm_finished;
+	/* finished works to be done, accessed only by the main thread */
+	struct list_head done_list;
+	struct wq_stat stat;
 };
 
 static int efd;
@@ -77,6 +144,10 @@ static size_t nr_nodes = 1;
 static size_t (*wq_get_nr_nodes)(void);
 static size_t nr_cores = 1;
 
+static struct wq_info *wq_table[WQ_MAX_QUEUES];
+static DECLARE_BITMAP(wq_dirty_map, WQ_MAX_QUEUES);
+static int nr_wq_infos;
+
 static void *worker_routine(void *arg);
 
 #ifdef HAVE_TRACE
@@ -202,6 +273,26 @@ static uint64_t get_msec_time(void)
 	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+static uint64_t get_usec_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint64_t wq_get_dynamic_roof(void)
+{
+	uint64_t nr;
+
+	if (max_dynamic_threads > 0)
+		return (uint64_t)max_dynamic_threads;
+
+	/* max(#nodes,#cores,16)*2 threads */
+	nr = (uint64_t)max(nr_nodes, nr_cores);
+	return max(nr, UINT64_C(16)) * 2;
+}
+
 static inline uint64_t wq_get_roof(struct wq_info *wi)
 {
 	uint64_t nr = 1;
@@ -210,15 +301,10 @@ static inline uint64_t wq_get_roof(struct wq_info *wi)
 	case WQ_ORDERED:
 		break;
 	case WQ_DYNAMIC:
-		if (max_dynamic_threads > 0) {
-			nr = (uint64_t)max_dynamic_threads;
-		} else {
-			/* max(#nodes,#cores,16)*2 threads */
-			nr = (uint64_t)max(nr_nodes, nr_cores);
-			nr = max(nr, UINT64_C(16)) * 2;
-		}
+		nr = wq_get_dynamic_roof();
 		break;
 	case WQ_FIXED:
+	case WQ_LOCKFREE:
 		nr = wi->nr_threads;
 		break;
 	default:
@@ -289,6 +375,104 @@ static int create_worker_threads(struct wq_info *wi, size_t nr_threads)
 	return 0;
 }
 
+static void lf_ring_init(struct lf_ring *r)
+{
+	for (unsigned long i = 0; i < LF_RING_SIZE; i++)
+		r->cells[i].seq = i;
+}
+
+/*
+ * Bounded MPMC queue by Dmitry Vyukov.  The sequence number of each cell tells
+ * whether the cell is ready to be written (seq == pos) or read
+ * (seq == pos + 1).  Full barriers of cmpxchg and xchg order the accesses to
+ * the cell.
+ */
+static bool lf_ring_push(struct lf_ring *r, struct work *work)
+{
+	unsigned long pos = uatomic_read(&r->enq_pos);
+	struct lf_cell *cell;
+	long diff;
+
+	for (;;) {
+		cell = &r->cells[pos & (LF_RING_SIZE - 1)];
+		diff = (long)uatomic_read(&cell->seq) - (long)pos;
+		if (diff == 0) {
+			if (uatomic_cmpxchg(&r->enq_pos, pos, pos + 1) == pos)
+				break;
+		} else if (diff < 0) {
+			return false; /* full */
+		}
+		pos = uatomic_read(&r->enq_pos);
+	}
+
+	cell->work = work;
+	uatomic_xchg(&cell->seq, pos + 1);
+
+	return true;
+}
+
+static struct work *lf_ring_pop(struct lf_ring *r)
+{
+	unsigned long pos = uatomic_read(&r->deq_pos);
+	struct lf_cell *cell;
+	struct work *work;
+	long diff;
+
+	for (;;) {
+		cell = &r->cells[pos & (LF_RING_SIZE - 1)];
+		diff = (long)uatomic_read(&cell->seq) - (long)(pos + 1);
+		if (diff == 0) {
+			if (uatomic_cmpxchg(&r->deq_pos, pos, pos + 1) == pos)
+				break;
+		} else if (diff < 0) {
+			return NULL; /* empty */
+		}
+		pos = uatomic_read(&r->deq_pos);
+	}
+
+	work = cell->work;
+	uatomic_xchg(&cell->seq, pos + LF_RING_SIZE);
+
+	return work;
+}
+
+static inline bool lf_wake_worker(struct lf_worker *w)
+{
+	if (uatomic_cmpxchg(&w->idle, 1, 0) != 1)
+		return false;
+
+	eventfd_xwrite(w->efd, 1);
+	return true;
+}
+
+static void lf_queue_work(struct wq_info *wi, struct work *work)
+{
+	unsigned long start = uatomic_add_return(&wi->next_worker, 1);
+	size_t nr = wi->nr_threads;
+	struct lf_worker *w;
+
+	for (size_t i = 0; i < nr; i++) {
+		w = wi->workers + (start + i) % nr;
+		if (lf_ring_push(&w->ring, work))
+			goto wake;
+	}
+
+	/* All the rings are full */
+	sd_mutex_lock(&wi->pending_lock);
+	list_add_tail(&work->w_list, &wi->q.pending_list);
+	uatomic_inc(&wi->nr_overflow);
+	sd_mutex_unlock(&wi->pending_lock);
+	w = wi->workers + start % nr;
+wake:
+	if (lf_wake_worker(w))
+		return;
+
+	/* The owner of the ring is busy, let an idle worker steal the work */
+	for (size_t i = 0; i < nr; i++)
+		if (lf_wake_worker(wi->workers + i))
+			return;
+}
+
 void queue_work(struct work_queue *q, struct work *work)
 {
 	struct wq_info *wi = container_of(q, struct wq_info, q);
@@ -297,6 +481,11 @@ void queue_work(struct work_queue *q, struct work *work)
 	tracepoint(work, queue_work, wi, work);
 
 	uatomic_inc(&wi->nr_queued_work);
+	if (wi->tc == WQ_LOCKFREE) {
+		lf_queue_work(wi, work);
+		return;
+	}
+
 	sd_mutex_lock(&wi->pending_lock);
 
 	new_nr_threads = wq_need_grow(wi);
@@ -309,30 +498,184 @@ void queue_work(struct work_queue *q, struct work *work)
 	sd_cond_signal(&wi->pending_cond);
 }
 
-static void worker_thread_request_done(int fd, int events, void *data)
+/*
+ * Called after a work is added to the finished works.  The full barriers of
+ * xchg make sure that the main thread sees the work when it clears the dirty
+ * flag after we set it.
+ */
+static void wq_mark_dirty(struct wq_info *wi)
 {
-	struct wq_info *wi;
+	if (!uatomic_read(&wi->tm_finished))
+		uatomic_cmpxchg(&wi->tm_finished, 0, get_usec_time());
+
+	if (uatomic_xchg(&wi->dirty, 1))
+		return;
+
+	atomic_set_bit(wi->idx, wq_dirty_map);
+	eventfd_xwrite(efd, 1);
+}
+
+/* Move the finished works of the lock-free work queue to the list */
+static void lf_splice_finished(struct wq_info *wi, struct list_head *list)
+{
+	struct list_node *n, *next;
+	LIST_HEAD(tmp);
+
+	n = uatomic_xchg_ptr(&wi->finished_stack, NULL);
+	/* The stack is in LIFO order, adding to the head reverses it */
+	while (n) {
+		next = n->next;
+		list_add(n, &tmp);
+		n = next;
+	}
+	list_splice_tail_init(&tmp, list);
+}
+
+static void lf_work_done(struct wq_info *wi, struct work *work)
+{
+	struct list_node *head;
+
+	do {
+		head = uatomic_read(&wi->finished_stack);
+		work->w_list.next = head;
+	} while (uatomic_cmpxchg(&wi->finished_stack, head,
+				 &work->w_list) != head);
+
+	wq_mark_dirty(wi);
+}
+
+static struct work *lf_get_work(struct lf_worker *w)
+{
+	struct wq_info *wi = w->wi;
+	size_t nr = wi->nr_threads;
 	struct work *work;
-	LIST_HEAD(list);
 
-	if (wq_get_nr_nodes)
-		nr_nodes = wq_get_nr_nodes();
+	work = lf_ring_pop(&w->ring);
+	if (work)
+		return work;
 
-	eventfd_xread(fd);
+	/* Steal works from the other workers */
+	for (size_t i = 1; i < nr; i++) {
+		work = lf_ring_pop(&wi->workers[(w->idx + i) % nr].ring);
+		if (work)
+			return work;
+	}
 
-	list_for_each_entry(wi, &wq_info_list, list) {
+	if (!uatomic_read(&wi->nr_overflow))
+		return NULL;
+
+	sd_mutex_lock(&wi->pending_lock);
+	if (!list_empty(&wi->q.pending_list)) {
+		work = list_first_entry(&wi->q.pending_list, struct work,
+					w_list);
+		list_del(&work->w_list);
+		uatomic_dec(&wi->nr_overflow);
+	}
+	sd_mutex_unlock(&wi->pending_lock);
+
+	return work;
+}
+
+static void *lf_worker_routine(void *arg)
+{
+	struct lf_worker *w = arg;
+	struct wq_info *wi = w->wi;
+	struct work *work;
+
+	set_thread_name(wi->name, true);
+
+	trace_set_tid_map(gettid());
+	while (true) {
+		work = lf_get_work(w);
+		if (!work) {
+			/*
+			 * Announce that we are going to sleep and check the
+			 * queues again, so that the producer which doesn't see
+			 * the idle flag is seen by us.
+			 */
+			uatomic_xchg(&w->idle, 1);
+			work = lf_get_work(w);
+			if (!work) {
+				eventfd_xread(w->efd);
+				continue;
+			}
+			uatomic_set(&w->idle, 0);
+		}
+
+		tracepoint(work, do_work, wi, work);
+
+		if (work->fn)
+			work->fn(work);
+
+		lf_work_done(wi, work);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void wq_update_stat(struct wq_info *wi, uint64_t tm_finished)
+{
+	uint64_t latency;
+
+	if (!tm_finished)
+		return;
+
+	latency = get_usec_time() - tm_finished;
+	wi->stat.nr_batches++;
+	wi->stat.total_latency += latency;
+	wi->stat.max_latency = max(wi->stat.max_latency, latency);
+}
+
+static void wq_do_done(struct wq_info *wi)
+{
+	struct work *work;
+	int nr = 0;
+
+	uatomic_xchg(&wi->dirty, 0);
+	wq_update_stat(wi, uatomic_xchg(&wi->tm_finished, 0));
+
+	if (wi->tc == WQ_LOCKFREE)
+		lf_splice_finished(wi, &wi->done_list);
+	else {
 		sd_mutex_lock(&wi->finished_lock);
-		list_splice_init(&wi->finished_list, &list);
+		list_splice_tail_init(&wi->finished_list, &wi->done_list);
 		sd_mutex_unlock(&wi->finished_lock);
+	}
+
+	while (!list_empty(&wi->done_list) && nr++ < WQ_DONE_BATCH) {
+		work = list_first_entry(&wi->done_list, struct work, w_list);
+		list_del(&work->w_list);
+
+		tracepoint(work, request_done, wi, work);
 
-		while (!list_empty(&list)) {
-			work = list_first_entry(&list, struct work, w_list);
-			list_del(&work->w_list);
+		work->done(work);
+		uatomic_dec(&wi->nr_queued_work);
+		wi->stat.nr_done++;
+	}
 
-			tracepoint(work, request_done, wi, work);
+	/* Come back after handling the other events */
+	if (!list_empty(&wi->done_list) && !uatomic_xchg(&wi->dirty, 1)) {
+		atomic_set_bit(wi->idx, wq_dirty_map);
+		eventfd_xwrite(efd, 1);
+	}
+}
 
-			work->done(work);
-			uatomic_dec(&wi->nr_queued_work);
+static void worker_thread_request_done(int fd, int events, void *data)
+{
+	unsigned long dirty;
+	int nr;
+
+	if (wq_get_nr_nodes)
+		nr_nodes = wq_get_nr_nodes();
+
+	eventfd_xread(fd);
+
+	for (int i = 0; i < BITS_TO_LONGS(nr_wq_infos); i++) {
+		dirty = uatomic_xchg(&wq_dirty_map[i], 0);
+		while (dirty) {
+			nr = __ffs(dirty);
+			dirty &= ~(1UL << nr);
+			wq_do_done(wq_table[i * BITS_PER_LONG + nr]);
 		}
 	}
 }
@@ -380,7 +723,7 @@ retest:
 		list_add_tail(&work->w_list, &wi->finished_list);
 		sd_mutex_unlock(&wi->finished_lock);
 
-		eventfd_xwrite(efd, 1);
+		wq_mark_dirty(wi);
 	}
 
 	pthread_exit(NULL);
@@ -411,12 +754,26 @@ int init_work_queue(size_t (*get_nr_nodes)(void))
 	return 0;
 }
 
+static void register_wq_info(struct wq_info *wi)
+{
+	if (nr_wq_infos >= WQ_MAX_QUEUES)
+		panic("too many work queues, %s", wi->name);
+
+	INIT_LIST_HEAD(&wi->done_list);
+	wi->idx = nr_wq_infos;
+	wq_table[nr_wq_infos++] = wi;
+	list_add(&wi->list, &wq_info_list);
+}
+
 struct work_queue *create_work_queue(const char *name,
 				     enum wq_thread_control tc)
 {
 	int ret;
 	struct wq_info *wi;
 
+	if (tc == WQ_LOCKFREE)
+		return create_lockfree_work_queue(name, 0);
+
 	wi = xzalloc(sizeof(*wi));
 	wi->name = name;
 	wi->tc = tc;
@@ -435,7 +792,7 @@ struct work_queue *create_work_queue(const char *name,
 			goto destroy_threads;
 	}
 
-	list_add(&wi->list, &wq_info_list);
+	register_wq_info(wi);
 
 	tracepoint(work, create_queue, wi->name, wi, tc);
 	return &wi->q;
@@ -448,6 +805,55 @@ destroy_threads:
 	return NULL;
 }
 
+/*
+ * Create a lock-free work queue with a fixed number of threads.  If nr_threads
+ * is zero, the maximum number of threads of the dynamic work queue is used.
+ */
+struct work_queue *create_lockfree_work_queue(const char *name,
+					      int nr_threads)
+{
+	struct wq_info *wi;
+	struct lf_worker *w;
+	pthread_t thread;
+	int ret;
+
+	wi = xzalloc(sizeof(*wi));
+	wi->name = name;
+	wi->tc = WQ_LOCKFREE;
+	wi->nr_threads = nr_threads > 0 ? nr_threads : wq_get_dynamic_roof();
+
+	INIT_LIST_HEAD(&wi->q.pending_list);
+	INIT_LIST_HEAD(&wi->finished_list);
+	sd_cond_init(&wi->pending_cond);
+	sd_init_mutex(&wi->finished_lock);
+	sd_init_mutex(&wi->pending_lock);
+
+	wi->workers = xcalloc(wi->nr_threads, sizeof(*wi->workers));
+	for (size_t i = 0; i < wi->nr_threads; i++) {
+		w = wi->workers + i;
+		w->wi = wi;
+		w->idx = i;
+		lf_ring_init(&w->ring);
+		w->efd = eventfd(0, 0);
+		if (w->efd < 0)
+			panic("failed to create event fd: %m");
+	}
+
+	for (size_t i = 0; i < wi->nr_threads; i++) {
+		ret = pthread_create(&thread, NULL, lf_worker_routine,
+				     wi->workers + i);
+		if (ret != 0)
+			panic("failed to create a lock-free workqueue: %s",
+			      name);
+	}
+	sd_debug("create %zu threads for %s", wi->nr_threads, name);
+
+	register_wq_info(wi);
+
+	tracepoint(work, create_queue, wi->name, wi, WQ_LOCKFREE);
+	return &wi->q;
+}
+
 struct work_queue *create_ordered_work_queue(const char *name)
 {
 	return create_work_queue(name, WQ_ORDERED);
@@ -479,6 +885,37 @@ bool work_queue_empty(struct work_queue *q)
 	return uatomic_read(&wi->nr_queued_work) == 0;
 }
 
+/* Return the number of the works queued and not finished yet */
+size_t work_queue_length(struct work_queue *q)
+{
+	struct wq_info *wi = container_of(q, struct wq_info, q);
+
+	return uatomic_read(&wi->nr_queued_work);
+}
+
+/* Must be called in the main thread */
+void work_queue_get_stat(struct work_queue *q, struct wq_stat *stat)
+{
+	struct wq_info *wi = container_of(q, struct wq_info, q);
+
+	*stat = wi->stat;
+}
+
+/* Sum up the statistics of all the work queues, in the main thread */
+void work_queue_get_total_stat(struct wq_stat *stat)
+{
+	struct wq_info *wi;
+
+	memset(stat, 0, sizeof(*stat));
+	list_for_each_entry(wi, &wq_info_list, list) {
+		stat->nr_done += wi->stat.nr_done;
+		stat->nr_batches += wi->stat.nr_batches;
+		stat->total_latency += wi->stat.total_latency;
+		stat->max_latency = max(stat->max_latency,
+					wi->stat.max_latency);
+	}
+}
+
 void set_max_dynamic_threads(size_t nr_max)
 {
 	max_dynamic_threads = nr_max;
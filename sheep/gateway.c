@@ -113,6 +113,20 @@ out:
 	return buf;
 }
 
+/* Generate the parity strips of the requests from the data strips */
+static void encode_strips(struct fec *ctx, struct req_iter *reqs, size_t len)
+{
+	int ed = ctx->d, ep = ctx->dp - ctx->d;
+	const uint8_t *ds[ed];
+	uint8_t *ps[ep];
+
+	for (int i = 0; i < ed; i++)
+		ds[i] = reqs[i].buf;
+	for (int i = 0; i < ep; i++)
+		ps[i] = reqs[ed + i].buf;
+	ec_encode_buffer(ctx, ds, ps, len);
+}
+
 /*
  * We spread data strips of req along with its parity strips onto replica for
  * write operation. For read we only need to prepare data strip buffers.
@@ -134,7 +148,7 @@ static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
 	int ed = 0, ep = 0, edp;
 
 	edp = ec_policy_to_dp(policy, &ed, &ep);
-	ctx = ec_init(ed, edp);
+	ctx = ec_get(ed, edp);
 	*nr = nr_to_send = (opcode == SD_OP_READ_OBJ) ? ed : edp;
 	strip_size = SD_EC_DATA_STRIPE_SIZE / ed;
 	reqs = zalloc(sizeof(*reqs) * nr_to_send);
@@ -144,18 +158,19 @@ static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
 	sd_debug("start %d, end %d, send %d, off %"PRIu64 ", len %"PRIu32,
 		 start, end, nr_to_send, off, len);
 
+	/* The strip buffers share one allocation, owned by reqs[0].buf */
+	p = malloc(strip_size * nr_stripe * nr_to_send);
+	if (!p) {
+		sd_err("failed to init request buffer %016"PRIx64,
+		       req->rq.obj.oid);
+		free(reqs);
+		reqs = NULL;
+		goto out;
+	}
 	for (i = 0; i < nr_to_send; i++) {
 		int l = strip_size * nr_stripe;
 
-		reqs[i].buf = malloc(l);
-		if(!reqs[i].buf) {
-			sd_err("failed to init request buffer %016"PRIx64,
-			       req->rq.obj.oid);
-			for(j = 0; j < i; j++)
-				free(reqs[j].buf);
-			reqs = NULL;
-			goto out;
-		}
+		reqs[i].buf = (uint8_t *)p + l * i;
 		reqs[i].dlen = l;
 		reqs[i].off = start * strip_size;
 		switch (opcode) {
@@ -175,30 +190,20 @@ static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
 	if (!buf) {
 		sd_err("failed to init erasure buffer %016"PRIx64,
 		       req->rq.obj.oid);
-		for (i = 0; i < nr_to_send; i++)
-			free(reqs[i].buf);
+		free(reqs[0].buf);
 		free(reqs);
 		reqs = NULL;
 		goto out;
 	}
+	/* Scatter the data strips and encode all the stripes at once */
 	for (i = 0; i < nr_stripe; i++) {
-		const uint8_t *ds[ed];
-		uint8_t *ps[ep];
-
-		for (j = 0; j < ed; j++)
-			ds[j] = reqs[j].buf + strip_size * i;
-
-		for (j = 0; j < ep; j++)
-			ps[j] = reqs[ed + j].buf + strip_size * i;
-
 		for (j = 0; j < ed; j++)
-			memcpy((uint8_t *)ds[j], p + j * strip_size,
-			       strip_size);
-		ec_encode(ctx, ds, ps);
+			memcpy(reqs[j].buf + strip_size * i,
+			       p + j * strip_size, strip_size);
 		p += SD_EC_DATA_STRIPE_SIZE;
 	}
+	encode_strips(ctx, reqs, strip_size * nr_stripe);
 out:
-	ec_destroy(ctx);
 	free(buf);
 
 	return reqs;
@@ -264,12 +269,201 @@ static void finish_requests(struct request *req, struct req_iter *reqs,
 		req->rp.data_length = req->rq.data_length;
 		free(buf);
 	}
-	for (i = 0; i < nr_to_send; i++)
-		free(reqs[i].buf);
+	free(reqs[0].buf);
 out:
 	free(reqs);
 }
 
+#ifndef HAVE_ACCELIO
+
+struct forward_info {
+	struct work work;
+	uint64_t oid;
+	uint32_t epoch;
+	struct peer_io_batch batch;
+	struct peer_io *ios;
+	struct node_id *nids;
+	/* the requests still in flight when we replied to the client */
+	int nr_inflight;
+};
+
+/*
+ * Objects which have replicated writes still in flight after we replied to the
+ * client.  The requests to these objects wait for the stragglers, so that they
+ * don't read the old data from the stragglers or overtake the writes.
+ */
+struct straggler {
+	struct rb_node rb;
+	uint64_t oid;
+	int nr;
+};
+
+static struct rb_root straggler_root = RB_ROOT;
+static int nr_stragglers;
+static struct sd_mutex straggler_lock = SD_MUTEX_INITIALIZER;
+static struct sd_cond straggler_cond = SD_COND_INITIALIZER;
+
+static int straggler_cmp(const struct straggler *a, const struct straggler *b)
+{
+	return intcmp(a->oid, b->oid);
+}
+
+static void add_straggler(uint64_t oid)
+{
+	struct straggler *s = xzalloc(sizeof(*s)), *old;
+
+	s->oid = oid;
+	s->nr = 1;
+	sd_mutex_lock(&straggler_lock);
+	old = rb_insert(&straggler_root, s, rb, straggler_cmp);
+	if (old) {
+		old->nr++;
+		free(s);
+	}
+	uatomic_inc(&nr_stragglers);
+	sd_mutex_unlock(&straggler_lock);
+}
+
+static void del_straggler(uint64_t oid)
+{
+	struct straggler key = { .oid = oid }, *s;
+
+	sd_mutex_lock(&straggler_lock);
+	s = rb_search(&straggler_root, &key, rb, straggler_cmp);
+	sd_assert(s);
+	if (--s->nr == 0) {
+		rb_erase(&s->rb, &straggler_root);
+		free(s);
+	}
+	uatomic_dec(&nr_stragglers);
+	sd_cond_broadcast(&straggler_cond);
+	sd_mutex_unlock(&straggler_lock);
+}
+
+static void wait_for_stragglers(uint64_t oid)
+{
+	struct straggler key = { .oid = oid };
+
+	if (!uatomic_read(&nr_stragglers))
+		return;
+
+	sd_mutex_lock(&straggler_lock);
+	while (rb_search(&straggler_root, &key, rb, straggler_cmp))
+		sd_cond_wait(&straggler_cond, &straggler_lock);
+	sd_mutex_unlock(&straggler_lock);
+}
+
+/*
+ * Copy the object from a replica which succeeded to the failed one, whose copy
+ * is stale now.  If it fails too, remove the stale copy so that nobody reads
+ * it.  The recovery brings the object back to the node later.
+ */
+static void repair_replica(struct forward_info *fwd, int bad)
+{
+	struct sd_req hdr;
+	const struct node_id *nid = fwd->nids + bad;
+	uint64_t oid = fwd->oid;
+	uint32_t len = get_store_objsize(oid);
+	void *buf = xvalloc(len);
+	int ret = SD_RES_NO_OBJ;
+
+	for (int i = 0; i < fwd->batch.nr_ios; i++) {
+		if (fwd->ios[i].rsp.result != SD_RES_SUCCESS)
+			continue;
+		sd_init_req(&hdr, SD_OP_READ_PEER);
+		hdr.epoch = sys_epoch();
+		hdr.data_length = len;
+		hdr.obj.oid = oid;
+		ret = sheep_exec_req(fwd->nids + i, &hdr, buf);
+		if (ret == SD_RES_SUCCESS)
+			break;
+	}
+
+	if (ret == SD_RES_SUCCESS) {
+		sd_init_req(&hdr, SD_OP_CREATE_AND_WRITE_PEER);
+		hdr.flags = SD_FLAG_CMD_WRITE;
+		hdr.epoch = sys_epoch();
+		hdr.data_length = len;
+		hdr.obj.oid = oid;
+		ret = sheep_exec_req(nid, &hdr, buf);
+		if (ret == SD_RES_SUCCESS) {
+			sd_info("repaired %016"PRIx64" on %s", oid,
+				addr_to_str(nid->addr, nid->port));
+			goto out;
+		}
+	}
+
+	sd_err("failed to repair %016"PRIx64" on %s, %s, remove it", oid,
+	       addr_to_str(nid->addr, nid->port), sd_strerror(ret));
+	sd_init_req(&hdr, SD_OP_REMOVE_PEER);
+	hdr.epoch = sys_epoch();
+	hdr.obj.oid = oid;
+	ret = sheep_exec_req(nid, &hdr, NULL);
+	if (ret != SD_RES_SUCCESS)
+		sd_err("failed to remove %016"PRIx64" on %s, %s", oid,
+		       addr_to_str(nid->addr, nid->port), sd_strerror(ret));
+out:
+	free(buf);
+}
+
+static void straggler_work(struct work *work)
+{
+	struct forward_info *fwd = container_of(work, struct forward_info,
+						work);
+
+	if (fwd->nr_inflight > 0)
+		peer_io_wait(&fwd->batch, fwd->epoch, fwd->batch.nr_ios);
+
+	/*
+	 * The client was told that the write succeeded, so the replicas which
+	 * failed, before or after the quorum, must not stay stale.  The later
+	 * requests to the object keep waiting until they are repaired.
+	 */
+	for (int i = 0; i < fwd->batch.nr_ios; i++) {
+		int ret = fwd->ios[i].rsp.result;
+
+		if (ret == SD_RES_SUCCESS)
+			continue;
+		sd_err("fail %016"PRIx64" after the quorum, %s", fwd->oid,
+		       sd_strerror(ret));
+		repair_replica(fwd, i);
+	}
+
+	del_straggler(fwd->oid);
+}
+
+static void straggler_done(struct work *work)
+{
+	struct forward_info *fwd = container_of(work, struct forward_info,
+						work);
+
+	free(fwd->ios);
+	free(fwd->nids);
+	free(fwd);
+}
+
+/*
+ * Return the number of the successful replies we need before replying to the
+ * client.  Only the replicated writes can complete early.
+ */
+static int get_write_quorum(const struct request *req, int nr_sent)
+{
+	const struct sd_req *hdr = &req->rq;
+
+	if (!sys->write_quorum || is_erasure_oid(hdr->obj.oid))
+		return nr_sent;
+
+	if (hdr->opcode != SD_OP_WRITE_OBJ &&
+	    hdr->opcode != SD_OP_CREATE_AND_WRITE_OBJ)
+		return nr_sent;
+
+	return min(nr_sent, sys->write_quorum);
+}
+
+#else
+static inline void wait_for_stragglers(uint64_t oid) {}
+#endif	/* HAVE_ACCELIO */
+
 /*
  * Try our best to read one copy and read local first.
  *
@@ -286,9 +480,10 @@ static int gateway_replication_read(struct request *req)
 	uint64_t oid = req->rq.obj.oid;
 	int nr_copies, j;
 
+	wait_for_stragglers(oid);
 	nr_copies = get_req_copy_number(req);
 
-	oid_to_vnodes(oid, &req->vinfo->vroot, nr_copies, obj_vnodes);
+	vinfo_oid_to_vnodes(oid, req->vinfo, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		v = obj_vnodes[i];
 		if (!vnode_is_local(v))
@@ -330,177 +525,6 @@ out:
 	return ret;
 }
 
-#ifndef HAVE_ACCELIO
-
-struct forward_info_entry {
-	struct pollfd pfd;
-	const struct node_id *nid;
-	struct sockfd *sfd;
-	void *buf;
-};
-
-struct forward_info {
-	struct forward_info_entry ent[SD_MAX_NODES];
-	int nr_sent;
-};
-
-static inline void forward_info_update(struct forward_info *fi, int pos)
-{
-	sd_debug("%d, %d", fi->nr_sent, pos);
-	fi->nr_sent--;
-	memmove(fi->ent + pos, fi->ent + pos + 1,
-		sizeof(struct forward_info_entry) * (fi->nr_sent - pos));
-}
-
-static inline void finish_one_entry(struct forward_info *fi, int i)
-{
-	sockfd_cache_put(fi->ent[i].nid, fi->ent[i].sfd);
-	forward_info_update(fi, i);
-}
-
-static inline void finish_one_entry_err(struct forward_info *fi, int i)
-{
-	sockfd_cache_del(fi->ent[i].nid, fi->ent[i].sfd);
-	forward_info_update(fi, i);
-}
-
-static inline struct forward_info_entry *
-forward_info_find(struct forward_info *fi, int fd)
-{
-	for (int i = 0; i < fi->nr_sent; i++)
-		if (fi->ent[i].pfd.fd == fd)
-			return &fi->ent[i];
-
-	panic("can't find entry for %d", fd);
-	return NULL;
-}
-
-struct pfd_info {
-	struct pollfd pfds[SD_MAX_NODES];
-	int nr;
-};
-
-static inline void pfd_info_init(struct forward_info *fi, struct pfd_info *pi)
-{
-	int i;
-	for (i = 0; i < fi->nr_sent; i++)
-		pi->pfds[i] = fi->ent[i].pfd;
-	pi->nr = fi->nr_sent;
-}
-
-/*
- * Wait for all forward requests completion.
- *
- * Even if something goes wrong, we have to wait forward requests completion to
- * avoid interleaved requests.
- *
- * Return error code if any one request fails.
- */
-static int wait_forward_request(struct forward_info *fi, struct request *req)
-{
-	int nr_sent, err_ret = SD_RES_SUCCESS, ret, pollret, i,
-	    repeat = MAX_RETRY_COUNT;
-	struct pfd_info pi;
-	struct sd_rsp *rsp = &req->rp;
-again:
-	pfd_info_init(fi, &pi);
-	pollret = poll(pi.pfds, pi.nr, 1000 * POLL_TIMEOUT);
-	if (pollret < 0) {
-		if (errno == EINTR)
-			goto again;
-
-		panic("%m");
-	} else if (pollret == 0) {
-		/*
-		 * If IO NIC is down, epoch isn't incremented, so we can't retry
-		 * for ever.
-		 */
-		if (sheep_need_retry(req->rq.epoch) && repeat) {
-			repeat--;
-			sd_warn("poll timeout %d, disks of some nodes or "
-				"network is busy. Going to poll-wait again",
-				fi->nr_sent);
-			goto again;
-		}
-
-		nr_sent = fi->nr_sent;
-		/* XXX Blindly close all the connections */
-		for (i = 0; i < nr_sent; i++)
-			sockfd_cache_del(fi->ent[i].nid, fi->ent[i].sfd);
-
-		return SD_RES_NETWORK_ERROR;
-	}
-
-	nr_sent = fi->nr_sent;
-	for (i = 0; i < nr_sent; i++)
-		if (pi.pfds[i].revents & POLLIN)
-			break;
-	if (i < nr_sent) {
-		int re = pi.pfds[i].revents;
-		sd_debug("%d, revents %x", i, re);
-		if (re & (POLLERR | POLLHUP | POLLNVAL)) {
-			err_ret = SD_RES_NETWORK_ERROR;
-			finish_one_entry_err(fi, i);
-			goto out;
-		}
-		if (do_read(pi.pfds[i].fd, rsp, sizeof(*rsp), sheep_need_retry,
-			    req->rq.epoch, MAX_RETRY_COUNT)) {
-			sd_err("remote node might have gone away");
-			err_ret = SD_RES_NETWORK_ERROR;
-			finish_one_entry_err(fi, i);
-			goto out;
-		}
-
-		if (rsp->data_length) {
-			struct forward_info_entry *ent;
-
-			ent = forward_info_find(fi, pi.pfds[i].fd);
-			if (do_read(pi.pfds[i].fd, ent->buf, rsp->data_length,
-				    sheep_need_retry, req->rq.epoch,
-				    MAX_RETRY_COUNT)) {
-				sd_err("remote node might have gone away");
-				err_ret = SD_RES_NETWORK_ERROR;
-				finish_one_entry_err(fi, i);
-				goto out;
-			}
-		}
-		ret = rsp->result;
-		if (ret != SD_RES_SUCCESS) {
-			sd_err("fail %016"PRIx64", %s", req->rq.obj.oid,
-			       sd_strerror(ret));
-			err_ret = ret;
-		}
-		finish_one_entry(fi, i);
-	}
-out:
-	if (fi->nr_sent > 0)
-		goto again;
-
-	return err_ret;
-}
-
-static inline void forward_info_init(struct forward_info *fi, size_t nr_to_send)
-{
-	int i;
-	for (i = 0; i < nr_to_send; i++)
-		fi->ent[i].pfd.fd = -1;
-	fi->nr_sent = 0;
-}
-
-static inline void
-forward_info_advance(struct forward_info *fi, const struct node_id *nid,
-		     struct sockfd *sfd, void *buf)
-{
-	fi->ent[fi->nr_sent].nid = nid;
-	fi->ent[fi->nr_sent].pfd.fd = sfd->fd;
-	fi->ent[fi->nr_sent].pfd.events = POLLIN;
-	fi->ent[fi->nr_sent].sfd = sfd;
-	fi->ent[fi->nr_sent].buf = buf;
-	fi->nr_sent++;
-}
-
-#endif	/* HAVE_ACCELIO */
-
 static int gateway_forward_request(struct request *req)
 {
 	int i, err_ret = SD_RES_SUCCESS;
@@ -514,18 +538,15 @@ static int gateway_forward_request(struct request *req)
 	struct xio_context *ctx;
 	struct xio_forward_info xio_fi;
 #else
-	unsigned wlen;
-	int ret;
-	struct forward_info fi;
+	struct forward_info *fwd;
+	int quorum, nr_inflight, nr_succeeded = 0, nr_failed = 0;
+	int fail_ret = SD_RES_SUCCESS;
 #endif
 
 	sd_debug("%016"PRIx64, oid);
 
 	gateway_init_fwd_hdr(&hdr, &req->rq);
-	oid_to_nodes(oid, &req->vinfo->vroot, nr_copies, target_nodes);
-#ifndef HAVE_ACCELIO
-	forward_info_init(&fi, nr_copies);
-#endif
+	vinfo_oid_to_nodes(oid, req->vinfo, nr_copies, target_nodes);
 	reqs = prepare_requests(req, &nr_to_send);
 	if (!reqs)
 		return SD_RES_NETWORK_ERROR;
@@ -554,39 +575,89 @@ static int gateway_forward_request(struct request *req)
 
 #ifndef HAVE_ACCELIO
 
-	for (i = 0; i < nr_to_send; i++) {
-		struct sockfd *sfd;
-		const struct node_id *nid;
+	wait_for_stragglers(oid);
 
-		nid = &target_nodes[i]->nid;
-		sfd = sockfd_cache_get(nid);
-		if (!sfd) {
-			err_ret = SD_RES_NETWORK_ERROR;
-			break;
-		}
+	/*
+	 * All the requests are queued at once to the multiplexed channels to
+	 * the peers, which send them in parallel, and then we wait for the
+	 * replies.
+	 */
+	fwd = xzalloc(sizeof(*fwd));
+	fwd->oid = oid;
+	fwd->epoch = req->rq.epoch;
+	fwd->ios = xcalloc(nr_to_send, sizeof(*fwd->ios));
+	fwd->nids = xcalloc(nr_to_send, sizeof(*fwd->nids));
+	peer_io_batch_init(&fwd->batch, fwd->ios);
+	for (i = 0; i < nr_to_send; i++) {
+		const struct node_id *nid = &target_nodes[i]->nid;
 
 		hdr.data_length = reqs[i].dlen;
-		wlen = reqs[i].wlen;
 		hdr.obj.offset = reqs[i].off;
 		hdr.obj.ec_index = i;
 		hdr.obj.copy_policy = req->rq.obj.copy_policy;
-		ret = send_req(sfd->fd, &hdr, reqs[i].buf, wlen,
-			       sheep_need_retry, req->rq.epoch,
-			       MAX_RETRY_COUNT);
-		if (ret) {
-			sockfd_cache_del_node(nid);
+		fwd->ios[i].buf = reqs[i].buf;
+		fwd->ios[i].buf_len = reqs[i].dlen;
+		fwd->nids[i] = *nid;
+		if (peer_io_submit(&fwd->batch, &fwd->ios[i], nid, &hdr,
+				   reqs[i].wlen) < 0) {
+			sd_debug("failed to send to %s",
+				 addr_to_str(nid->addr, nid->port));
+			/* the copies not sent are stale, fail the request */
 			err_ret = SD_RES_NETWORK_ERROR;
-			sd_debug("fail %d", ret);
 			break;
 		}
-		forward_info_advance(&fi, nid, sfd, reqs[i].buf);
 	}
 
-	sd_debug("nr_sent %d, err %x", fi.nr_sent, err_ret);
-	if (fi.nr_sent > 0) {
-		ret = wait_forward_request(&fi, req);
-		if (ret != SD_RES_SUCCESS)
-			err_ret = ret;
+	sd_debug("nr_sent %d", fwd->batch.nr_ios);
+	quorum = get_write_quorum(req, fwd->batch.nr_ios);
+	if (quorum < fwd->batch.nr_ios)
+		add_straggler(oid);
+	nr_inflight = peer_io_wait(&fwd->batch, req->rq.epoch, quorum);
+
+	sd_mutex_lock(&fwd->batch.lock);
+	for (i = 0; i < fwd->batch.nr_ios; i++) {
+		int ret = fwd->ios[i].rsp.result;
+
+		if (!fwd->ios[i].done) {
+			/*
+			 * The request is already sent.  Don't let the straggler
+			 * refer to req->data, which is freed after the reply.
+			 */
+			fwd->ios[i].buf = NULL;
+			fwd->ios[i].buf_len = 0;
+			continue;
+		}
+		if (ret != SD_RES_SUCCESS) {
+			sd_err("fail %016"PRIx64", %s", oid, sd_strerror(ret));
+			fail_ret = ret;
+			nr_failed++;
+			continue;
+		}
+		nr_succeeded++;
+		memcpy(&req->rp, &fwd->ios[i].rsp, sizeof(req->rp));
+	}
+	sd_mutex_unlock(&fwd->batch.lock);
+
+	/*
+	 * The write succeeds if the quorum does, whether the other replicas
+	 * fail before or after it.  straggler_work() repairs the failed ones.
+	 */
+	if (nr_succeeded < quorum && err_ret == SD_RES_SUCCESS)
+		err_ret = fail_ret;
+
+	fwd->nr_inflight = nr_inflight;
+	if (nr_inflight > 0 || (nr_failed > 0 && err_ret == SD_RES_SUCCESS)) {
+		/* Let the stragglers finish and repair in the background */
+		sd_debug("%016"PRIx64", %d stragglers", oid, nr_inflight);
+		fwd->work.fn = straggler_work;
+		fwd->work.done = straggler_done;
+		queue_work(sys->straggler_wqueue, &fwd->work);
+	} else {
+		if (quorum < fwd->batch.nr_ios)
+			del_straggler(oid);
+		free(fwd->ios);
+		free(fwd->nids);
+		free(fwd);
 	}
 
 #else  /* HAVE_ACCELIO */
@@ -716,6 +787,50 @@ static bool is_inode_refresh_req(struct request *req)
 	return true;
 }
 
+/*
+ * Read the readonly object through the read cache.  On a cache miss, we read
+ * the whole object to cache it.
+ */
+static int gateway_cached_read(struct request *req)
+{
+	struct sd_req *hdr = &req->rq;
+	uint64_t oid = hdr->obj.oid, offset = hdr->obj.offset;
+	uint32_t length = hdr->data_length;
+	size_t size = get_objsize(oid, get_vdi_object_size(oid_to_vid(oid)));
+	void *data = req->data, *buf;
+	int ret;
+
+	if (readonly_cache_read(oid, data, length, offset)) {
+		req->rp.data_length = length;
+		return SD_RES_SUCCESS;
+	}
+
+	if (offset + length > size)
+		return gateway_replication_read(req);
+
+	buf = xvalloc(size);
+	req->data = buf;
+	hdr->obj.offset = 0;
+	hdr->data_length = size;
+
+	ret = gateway_replication_read(req);
+
+	req->data = data;
+	hdr->obj.offset = offset;
+	hdr->data_length = length;
+
+	if (ret != SD_RES_SUCCESS) {
+		free(buf);
+		return ret;
+	}
+
+	memcpy(data, (char *)buf + offset, length);
+	req->rp.data_length = length;
+	readonly_cache_insert(oid, buf, size);
+
+	return SD_RES_SUCCESS;
+}
+
 int gateway_read_obj(struct request *req)
 {
 	uint64_t oid = req->rq.obj.oid;
@@ -730,6 +845,8 @@ int gateway_read_obj(struct request *req)
 
 	if (is_erasure_oid(oid))
 		ret = gateway_forward_request(req);
+	else if (sys->readonly_cache && oid_is_readonly(oid))
+		ret = gateway_cached_read(req);
 	else
 		ret = gateway_replication_read(req);
 
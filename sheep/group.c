@@ -98,6 +98,8 @@ void put_vnode_info(struct vnode_info *vnode_info)
 		if (refcount_dec(&vnode_info->refcnt) == 0) {
 			rb_destroy(&vnode_info->vroot, struct sd_vnode, rb);
 			rb_destroy(&vnode_info->nroot, struct sd_node, rb);
+			free(vnode_info->vhash);
+			free(vnode_info->placement);
 			free(vnode_info);
 		}
 	}
@@ -130,6 +132,58 @@ static void recalculate_vnodes(struct rb_root *nroot)
 	}
 }
 
+/*
+ * Build the placement table of the vnode info.  For every vnode, we walk the
+ * ring once here and remember the vnodes of the copies of the objects which
+ * start from it, so that the lookup of the object placement is a binary
+ * search in a flat array instead of a tree walk with the zone checks.  We
+ * never look up more than SD_MAX_COPIES vnodes, so the rows are not wider than
+ * that even in a large cluster.
+ */
+static void build_vnode_placement(struct vnode_info *vinfo)
+{
+	int nr_vnodes = 0, i, j, k, n;
+	int width = min(vinfo->nr_zones, SD_MAX_COPIES);
+	const struct sd_vnode **ring, **p;
+	struct sd_vnode *v;
+
+	rb_for_each_entry(v, &vinfo->vroot, rb)
+		nr_vnodes++;
+	if (!nr_vnodes || !width)
+		return;
+
+	ring = xmalloc(nr_vnodes * sizeof(*ring));
+	vinfo->vhash = xmalloc(nr_vnodes * sizeof(*vinfo->vhash));
+	i = 0;
+	rb_for_each_entry(v, &vinfo->vroot, rb) {
+		ring[i] = v;
+		vinfo->vhash[i] = v->hash;
+		i++;
+	}
+
+	vinfo->placement = xmalloc((size_t)nr_vnodes * width *
+				   sizeof(*vinfo->placement));
+	for (i = 0; i < nr_vnodes; i++) {
+		p = vinfo->placement + (size_t)i * width;
+		p[0] = ring[i];
+		for (n = 1, j = (i + 1) % nr_vnodes; n < width;
+		     j = (j + 1) % nr_vnodes) {
+			if (unlikely(j == i))
+				panic("can't find a valid vnode");
+			for (k = 0; k < n; k++)
+				if (same_zone(p[k], ring[j]))
+					break;
+			if (k == n)
+				p[n++] = ring[j];
+		}
+	}
+	free(ring);
+	vinfo->nr_vnodes = nr_vnodes;
+	vinfo->width = width;
+
+	sd_debug("%d vnodes, %d zones", nr_vnodes, vinfo->nr_zones);
+}
+
 struct vnode_info *alloc_vnode_info(const struct rb_root *nroot)
 {
 	struct vnode_info *vnode_info;
@@ -155,6 +209,7 @@ struct vnode_info *alloc_vnode_info(const struct rb_root *nroot)
 	else
 		nodes_to_vnodes(&vnode_info->nroot, &vnode_info->vroot);
 	vnode_info->nr_zones = get_zones_nr_from(&vnode_info->nroot);
+	build_vnode_placement(vnode_info);
 	refcount_set(&vnode_info->refcnt, 1);
 	return vnode_info;
 }
@@ -1311,6 +1366,7 @@ main_fn void sd_leave_handler(const struct sd_node *left,
 	put_vnode_info(old_vnode_info);
 
 	sockfd_cache_del_node(&left->nid);
+	peer_channel_del_node(&left->nid);
 
 	remove_node_from_participants(&left->nid);
 }
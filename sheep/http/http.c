@@ -138,6 +138,125 @@ int http_request_writef(struct http_request *req, const char *fmt, ...)
 	return ret;
 }
 
+static int hex_to_int(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * Copy the URL-decoded value of 'key' in the query string to 'buf'.  Return
+ * false if the key is not found.
+ */
+bool http_request_query(const struct http_request *req, const char *key,
+			char *buf, size_t len)
+{
+	const char *p = req->query;
+	size_t key_len = strlen(key), n = 0;
+	int hi, lo;
+
+	while (p && *p) {
+		if (strncmp(p, key, key_len) == 0 &&
+		    (p[key_len] == '=' || p[key_len] == '&' ||
+		     p[key_len] == '\0'))
+			break;
+		p = strchr(p, '&');
+		if (p)
+			p++;
+	}
+	if (!p || !*p)
+		return false;
+
+	p += key_len;
+	if (*p == '=')
+		p++;
+	for (; *p && *p != '&' && n < len - 1; p++) {
+		if (*p == '+')
+			buf[n++] = ' ';
+		else if (*p == '%' && (hi = hex_to_int(p[1])) >= 0 &&
+			 (lo = hex_to_int(p[2])) >= 0) {
+			buf[n++] = hi << 4 | lo;
+			p += 2;
+		} else
+			buf[n++] = *p;
+	}
+	buf[n] = '\0';
+
+	return true;
+}
+
+/* Get the parameters to list a bucket, the name of 'limit' differs by API */
+void http_request_list_params(const struct http_request *req,
+			      const char *limit_key,
+			      struct kv_list_params *params)
+{
+	char limit[32];
+
+	memset(params, 0, sizeof(*params));
+	http_request_query(req, "marker", params->marker,
+			   sizeof(params->marker));
+	http_request_query(req, "prefix", params->prefix,
+			   sizeof(params->prefix));
+	http_request_query(req, "delimiter", params->delimiter,
+			   sizeof(params->delimiter));
+	if (http_request_query(req, limit_key, limit, sizeof(limit)))
+		params->limit = strtoull(limit, NULL, 10);
+}
+
+/*
+ * Parse "bytes=first-last", "bytes=first-" and "bytes=-length".  The range to
+ * the end of the object has zero 'data_length' and the last 'length' bytes are
+ * marked with 'range_suffix', because we don't know the size of the object yet.
+ */
+static int parse_range(struct http_request *req, const char *p)
+{
+	const char prefix[] = "bytes=";
+	uint64_t first, last;
+	char *endp;
+
+	p = strstr(p, prefix);
+	if (!p)
+		return -1;
+	p += sizeof(prefix) - 1;
+
+	if (*p == '-') {
+		req->data_length = strtoull(p + 1, &endp, 10);
+		if (endp == p + 1 || !req->data_length)
+			return -1;
+		req->range_suffix = true;
+		goto out;
+	}
+
+	first = strtoull(p, &endp, 10);
+	if (endp == p || *endp != '-')
+		return -1;
+	req->offset = first;
+	p = endp + 1;
+	if (!isdigit(*p)) {
+		req->data_length = 0;
+		goto out;
+	}
+
+	/*
+	 * In swift spec, the second number of RANGE should be included
+	 * which means [num1, num2], but our common means for read and
+	 * write data by 'offset' and 'len' is [num1, num2), so we
+	 * should add 1 to num2.
+	 */
+	last = strtoull(p, &endp, 10);
+	if (last < first)
+		return -1;
+	req->data_length = last + 1 - first;
+out:
+	req->range = true;
+	return 0;
+}
+
 static int request_init_operation(struct http_request *req)
 {
 	char **env = req->fcgx.envp;
@@ -169,33 +288,15 @@ static int request_init_operation(struct http_request *req)
 	req->uri = FCGX_GetParam("DOCUMENT_URI", env);
 	if (!req->uri)
 		return BAD_REQUEST;
+	req->query = FCGX_GetParam("QUERY_STRING", env);
 	p = FCGX_GetParam("HTTP_RANGE", env);
 	if (p && p[0] != '\0') {
-		const char prefix[] = "bytes=";
-		char *left, *right, num[64];
-		uint64_t max;
-		left = strstr(p, prefix);
-		if (!left)
-			goto invalid_range;
-		right = strchr(left, '-');
-		pstrcpy(num, right - left, left + sizeof(prefix) - 1);
-		req->offset = strtoll(num, &endp, 10);
-		if (num == endp)
-			goto invalid_range;
-		strcpy(num, right + 1);
-		/*
-		 * In swift spec, the second number of RANGE should be included
-		 * which means [num1, num2], but our common means for read and
-		 * write data by 'offset' and 'len' is [num1, num2), so we
-		 * should add 1 to num2.
-		 */
-		max = strtoll(num, &endp, 10) + 1;
-		if (num == endp)
-			goto invalid_range;
-		if (max <= req->offset)
-			goto invalid_range;
-		req->data_length = max - req->offset;
-		sd_debug("HTTP_RANGE: %"PRIu64" %"PRIu64, req->offset, max);
+		if (parse_range(req, p) < 0) {
+			sd_err("invalid range %s", p);
+			return REQUEST_RANGE_NOT_SATISFIABLE;
+		}
+		sd_debug("HTTP_RANGE: %"PRIu64" %"PRIu64, req->offset,
+			 req->data_length);
 	}
 	p = FCGX_GetParam("FORCE", env);
 	if (p && p[0] != '\0') {
@@ -213,10 +314,6 @@ static int request_init_operation(struct http_request *req)
 	req->status = UNKNOWN;
 
 	return OK;
-
-invalid_range:
-	sd_err("invalid range %s", p);
-	return REQUEST_RANGE_NOT_SATISFIABLE;
 }
 
 static int http_init_request(struct http_request *req)
@@ -240,6 +337,11 @@ void http_response_header(struct http_request *req, enum http_status status)
 	if (req->opcode == HTTP_GET || req->opcode == HTTP_HEAD)
 		http_request_writef(req, "Content-Length: %"PRIu64"\r\n",
 				    req->data_length);
+	if (status == PARTIAL_CONTENT && req->total_length)
+		http_request_writef(req, "Content-Range: bytes %"PRIu64"-%"
+				    PRIu64"/%"PRIu64"\r\n", req->offset,
+				    req->offset + req->data_length - 1,
+				    req->total_length);
 	http_request_writes(req, "Content-type: text/plain;\r\n\r\n");
 }
 
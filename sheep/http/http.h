@@ -45,10 +45,17 @@ enum http_status {
 struct http_request {
 	FCGX_Request fcgx;
 	char *uri;
+	char *query;
 	enum http_opcode opcode;
 	enum http_status status;
 	uint64_t data_length;
 	uint64_t offset;
+	/* set if the request has a Range header */
+	bool range;
+	/* the range is the last 'data_length' bytes */
+	bool range_suffix;
+	/* the size of the whole object for a range request */
+	uint64_t total_length;
 	bool force;
 	bool append;
 	bool eof;
@@ -112,12 +119,26 @@ int http_request_write(struct http_request *req, const void *buf, int len);
 int http_request_writes(struct http_request *req, const char *str);
 __printf(2, 3)
 int http_request_writef(struct http_request *req, const char *fmt, ...);
+bool http_request_query(const struct http_request *req, const char *key,
+			char *buf, size_t len);
+struct kv_list_params;
+void http_request_list_params(const struct http_request *req,
+			      const char *limit_key,
+			      struct kv_list_params *params);
 
 /* For kv.c */
 
 #define SD_MAX_BUCKET_NAME 256
 #define SD_MAX_OBJECT_NAME 1024
 
+/* Parameters to list the objects of a bucket, an empty string means none */
+struct kv_list_params {
+	char marker[SD_MAX_OBJECT_NAME];	/* list the names after this */
+	char prefix[SD_MAX_OBJECT_NAME];
+	char delimiter[SD_MAX_OBJECT_NAME];	/* roll up the names by this */
+	uint64_t limit;				/* 0 means no limit */
+};
+
 /* This default value shows best performance in test */
 #define DEFAULT_KV_RW_BUFFER (SD_DATA_OBJ_SIZE * 8)
 extern uint64_t kv_rw_buffer;
@@ -156,6 +177,7 @@ int kv_read_object_meta(struct http_request *req, const char *account,
 int kv_delete_object(const char *account, const char *bucket, const char *,
 		     bool force);
 int kv_iterate_object(const char *account, const char *bucket,
+		      const struct kv_list_params *params,
 		      void (*cb)(const char *object, void *opaque),
 		      void *opaque);
 
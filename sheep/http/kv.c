@@ -91,6 +91,148 @@ struct bucket_iterater_arg {
 	uint64_t bytes_used;
 };
 
+/*
+ * Name index cache
+ *
+ * Looking up an object by name reads the whole bucket inode and then the
+ * onodes along the probe sequence of the name.  To skip it, we remember in
+ * memory the slot of each name we have seen in a bucket.
+ *
+ * The other gateways can create and delete the objects behind our back, so a
+ * cached slot is only a hint.  The lookup reads the onode at the slot and
+ * uses it only if it still has the name, and falls back to the probe
+ * otherwise.  Since the name of an onode is unique in its bucket, a matched
+ * onode is what the probe would find.
+ */
+#define NR_NAME_CACHE_SHARDS 64
+#define NAME_CACHE_MAX_ENTRIES (UINT64_C(1) << 22)
+
+struct name_cache_entry {
+	struct rb_node rb;
+	uint32_t vid;
+	uint32_t idx;
+	uint64_t hval;
+	const char *name;
+};
+
+struct name_cache_shard {
+	struct sd_mutex lock;
+	struct rb_root root;
+};
+
+static struct name_cache_shard name_cache_shards[NR_NAME_CACHE_SHARDS];
+static uint64_t name_cache_nr_entries;
+
+static void __attribute__((constructor)) name_cache_init(void)
+{
+	for (int i = 0; i < NR_NAME_CACHE_SHARDS; i++) {
+		sd_init_mutex(&name_cache_shards[i].lock);
+		INIT_RB_ROOT(&name_cache_shards[i].root);
+	}
+}
+
+static int name_cache_cmp(const struct name_cache_entry *a,
+			  const struct name_cache_entry *b)
+{
+	return intcmp(a->vid, b->vid) ?: intcmp(a->hval, b->hval) ?:
+		strcmp(a->name, b->name);
+}
+
+static inline struct name_cache_shard *name_cache_shard(uint64_t hval)
+{
+	return name_cache_shards + hval % NR_NAME_CACHE_SHARDS;
+}
+
+static bool name_cache_get(uint32_t vid, const char *name, uint64_t hval,
+			   uint32_t *idx)
+{
+	struct name_cache_shard *shard = name_cache_shard(hval);
+	struct name_cache_entry key = {
+		.vid = vid,
+		.hval = hval,
+		.name = name,
+	}, *entry;
+
+	sd_mutex_lock(&shard->lock);
+	entry = rb_search(&shard->root, &key, rb, name_cache_cmp);
+	if (entry)
+		*idx = entry->idx;
+	sd_mutex_unlock(&shard->lock);
+
+	return entry != NULL;
+}
+
+static void name_cache_set(uint32_t vid, const char *name, uint64_t hval,
+			   uint32_t idx)
+{
+	struct name_cache_shard *shard = name_cache_shard(hval);
+	struct name_cache_entry *entry, *old;
+	size_t len = strlen(name) + 1;
+
+	if (uatomic_read(&name_cache_nr_entries) >= NAME_CACHE_MAX_ENTRIES)
+		return;
+
+	entry = xmalloc(sizeof(*entry) + len);
+	entry->vid = vid;
+	entry->idx = idx;
+	entry->hval = hval;
+	entry->name = memcpy(entry + 1, name, len);
+
+	sd_mutex_lock(&shard->lock);
+	old = rb_insert(&shard->root, entry, rb, name_cache_cmp);
+	if (old)
+		old->idx = idx;
+	sd_mutex_unlock(&shard->lock);
+
+	if (old)
+		free(entry);
+	else
+		uatomic_inc(&name_cache_nr_entries);
+}
+
+static void name_cache_del(uint32_t vid, const char *name, uint64_t hval)
+{
+	struct name_cache_shard *shard = name_cache_shard(hval);
+	struct name_cache_entry key = {
+		.vid = vid,
+		.hval = hval,
+		.name = name,
+	}, *entry;
+
+	sd_mutex_lock(&shard->lock);
+	entry = rb_search(&shard->root, &key, rb, name_cache_cmp);
+	if (entry)
+		rb_erase(&entry->rb, &shard->root);
+	sd_mutex_unlock(&shard->lock);
+
+	if (entry) {
+		free(entry);
+		uatomic_dec(&name_cache_nr_entries);
+	}
+}
+
+/* Drop the names of the deleted bucket, whose vid can be reused */
+static void name_cache_purge_bucket(uint32_t vid)
+{
+	struct name_cache_shard *shard;
+	struct name_cache_entry key = { .vid = vid, .name = "" }, *entry;
+	struct rb_node *next;
+
+	for (int i = 0; i < NR_NAME_CACHE_SHARDS; i++) {
+		shard = name_cache_shards + i;
+		sd_mutex_lock(&shard->lock);
+		entry = rb_nsearch(&shard->root, &key, rb, name_cache_cmp);
+		while (entry && entry->vid == vid) {
+			next = rb_next(&entry->rb);
+			rb_erase(&entry->rb, &shard->root);
+			free(entry);
+			uatomic_dec(&name_cache_nr_entries);
+			entry = rb_entry(next, struct name_cache_entry, rb);
+		}
+		sd_mutex_unlock(&shard->lock);
+	}
+}
+
 /* Account operations */
 
 /*
@@ -489,45 +631,111 @@ static int bucket_delete(const char *account, uint32_t avid, const char *bucket)
 
 typedef void (*object_iter_cb)(const char *object, void *opaque);
 
+/* The number of the onode names read in parallel to list a bucket */
+#define KV_LIST_BATCH 128
+
 struct object_iterater_arg {
-	void *opaque;
-	object_iter_cb cb;
-	uint32_t count;
+	uint64_t *oids;
+	size_t nr_oids;
+	size_t alloc;
 };
 
 static void object_iterater(struct sd_index *idx, void *arg, int ignore)
 {
 	struct object_iterater_arg *oiarg = arg;
-	struct kv_onode *onode = NULL;
-	uint64_t oid, read_size;
-	int ret;
 
 	if (!idx->vdi_id)
-		goto out;
+		return;
 
-	read_size = offsetof(struct kv_onode, name) + sizeof(onode->name);
-	onode = xmalloc(read_size);
-	oid = vid_to_data_oid(idx->vdi_id, idx->idx);
-	ret = sd_read_object(oid, (char *)onode, read_size, 0);
-	if (ret != SD_RES_SUCCESS) {
-		sd_err("Failed to read data object %016"PRIx64, oid);
-		goto out;
+	if (oiarg->nr_oids == oiarg->alloc) {
+		oiarg->alloc = oiarg->alloc * 2 ?: 1024;
+		oiarg->oids = xrealloc(oiarg->oids,
+				       oiarg->alloc * sizeof(*oiarg->oids));
 	}
+	oiarg->oids[oiarg->nr_oids++] = vid_to_data_oid(idx->vdi_id, idx->idx);
+}
 
-	if (onode->name[0] == '\0')
-		goto out;
-	if (oiarg->cb)
-		oiarg->cb(onode->name, oiarg->opaque);
-	oiarg->count++;
-out:
-	free(onode);
+struct object_list {
+	const struct kv_list_params *params;
+	char **names;
+	size_t nr_names;
+	size_t alloc;
+};
+
+static int name_cmp(char *const *a, char *const *b)
+{
+	return strcmp(*a, *b);
+}
+
+/* Sort the names, drop the duplicated ones and keep the first 'max' ones */
+static void object_list_trim(struct object_list *list, size_t max)
+{
+	size_t i, n = 0;
+
+	xqsort(list->names, list->nr_names, name_cmp);
+	for (i = 0; i < list->nr_names; i++) {
+		if (n == max || (n > 0 &&
+				 strcmp(list->names[n - 1], list->names[i]) == 0))
+			free(list->names[i]);
+		else
+			list->names[n++] = list->names[i];
+	}
+	list->nr_names = n;
 }
 
-static int bucket_iterate_object(uint32_t bucket_vid, object_iter_cb cb,
-				 void *opaque)
+/*
+ * Add the name to the list if it matches the parameters.  The names which
+ * contain the delimiter after the prefix are rolled up to the common prefix.
+ */
+static void object_list_add(struct object_list *list, const char *name)
 {
-	struct object_iterater_arg arg = {opaque, cb, 0};
+	const struct kv_list_params *params = list->params;
+	size_t prefix_len = strlen(params->prefix);
+	const char *d = NULL;
+	char *entry;
+
+	if (strncmp(name, params->prefix, prefix_len) != 0)
+		return;
+
+	if (params->delimiter[0])
+		d = strstr(name + prefix_len, params->delimiter);
+	entry = xstrdup(name);
+	if (d)
+		entry[d - name + strlen(params->delimiter)] = '\0';
+
+	if (params->marker[0] && strcmp(entry, params->marker) <= 0) {
+		free(entry);
+		return;
+	}
+
+	if (list->nr_names == list->alloc) {
+		list->alloc = list->alloc * 2 ?: 1024;
+		list->names = xrealloc(list->names,
+				       list->alloc * sizeof(*list->names));
+	}
+	list->names[list->nr_names++] = entry;
+
+	/* We need only the first 'limit' names, don't keep the others */
+	if (params->limit && list->nr_names >= params->limit * 2)
+		object_list_trim(list, params->limit);
+}
+
+/*
+ * The onodes are placed by the hash of their names, so we have to read all of
+ * them to list a bucket in the order of the names.  We read the names of the
+ * onodes in parallel batches and keep only the ones to be returned.
+ */
+static int bucket_iterate_object(uint32_t bucket_vid,
+				 const struct kv_list_params *params,
+				 object_iter_cb cb, void *opaque)
+{
+	struct object_iterater_arg arg = {};
+	struct object_list list = { .params = params };
+	struct request_iocb *iocb;
 	struct sd_inode *inode;
+	struct sd_req hdr;
+	char *names = NULL, *name;
+	size_t i, j, n;
 	int ret;
 
 	inode = xmalloc(sizeof(*inode));
@@ -539,7 +747,49 @@ static int bucket_iterate_object(uint32_t bucket_vid, object_iter_cb cb,
 	}
 
 	sd_inode_index_walk(inode, object_iterater, &arg);
+
+	names = xmalloc(KV_LIST_BATCH * SD_MAX_OBJECT_NAME);
+	for (i = 0; i < arg.nr_oids; i += n) {
+		n = min(arg.nr_oids - i, (size_t)KV_LIST_BATCH);
+		memset(names, 0, n * SD_MAX_OBJECT_NAME);
+
+		iocb = local_req_init();
+		if (!iocb) {
+			ret = SD_RES_SYSTEM_ERROR;
+			goto out;
+		}
+		for (j = 0; j < n; j++) {
+			sd_init_req(&hdr, SD_OP_READ_OBJ);
+			hdr.data_length = SD_MAX_OBJECT_NAME;
+			hdr.obj.oid = arg.oids[i + j];
+			name = names + j * SD_MAX_OBJECT_NAME;
+			exec_local_req_async(&hdr, name, iocb);
+		}
+		/* The onodes which failed to be read are skipped */
+		ret = local_req_wait(iocb);
+		if (ret != SD_RES_SUCCESS)
+			sd_err("failed to read onodes of %" PRIx32 ", %s",
+			       bucket_vid, sd_strerror(ret));
+
+		for (j = 0; j < n; j++) {
+			name = names + j * SD_MAX_OBJECT_NAME;
+			name[SD_MAX_OBJECT_NAME - 1] = '\0';
+			if (name[0] != '\0')
+				object_list_add(&list, name);
+		}
+	}
+
+	object_list_trim(&list, params->limit ?: SIZE_MAX);
+	for (i = 0; i < list.nr_names; i++)
+		if (cb)
+			cb(list.names[i], opaque);
+	ret = SD_RES_SUCCESS;
 out:
+	for (i = 0; i < list.nr_names; i++)
+		free(list.names[i]);
+	free(list.names);
+	free(names);
+	free(arg.oids);
 	free(inode);
 	return ret;
 }
@@ -624,6 +874,8 @@ int kv_delete_bucket(const char *account, const char *bucket)
 	if (ret != SD_RES_SUCCESS)
 		goto out;
 	ret = bucket_delete(account, account_vid, bucket);
+	if (ret == SD_RES_SUCCESS)
+		name_cache_purge_bucket(vid);
 out:
 	sys->cdrv->unlock(account_vid);
 	return ret;
@@ -664,19 +916,16 @@ out:
 
 #define KV_ONODE_INLINE_SIZE (SD_DATA_OBJ_SIZE - ONODE_HDR_SIZE)
 
-static int vdi_read_write(uint32_t vid, char *data, size_t length,
-			  off_t offset, bool is_read, bool create)
+/* Submit the requests to read or write the range of the VDI to 'iocb' */
+static void vdi_submit_rw(uint32_t vid, char *data, size_t length,
+			  off_t offset, bool is_read, bool create,
+			  struct request_iocb *iocb)
 {
 	struct sd_req hdr;
 	uint32_t idx = offset / SD_DATA_OBJ_SIZE;
 	uint64_t done = 0;
-	struct request_iocb *iocb;
 	int ret;
 
-	iocb = local_req_init();
-	if (!iocb)
-		return SD_RES_SYSTEM_ERROR;
-
 	offset %= SD_DATA_OBJ_SIZE;
 	while (done < length) {
 		size_t len = min(length - done, SD_DATA_OBJ_SIZE - offset);
@@ -708,8 +957,6 @@ static int vdi_read_write(uint32_t vid, char *data, size_t length,
 		data += len;
 		create = true;
 	}
-
-	return local_req_wait(iocb);
 }
 
 static int onode_allocate_extents(struct kv_onode *onode,
@@ -760,35 +1007,96 @@ out:
 	return ret;
 }
 
+/*
+ * The buffers of the pipelined PUT and GET.  While the objects of one buffer
+ * are written to or read from the cluster, the next buffer is filled from or
+ * sent to the client.
+ */
+#define KV_PIPELINE_DEPTH 2
+
+struct kv_pipe_buf {
+	char *data;
+	uint64_t size;
+	struct request_iocb *iocb;
+};
+
+/* Wait for the requests of the buffers in flight and return the first error */
+static int kv_pipe_drain(struct kv_pipe_buf *bufs, int ret)
+{
+	int r;
+
+	for (int i = 0; i < KV_PIPELINE_DEPTH; i++) {
+		if (!bufs[i].iocb)
+			continue;
+		r = local_req_wait(bufs[i].iocb);
+		bufs[i].iocb = NULL;
+		if (ret == SD_RES_SUCCESS)
+			ret = r;
+	}
+
+	return ret;
+}
+
+static void kv_pipe_free(struct kv_pipe_buf *bufs)
+{
+	for (int i = 0; i < KV_PIPELINE_DEPTH; i++)
+		free(bufs[i].data);
+}
+
 static int do_vdi_write(struct http_request *req, uint32_t data_vid,
-			uint64_t offset, uint64_t total, char *data_buf,
-			bool create)
+			uint64_t offset, uint64_t total, bool create)
 {
-	uint64_t done = 0, size;
-	int ret = SD_RES_SUCCESS;
+	struct kv_pipe_buf bufs[KV_PIPELINE_DEPTH] = {}, *buf;
+	uint64_t done = 0, size, buf_size = MIN(kv_rw_buffer, total);
+	int ret = SD_RES_SUCCESS, n;
+
+	for (int i = 0; done < total; i++) {
+		buf = bufs + i % KV_PIPELINE_DEPTH;
+		if (buf->iocb) {
+			ret = local_req_wait(buf->iocb);
+			buf->iocb = NULL;
+			if (ret != SD_RES_SUCCESS)
+				goto out;
+		}
+		if (!buf->data)
+			buf->data = xmalloc(buf_size);
+
+		/*
+		 * End the chunk at an object boundary, so the chunks in flight
+		 * never write to the same object.  kv_rw_buffer is a multiple
+		 * of the object size, so the chunk is never empty.
+		 */
+		size = MIN(buf_size, total - done);
+		if (size < total - done)
+			size -= (offset + size) % SD_DATA_OBJ_SIZE;
 
-	while (done < total) {
-		size = http_request_read(req, data_buf,
-					 MIN(kv_rw_buffer, total - done));
-		if (size <= 0) {
-			sd_err("Failed to read http request: %ld", size);
+		n = http_request_read(req, buf->data, size);
+		if (n <= 0) {
+			sd_err("Failed to read http request: %d", n);
 			ret = SD_RES_EIO;
 			goto out;
 		}
-		ret = vdi_read_write(data_vid, data_buf, size, offset,
-				     false, create);
-		sd_debug("vdi_write offset: %"PRIu64", size: %" PRIu64
-			 ", for %" PRIx32 "ret: %d", offset, size,
-			 data_vid, ret);
-		if (ret != SD_RES_SUCCESS) {
-			sd_err("Failed to write data object for %" PRIx32
-			       ", %s", data_vid, sd_strerror(ret));
+
+		buf->iocb = local_req_init();
+		if (!buf->iocb) {
+			ret = SD_RES_SYSTEM_ERROR;
 			goto out;
 		}
-		done += size;
-		offset += size;
+		vdi_submit_rw(data_vid, buf->data, n, offset, false, create,
+			      buf->iocb);
+		sd_debug("vdi_write offset: %"PRIu64", size: %d, for %" PRIx32,
+			 offset, n, data_vid);
+		/* the following chunks start at the objects not written yet */
+		create = true;
+		done += n;
+		offset += n;
 	}
 out:
+	ret = kv_pipe_drain(bufs, ret);
+	if (ret != SD_RES_SUCCESS)
+		sd_err("Failed to write data object for %" PRIx32 ", %s",
+		       data_vid, sd_strerror(ret));
+	kv_pipe_free(bufs);
 	return ret;
 }
 
@@ -798,27 +1106,22 @@ static int onode_populate_extents(struct kv_onode *onode,
 	struct onode_extent *ext;
 	struct onode_extent *last_ext = onode->o_extent + onode->nr_extent - 1;
 	uint64_t total, offset = 0, reserv_len;
-	uint64_t write_buffer_size = MIN(kv_rw_buffer, req->data_length);
 	int ret = SD_RES_SUCCESS;
-	char *data_buf = NULL;
 	uint32_t data_vid = onode->data_vid;
 	bool create = true;
 
-	data_buf = xmalloc(write_buffer_size);
-
 	if (last_ext->data_len < req->data_length) {
 		ext = last_ext - 1;
 		reserv_len = (req->data_length - last_ext->data_len);
 		offset = (ext->start + ext->count) * SD_DATA_OBJ_SIZE -
 			 reserv_len;
-		ret = do_vdi_write(req, data_vid, offset, reserv_len,
-				   data_buf, false);
+		ret = do_vdi_write(req, data_vid, offset, reserv_len, false);
 		if (ret != SD_RES_SUCCESS) {
 			sd_err("Failed to do_vdi_write data_vid: %" PRIx32
 			       ", offset: %" PRIx64 ", total: %" PRIx64
 			       ", ret: %s", data_vid, offset, reserv_len,
 			       sd_strerror(ret));
-			goto out;
+			return ret;
 		}
 		offset = last_ext->start * SD_DATA_OBJ_SIZE;
 		total = last_ext->data_len;
@@ -830,14 +1133,12 @@ static int onode_populate_extents(struct kv_onode *onode,
 			create = false;
 	}
 
-	ret = do_vdi_write(req, data_vid, offset, total, data_buf, create);
+	ret = do_vdi_write(req, data_vid, offset, total, create);
 	if (ret != SD_RES_SUCCESS)
 		sd_err("Failed to do_vdi_write data_vid: %" PRIx32
 		       ", offset: %" PRIx64 ", total: %" PRIx64
 		       ", ret: %s", data_vid, offset, total,
 		       sd_strerror(ret));
-out:
-	free(data_buf);
 	return ret;
 }
 
@@ -974,7 +1275,7 @@ static int onode_do_create(struct kv_onode *onode, struct sd_inode *inode,
 		goto out;
 	}
 	if (!create)
-		goto out;
+		goto set_cache;
 
 	sd_inode_set_vid(inode, idx, vid);
 	ret = sd_inode_write_vid(inode, idx, vid, vid, 0, false, false);
@@ -983,6 +1284,9 @@ static int onode_do_create(struct kv_onode *onode, struct sd_inode *inode,
 		       vid_to_vdi_oid(vid));
 		goto out;
 	}
+set_cache:
+	name_cache_set(vid, onode->name,
+		       sd_hash(onode->name, strlen(onode->name)), idx);
 out:
 	return ret;
 }
@@ -1055,47 +1359,90 @@ static int onode_free_data(struct kv_onode *onode)
 	return ret;
 }
 
-static int onode_read_extents(struct kv_onode *onode, struct http_request *req)
+/* The position in the extents of the data to send to the client */
+struct extent_cursor {
+	uint64_t idx;
+	uint64_t off;
+	uint64_t left;
+};
+
+/*
+ * Get the VDI range of the next chunk of at most 'max' bytes to read.  Return
+ * false if there is no more data to read.
+ */
+static bool next_read_chunk(const struct kv_onode *onode,
+			    struct extent_cursor *cur, uint64_t max,
+			    uint64_t *offset, uint64_t *size)
 {
-	struct onode_extent *ext;
-	uint64_t size, total, total_size, offset, done = 0, i, ext_len;
-	uint64_t off = req->offset, len = req->data_length;
-	int ret = SD_RES_SUCCESS;
-	char *data_buf = NULL;
-	uint64_t read_buffer_size = MIN(kv_rw_buffer, onode->size);
-
-	data_buf = xmalloc(read_buffer_size);
-	total_size = len;
-	for (i = 0; i < onode->nr_extent; i++) {
-		ext = onode->o_extent + i;
-		ext_len = ext->data_len;
-		if (off >= ext_len) {
-			off -= ext_len;
+	const struct onode_extent *ext;
+	uint64_t len;
+
+	while (cur->left && cur->idx < onode->nr_extent) {
+		ext = onode->o_extent + cur->idx;
+		if (cur->off >= ext->data_len) {
+			cur->off -= ext->data_len;
+			cur->idx++;
 			continue;
 		}
-		total = min(ext_len - off, total_size);
-		offset = ext->start * SD_DATA_OBJ_SIZE + off;
-		off = 0;
-		done = 0;
-		while (done < total) {
-			size = MIN(total - done, read_buffer_size);
-			ret = vdi_read_write(onode->data_vid, data_buf,
-					     size, offset, true, false);
-			sd_debug("vdi_read size: %"PRIu64", offset: %"
-				 PRIu64", ret:%d", size, offset, ret);
-			if (ret != SD_RES_SUCCESS) {
-				sd_err("Failed to read for vid %"PRIx32,
-				       onode->data_vid);
+		*offset = ext->start * SD_DATA_OBJ_SIZE + cur->off;
+		len = min(ext->data_len - cur->off, cur->left);
+		*size = min(len, max);
+		cur->off += *size;
+		cur->left -= *size;
+		return true;
+	}
+
+	return false;
+}
+
+static int onode_read_extents(struct kv_onode *onode, struct http_request *req)
+{
+	struct kv_pipe_buf bufs[KV_PIPELINE_DEPTH] = {}, *buf;
+	struct extent_cursor cur = {
+		.off = req->offset,
+		.left = req->data_length,
+	};
+	uint64_t offset, size, buf_size = MIN(kv_rw_buffer, req->data_length);
+	int ret = SD_RES_SUCCESS, nr = 0;
+
+	/* Read ahead the next chunks while the current one is sent */
+	for (int i = 0;; i++) {
+		while (nr < i + KV_PIPELINE_DEPTH &&
+		       next_read_chunk(onode, &cur, buf_size, &offset, &size)) {
+			buf = bufs + nr++ % KV_PIPELINE_DEPTH;
+			if (!buf->data)
+				buf->data = xmalloc(buf_size);
+			buf->iocb = local_req_init();
+			if (!buf->iocb) {
+				ret = SD_RES_SYSTEM_ERROR;
 				goto out;
 			}
-			http_request_write(req, data_buf, size);
-			done += size;
-			offset += size;
-			total_size -= size;
+			buf->size = size;
+			vdi_submit_rw(onode->data_vid, buf->data, size, offset,
+				      true, false, buf->iocb);
+			sd_debug("vdi_read size: %"PRIu64", offset: %"PRIu64,
+				 size, offset);
+		}
+		if (i == nr)
+			break;
+
+		buf = bufs + i % KV_PIPELINE_DEPTH;
+		ret = local_req_wait(buf->iocb);
+		buf->iocb = NULL;
+		if (ret != SD_RES_SUCCESS) {
+			sd_err("Failed to read for vid %"PRIx32,
+			       onode->data_vid);
+			goto out;
+		}
+		if (http_request_write(req, buf->data, buf->size) != buf->size) {
+			sd_err("Failed to send data to the client");
+			ret = SD_RES_SYSTEM_ERROR;
+			goto out;
 		}
 	}
 out:
-	free(data_buf);
+	ret = kv_pipe_drain(bufs, ret);
+	kv_pipe_free(bufs);
 	return ret;
 }
 
@@ -1116,11 +1463,22 @@ out:
 static int onode_lookup_nolock(struct kv_onode *onode, uint32_t ovid,
 			       const char *name)
 {
-	struct sd_inode *inode = xmalloc(sizeof(struct sd_inode));
+	struct sd_inode *inode;
 	uint32_t tmp_vid, idx;
-	uint64_t hval, i;
+	uint64_t hval = sd_hash(name, strlen(name)), i;
+	char tmp_name[SD_MAX_OBJECT_NAME];
 	int ret;
 
+	if (name_cache_get(ovid, name, hval, &idx)) {
+		ret = sd_read_object(vid_to_data_oid(ovid, idx), (char *)onode,
+				     sizeof(*onode), 0);
+		if (ret == SD_RES_SUCCESS && strcmp(onode->name, name) == 0)
+			return SD_RES_SUCCESS;
+		/* Deleted or moved by another gateway */
+		name_cache_del(ovid, name, hval);
+	}
+
+	inode = xmalloc(sizeof(struct sd_inode));
 	ret = sd_read_object(vid_to_vdi_oid(ovid), (char *)inode,
 			     sizeof(*inode), 0);
 	if (ret != SD_RES_SUCCESS) {
@@ -1129,19 +1487,27 @@ static int onode_lookup_nolock(struct kv_onode *onode, uint32_t ovid,
 		goto out;
 	}
 
-	hval = sd_hash(name, strlen(name));
 	for (i = 0; i < MAX_DATA_OBJS; i++) {
 		idx = (hval + i) % MAX_DATA_OBJS;
 		tmp_vid = sd_inode_get_vid(inode, idx);
 		if (tmp_vid) {
 			uint64_t oid = vid_to_data_oid(ovid, idx);
 
-			ret = sd_read_object(oid, (char *)onode,
-					     sizeof(*onode), 0);
+			/* Read only the name of the onodes we pass by */
+			ret = sd_read_object(oid, tmp_name, sizeof(tmp_name),
+					     0);
 			if (ret != SD_RES_SUCCESS)
 				goto out;
-			if (strcmp(onode->name, name) == 0)
+			if (tmp_name[0] == '\0')
+				continue;
+			tmp_name[sizeof(tmp_name) - 1] = '\0';
+			name_cache_set(ovid, tmp_name,
+				       sd_hash(tmp_name, strlen(tmp_name)), idx);
+			if (strcmp(tmp_name, name) == 0) {
+				ret = sd_read_object(oid, (char *)onode,
+						     sizeof(*onode), 0);
 				break;
+			}
 		} else {
 			ret = SD_RES_NO_OBJ;
 			break;
@@ -1172,22 +1538,27 @@ static int onode_read_data(struct kv_onode *onode, struct http_request *req)
 	int ret;
 	uint64_t off = 0, len = onode->size;
 
-	if (req->offset || req->data_length) {
-		off = req->offset;
-		len = req->data_length;
-		if ((off + len - 1) > onode->size) {
-			if (onode->size > off)
-				len = onode->size - off;
-			else
-				len = 0;
-		}
+	if (req->range) {
+		if (req->range_suffix) {
+			len = min(req->data_length, onode->size);
+			off = onode->size - len;
+		} else if (req->offset < onode->size) {
+			off = req->offset;
+			len = onode->size - off;
+			/* the range can go beyond the end of the object */
+			if (req->data_length)
+				len = min(req->data_length, len);
+		} else
+			len = 0;
+
+		if (!len)
+			return SD_RES_INVALID_PARMS;
+		req->total_length = onode->size;
 	}
 
+	req->offset = off;
 	req->data_length = len;
-	if (!len)
-		return SD_RES_INVALID_PARMS;
-
-	http_response_header(req, OK);
+	http_response_header(req, req->range ? PARTIAL_CONTENT : OK);
 
 	if (!onode->inlined)
 		return onode_read_extents(onode, req);
@@ -1222,6 +1593,8 @@ static int onode_delete(struct kv_onode *onode)
 		sd_err("failed to zero onode for %s", onode->name);
 		return ret;
 	}
+	name_cache_del(oid_to_vid(onode->oid), onode->name,
+		       sd_hash(onode->name, strlen(onode->name)));
 
 	ret = onode_free_data(onode);
 	if (ret != SD_RES_SUCCESS)
@@ -1603,8 +1976,10 @@ out:
 }
 
 int kv_iterate_object(const char *account, const char *bucket,
+		      const struct kv_list_params *params,
 		      object_iter_cb cb, void *opaque)
 {
+	static const struct kv_list_params all;
 	char vdi_name[SD_MAX_VDI_LEN];
 	uint32_t bucket_vid;
 	int ret;
@@ -1615,7 +1990,7 @@ int kv_iterate_object(const char *account, const char *bucket,
 		return ret;
 
 	sys->cdrv->lock(bucket_vid);
-	ret = bucket_iterate_object(bucket_vid, cb, opaque);
+	ret = bucket_iterate_object(bucket_vid, params ?: &all, cb, opaque);
 	sys->cdrv->unlock(bucket_vid);
 
 	return ret;
@@ -52,8 +52,11 @@ static void s3_get_bucket_cb(const char *object, void *opaque)
 static void s3_get_bucket(struct http_request *req, const char *bucket)
 {
 	bool print_header = true;
+	struct kv_list_params params;
 
-	kv_iterate_object("s3", bucket, s3_get_bucket_cb, &print_header);
+	http_request_list_params(req, "max-keys", &params);
+	kv_iterate_object("s3", bucket, &params, s3_get_bucket_cb,
+			  &print_header);
 
 	switch (req->status) {
 	case OK:
@@ -127,10 +127,12 @@ static void swift_get_container(struct http_request *req, const char *account,
 				const char *container)
 {
 	struct strbuf buf = STRBUF_INIT;
+	struct kv_list_params params;
 	int ret;
 
-	ret = kv_iterate_object(account, container, swift_get_container_cb,
-				&buf);
+	http_request_list_params(req, "limit", &params);
+	ret = kv_iterate_object(account, container, &params,
+				swift_get_container_cb, &buf);
 	switch (ret) {
 	case SD_RES_SUCCESS:
 		req->data_length = buf.len;
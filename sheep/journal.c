@@ -58,6 +58,31 @@ static struct sd_mutex jfile_lock = SD_MUTEX_INITIALIZER;
 
 static struct work_queue *commit_wq;
 
+/*
+ * The objects written through each journal file.  When a journal file is
+ * committed, only these objects (and the directories of the created or
+ * removed ones) are synced instead of calling sync() for the whole system.
+ *
+ * jfile_dirty[i] is only updated by the flusher after it writes a group to
+ * journal file i, and is taken by the commit work of that file.  The two
+ * never run at the same time because switching back to the file waits for
+ * journal_commit_mutex.
+ */
+#define JO_DATA 0x1 /* the object data needs fdatasync() */
+#define JO_DIR 0x2 /* the directory entry needs fsync() of the directory */
+
+struct journal_obj {
+	struct rb_node rb;
+	struct list_node list;
+	uint64_t oid;
+	uint8_t ec_index;
+	uint8_t flags;
+};
+
+static struct rb_root jfile_dirty[2] = { RB_ROOT, RB_ROOT };
+
+static int journal_group_init(void);
+
 static int create_journal_file(const char *root, const char *name)
 {
 	int fd, flags = O_DSYNC | O_RDWR | O_TRUNC | O_CREAT | O_DIRECT;
@@ -133,35 +158,133 @@ static bool journal_entry_full_write(struct journal_descriptor *jd)
 	return true;
 }
 
-static int replay_journal_entry(struct journal_descriptor *jd)
+/*
+ * Journal replay
+ *
+ * The journal files are parsed once into the per-object lists of the writes
+ * to replay.  A write which is fully covered by a later one of the same
+ * object is dropped, and a removal drops all the earlier writes.  Then the
+ * objects are replayed in parallel, one thread per object directory (MD
+ * disk), writing the extents straight from the mapped journal files.
+ */
+struct replay_extent {
+	struct list_node list;
+	uint64_t offset;
+	uint64_t size;
+	const char *data;
+};
+
+struct replay_obj {
+	struct rb_node rb;
+	struct list_node list;
+	uint64_t oid;
+	bool create;
+	bool remove;
+	struct list_head extents;
+};
+
+struct replay_disk {
+	struct rb_node rb;
+	char dir[PATH_MAX];
+	struct list_head objs;
+	sd_thread_t thread;
+	bool started;
+	int ret;
+};
+
+static int replay_obj_cmp(const struct replay_obj *a,
+			  const struct replay_obj *b)
+{
+	return intcmp(a->oid, b->oid);
+}
+
+static int replay_disk_cmp(const struct replay_disk *a,
+			   const struct replay_disk *b)
+{
+	return strcmp(a->dir, b->dir);
+}
+
+static void free_extents(struct replay_obj *obj)
+{
+	struct replay_extent *ext;
+
+	list_for_each_entry(ext, &obj->extents, list) {
+		list_del(&ext->list);
+		free(ext);
+	}
+}
+
+static void free_replay_objs(struct rb_root *objs)
+{
+	struct replay_obj *obj;
+
+	rb_for_each_entry(obj, objs, rb) {
+		rb_erase(&obj->rb, objs);
+		free_extents(obj);
+		free(obj);
+	}
+}
+
+static void add_replay_entry(struct rb_root *objs,
+			     struct journal_descriptor *jd)
+{
+	struct replay_obj key = { .oid = jd->oid }, *obj;
+	struct replay_extent *ext;
+
+	obj = rb_search(objs, &key, rb, replay_obj_cmp);
+	if (!obj) {
+		obj = xzalloc(sizeof(*obj));
+		obj->oid = jd->oid;
+		INIT_LIST_HEAD(&obj->extents);
+		rb_insert(objs, obj, rb, replay_obj_cmp);
+	}
+
+	if (jd->flag == JF_REMOVE_OBJ) {
+		free_extents(obj);
+		obj->remove = true;
+		obj->create = false;
+		return;
+	}
+
+	if (jd->create)
+		obj->create = true;
+
+	/* Drop the older writes which this one overwrites */
+	list_for_each_entry(ext, &obj->extents, list) {
+		if (jd->offset <= ext->offset &&
+		    ext->offset + ext->size <= jd->offset + jd->size) {
+			list_del(&ext->list);
+			free(ext);
+		}
+	}
+
+	ext = xmalloc(sizeof(*ext));
+	ext->offset = jd->offset;
+	ext->size = jd->size;
+	ext->data = (char *)jd + JOURNAL_DESC_SIZE;
+	list_add_tail(&ext->list, &obj->extents);
+}
+
+static int replay_obj(struct replay_obj *obj)
 {
 	char path[PATH_MAX];
+	struct replay_extent *ext;
 	ssize_t size;
-	uint32_t object_size = 0;
 	int fd, flags = O_WRONLY, ret = 0;
-	void *buf = NULL;
-	char *p = (char *)jd;
 
 	snprintf(path, PATH_MAX, "%s/%016"PRIx64,
-		 md_get_object_dir(jd->oid), jd->oid);
+		 md_get_object_dir(obj->oid), obj->oid);
 
-	if (jd->flag == JF_REMOVE_OBJ) {
+	if (obj->remove) {
 		sd_info("%s (remove)", path);
 		unlink(path);
-
-		return 0;
-	}
-
-	if (jd->flag != JF_STORE) {
-		sd_emerg("flag is not JF_STORE, the journaling file is broken."
-		      " please remove the journaling file and restart sheep daemon");
-		return -1;
 	}
+	if (list_empty(&obj->extents))
+		return 0;
 
-	sd_info("%s, size %" PRIu64 ", off %" PRIu64 ", %d", path, jd->size,
-		jd->offset, jd->create);
+	sd_info("%s, %d", path, obj->create);
 
-	if (jd->create)
+	if (obj->create)
 		flags |= O_CREAT;
 
 	fd = open(path, flags, sd_def_fmode);
@@ -169,36 +292,110 @@ static int replay_journal_entry(struct journal_descriptor *jd)
 		sd_err("open %m");
 		return -1;
 	}
-	if (jd->create) {
-		object_size = get_vdi_object_size(oid_to_vid(jd->oid));
-		ret = prealloc(fd, object_size);
+	if (obj->create) {
+		ret = prealloc(fd, get_vdi_object_size(oid_to_vid(obj->oid)));
 		if (ret < 0)
 			goto out;
 	}
-	buf = xmalloc(jd->size);
-	p += JOURNAL_DESC_SIZE;
-	memcpy(buf, p, jd->size);
-	size = xpwrite(fd, buf, jd->size, jd->offset);
-	if (size != jd->size) {
-		sd_err("write %zd, size %" PRIu64 ", errno %m", size, jd->size);
+	list_for_each_entry(ext, &obj->extents, list) {
+		sd_debug("%s, size %"PRIu64", off %"PRIu64, path, ext->size,
+			 ext->offset);
+		size = xpwrite(fd, ext->data, ext->size, ext->offset);
+		if (size != ext->size) {
+			sd_err("write %zd, size %" PRIu64 ", errno %m", size,
+			       ext->size);
+			ret = -1;
+			goto out;
+		}
+	}
+	if (fdatasync(fd) < 0) {
+		sd_err("fdatasync %s, %m", path);
 		ret = -1;
-		goto out;
 	}
 out:
-	free(buf);
 	close(fd);
 	return ret;
 }
 
-static int do_recover(int fd)
+static void *replay_worker(void *arg)
+{
+	struct replay_disk *disk = arg;
+	struct replay_obj *obj;
+	int fd;
+
+	list_for_each_entry(obj, &disk->objs, list) {
+		if (replay_obj(obj) < 0)
+			disk->ret = -1;
+	}
+
+	/* Make the created and removed objects persistent */
+	fd = open(disk->dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || fsync(fd) < 0) {
+		sd_err("failed to sync %s, %m", disk->dir);
+		disk->ret = -1;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	return NULL;
+}
+
+static int replay_journal(struct rb_root *objs)
+{
+	struct rb_root disks = RB_ROOT;
+	struct replay_disk *disk, *old;
+	struct replay_obj *obj;
+	int ret = 0;
+
+	disk = xzalloc(sizeof(*disk));
+	rb_for_each_entry(obj, objs, rb) {
+		pstrcpy(disk->dir, sizeof(disk->dir),
+			md_get_object_dir(obj->oid));
+		old = rb_insert(&disks, disk, rb, replay_disk_cmp);
+		if (!old) {
+			INIT_LIST_HEAD(&disk->objs);
+			old = disk;
+			disk = xzalloc(sizeof(*disk));
+		}
+		list_add_tail(&obj->list, &old->objs);
+	}
+	free(disk);
+
+	rb_for_each_entry(disk, &disks, rb) {
+		if (sd_thread_create("journal replay", &disk->thread,
+				     replay_worker, disk) == 0)
+			disk->started = true;
+		else
+			replay_worker(disk);
+	}
+
+	rb_for_each_entry(disk, &disks, rb) {
+		if (disk->started)
+			sd_thread_join(disk->thread, NULL);
+		if (disk->ret < 0)
+			ret = -1;
+		rb_erase(&disk->rb, &disks);
+		free(disk);
+	}
+
+	return ret;
+}
+
+/*
+ * Map the journal file and add its entries to 'objs'.  The map has to be kept
+ * until the entries are replayed.
+ */
+static int parse_journal_file(int fd, struct rb_root *objs, void **map,
+			      size_t *len)
 {
 	struct journal_descriptor *jd;
-	void *map;
 	char *p, *end;
 	struct stat st;
 
+	*map = NULL;
 	if (fstat(fd, &st) < 0) {
 		sd_err("fstat %m");
+		close(fd);
 		return -1;
 	}
 
@@ -212,45 +409,55 @@ static int do_recover(int fd)
 		return 0;
 	}
 
-	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	*map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
-	if (map == MAP_FAILED) {
+	if (*map == MAP_FAILED) {
 		sd_err("%m");
+		*map = NULL;
 		return -1;
 	}
+	*len = st.st_size;
 
-	end = (char *)map + st.st_size;
-	for (p = map; p < end;) {
+	end = (char *)*map + st.st_size;
+	for (p = *map; p < end;) {
 		jd = (struct journal_descriptor *)p;
 		if (jd->magic != JOURNAL_DESC_MAGIC) {
 			/* Empty area */
 			p += SECTOR_SIZE;
 			continue;
 		}
+		if (p + JOURNAL_META_SIZE + round_up(jd->size, SECTOR_SIZE) >
+		    end)
+			break;
 		/* We skip partial write because it is not acked back to VM */
 		if (!journal_entry_full_write(jd))
 			goto skip;
 
-		if (replay_journal_entry(jd) < 0)
+		if (jd->flag != JF_STORE && jd->flag != JF_REMOVE_OBJ) {
+			sd_emerg("flag is not JF_STORE, the journaling file is"
+				 " broken. please remove the journaling file"
+				 " and restart sheep daemon");
 			return -1;
+		}
+		add_replay_entry(objs, jd);
 skip:
 		p += JOURNAL_META_SIZE + round_up(jd->size, SECTOR_SIZE);
 	}
-	munmap(map, st.st_size);
-	/* Do a final sync() to assure data is reached to the disk */
-	sync();
+
 	return 0;
 }
 
 /*
  * We recover the journal file in order of wall time in the corner case that
  * sheep crashes while in the middle of journal committing. For most of cases,
- * we actually only recover one jfile, the other would be empty. This process
- * is fast with buffered IO that only take several seconds at most.
+ * we actually only recover one jfile, the other would be empty.
  */
 static int check_recover_journal_file(const char *p)
 {
-	int old = 0, new = 0;
+	struct rb_root objs = RB_ROOT;
+	int old = 0, new = 0, ret = -1;
+	void *map[2] = {};
+	size_t len[2];
 
 	if (get_old_new_jfile(p, &old, &new) < 0)
 		return -1;
@@ -259,16 +466,25 @@ static int check_recover_journal_file(const char *p)
 	if (old == 0)
 		return 0;
 
-	if (do_recover(old) < 0) {
+	if (parse_journal_file(old, &objs, &map[0], &len[0]) < 0) {
 		sd_emerg("recovering from journal file (old) failed");
-		return -1;
+		close(new);
+		goto out;
 	}
-	if (do_recover(new) < 0) {
+	if (parse_journal_file(new, &objs, &map[1], &len[1]) < 0) {
 		sd_emerg("recovering from journal file (new) failed");
-		return -1;
+		goto out;
 	}
 
-	return 0;
+	ret = replay_journal(&objs);
+	if (ret < 0)
+		sd_emerg("replaying journal files failed");
+out:
+	free_replay_objs(&objs);
+	for (int i = 0; i < ARRAY_SIZE(map); i++)
+		if (map[i])
+			munmap(map[i], len[i]);
+	return ret;
 }
 
 int journal_file_init(const char *path, size_t size, bool skip)
@@ -295,7 +511,7 @@ int journal_file_init(const char *path, size_t size, bool skip)
 		return -1;
 	}
 
-	return 0;
+	return journal_group_init();
 }
 
 void clean_journal_file(const char *p)
@@ -323,15 +539,138 @@ static inline bool jfile_enough_space(size_t size)
 
 static struct sd_mutex journal_commit_mutex = SD_MUTEX_INITIALIZER;
 
+static int journal_obj_cmp(const struct journal_obj *a,
+			   const struct journal_obj *b)
+{
+	int ret = intcmp(a->oid, b->oid);
+
+	if (ret)
+		return ret;
+	return intcmp(a->ec_index, b->ec_index);
+}
+
+/* Called by the flusher when it writes a group to journal file 'idx' */
+static void mark_dirty_objs(struct list_head *objs, int idx)
+{
+	struct journal_obj *obj, *old;
+
+	list_for_each_entry(obj, objs, list) {
+		list_del(&obj->list);
+		old = rb_insert(&jfile_dirty[idx], obj, rb, journal_obj_cmp);
+		if (old) {
+			old->flags |= obj->flags;
+			free(obj);
+		}
+	}
+}
+
+struct journal_dir {
+	struct rb_node rb;
+	char path[PATH_MAX];
+};
+
+static int journal_dir_cmp(const struct journal_dir *a,
+			   const struct journal_dir *b)
+{
+	return strcmp(a->path, b->path);
+}
+
+static void add_dirty_dir(struct rb_root *root, const char *path)
+{
+	struct journal_dir *dir = xmalloc(sizeof(*dir));
+	char *p;
+
+	pstrcpy(dir->path, sizeof(dir->path), path);
+	p = strrchr(dir->path, '/');
+	if (p)
+		*p = '\0';
+
+	if (rb_insert(root, dir, rb, journal_dir_cmp))
+		free(dir);
+}
+
+static int sync_path(const char *path, int flags)
+{
+	int fd, ret;
+
+	fd = open(path, flags);
+	if (fd < 0) {
+		/* Removed after it was written */
+		if (errno == ENOENT)
+			return 0;
+		sd_err("failed to open %s, %m", path);
+		return -1;
+	}
+	ret = (flags & O_DIRECTORY) ? fsync(fd) : fdatasync(fd);
+	if (ret < 0)
+		sd_err("failed to sync %s, %m", path);
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Make the objects written through journal file 'idx' persistent.  Return
+ * the number of the synced objects, or -1 if some of them failed.
+ */
+static int checkpoint_objs(int idx)
+{
+	struct rb_root dirs = RB_ROOT;
+	struct journal_obj *obj;
+	struct journal_dir *dir;
+	char path[PATH_MAX];
+	int nr = 0, ret = 0;
+
+	rb_for_each_entry(obj, &jfile_dirty[idx], rb) {
+		sd_store->get_path(obj->oid, obj->ec_index, path);
+		if ((obj->flags & JO_DATA) && sync_path(path, O_RDONLY) < 0)
+			ret = -1;
+		if (obj->flags & JO_DIR)
+			add_dirty_dir(&dirs, path);
+		rb_erase(&obj->rb, &jfile_dirty[idx]);
+		free(obj);
+		nr++;
+	}
+
+	rb_for_each_entry(dir, &dirs, rb) {
+		if (sync_path(dir->path, O_RDONLY | O_DIRECTORY) < 0)
+			ret = -1;
+		rb_erase(&dir->rb, &dirs);
+		free(dir);
+	}
+
+	return ret < 0 ? ret : nr;
+}
+
 /*
  * We rely on the kernel's page cache to cache data objects to 1) boost read
  * performance 2) simplify read path so that data committing is simply a
- * sync() operation and We do it in a dedicated thread to avoid blocking
- * the writer by switch back and forth between two journal files.
+ * checkpoint of the objects written through the journal file.  We do it in a
+ * dedicated thread to avoid blocking the writer by switch back and forth
+ * between two journal files.
+ *
+ * The checkpoint syncs only those objects, so it doesn't flush the other
+ * filesystems on the host.  If any of them fails, we fall back to sync().
  */
 static void journal_commit_data_work(struct work *work)
 {
-	sync();
+	int idx = jfile.commit_fd == jfile_fds[0] ? 0 : 1, nr;
+	uint64_t start = clock_get_time(), elapsed;
+
+	nr = checkpoint_objs(idx);
+	if (unlikely(nr < 0)) {
+		sd_err("checkpoint failed, fall back to sync()");
+		sync();
+		nr = 0;
+	}
+
+	elapsed = (clock_get_time() - start) / 1000;
+	uatomic_inc(&sys->stat.j.checkpoint_nr);
+	uatomic_add(&sys->stat.j.checkpoint_obj_nr, nr);
+	uatomic_add(&sys->stat.j.checkpoint_time, elapsed);
+	if (elapsed > sys->stat.j.max_checkpoint_time)
+		sys->stat.j.max_checkpoint_time = elapsed;
+	sd_debug("journal file %d, %d objects, %"PRIu64" us", idx, nr, elapsed);
 
 	if (unlikely(xftruncate(jfile.commit_fd, 0) < 0))
 		panic("truncate %m");
@@ -370,24 +709,217 @@ static void switch_journal_file(void)
 	queue_work(commit_wq, w);
 }
 
-static int journal_file_write(struct journal_descriptor *jd, const char *buf)
+/*
+ * Group commit
+ *
+ * Writing every journal entry with its own O_DSYNC pwrite() makes small
+ * synchronous writes bound by the IOPS of the journal device.  Instead, the
+ * writers copy their entries into a shared ring of preallocated aligned
+ * buffers (journal groups) and a single flusher thread writes the whole
+ * group with one O_DIRECT write, then wakes up all of its writers at once.
+ *
+ * The flusher seals the open group as soon as it is idle, so a lonely writer
+ * doesn't wait for a group to fill up, while the writers which arrive during
+ * a flush are batched into the next group.  The on-disk format doesn't
+ * change: a group is just a run of journal entries.
+ *
+ * A group goes through JG_FREE -> JG_OPEN -> JG_SEALED -> JG_FLUSHING ->
+ * JG_DONE and is freed again when the last writer picks up the result.  All
+ * the fields of the groups are protected by jfile_lock.  jfile.pos and the
+ * journal file switching are only touched by the flusher.
+ */
+#define JOURNAL_NR_GROUPS 4
+#define JOURNAL_GROUP_SIZE (1UL << 20) /* 1 MB */
+
+enum journal_group_state {
+	JG_FREE,
+	JG_OPEN,
+	JG_SEALED,
+	JG_FLUSHING,
+	JG_DONE,
+};
+
+struct journal_group {
+	enum journal_group_state state;
+	char *buf;		/* preallocated, JOURNAL_GROUP_SIZE */
+	char *data;		/* buf, or a bigger one for a huge entry */
+	size_t len;
+	int nr_copying;		/* writers still filling their entries */
+	int nr_refs;		/* writers waiting for the result */
+	int ret;
+	struct sd_cond done_cond;
+	struct list_head obj_list;	/* journal_obj of the entries */
+};
+
+static struct journal_group jgroups[JOURNAL_NR_GROUPS];
+static uint64_t jgroup_head;	/* sequence number of the group to fill */
+static uint64_t jgroup_tail;	/* sequence number of the group to flush */
+static struct sd_cond jgroup_free_cond = SD_COND_INITIALIZER;
+static struct sd_cond jflush_cond = SD_COND_INITIALIZER;
+
+static inline struct journal_group *seq_to_group(uint64_t seq)
+{
+	return jgroups + seq % JOURNAL_NR_GROUPS;
+}
+
+/* Called with jfile_lock held */
+static struct journal_group *get_open_group(void)
+{
+	struct journal_group *g;
+
+	for (;;) {
+		g = seq_to_group(jgroup_head);
+		if (g->state == JG_FREE) {
+			g->state = JG_OPEN;
+			g->data = g->buf;
+			g->len = 0;
+			g->ret = SD_RES_SUCCESS;
+			INIT_LIST_HEAD(&g->obj_list);
+		}
+		if (g->state == JG_OPEN)
+			return g;
+
+		/* All the groups are in flight */
+		sd_cond_wait(&jgroup_free_cond, &jfile_lock);
+	}
+}
+
+/* Called with jfile_lock held */
+static void seal_group(struct journal_group *g)
+{
+	g->state = JG_SEALED;
+	jgroup_head++;
+	sd_cond_signal(&jflush_cond);
+}
+
+/* Called with jfile_lock held */
+static void put_group(struct journal_group *g)
+{
+	if (--g->nr_refs > 0)
+		return;
+
+	if (g->data != g->buf)
+		free(g->data);
+	g->state = JG_FREE;
+	sd_cond_broadcast(&jgroup_free_cond);
+}
+
+static int journal_group_write(struct journal_group *g)
+{
+	ssize_t written;
+
+	if (!jfile_enough_space(g->len))
+		switch_journal_file();
+	mark_dirty_objs(&g->obj_list, jfile.fd == jfile_fds[0] ? 0 : 1);
+
+	/*
+	 * Concurrent writes with the same FD is okay because we don't have any
+	 * critical sections that need lock inside kernel write path, since we
+	 * a) bypass page cache, b) don't modify i_size of this inode.
+	 *
+	 * Feel free to correct me If I am wrong.
+	 */
+	written = xpwrite(jfile.fd, g->data, g->len, jfile.pos);
+	jfile.pos += g->len;
+	if (unlikely(written != g->len)) {
+		sd_err("failed, written %zd, len %zu", written, g->len);
+		/* FIXME: teach journal file handle EIO gracefully */
+		return SD_RES_EIO;
+	}
+
+	return SD_RES_SUCCESS;
+}
+
+static void *journal_flusher(void *arg)
+{
+	struct journal_group *g;
+	int ret;
+
+	pthread_detach(pthread_self());
+
+	sd_mutex_lock(&jfile_lock);
+	for (;;) {
+		g = seq_to_group(jgroup_tail);
+		if (g->state == JG_OPEN && g->len > 0)
+			seal_group(g);
+		if (g->state != JG_SEALED || g->nr_copying > 0) {
+			sd_cond_wait(&jflush_cond, &jfile_lock);
+			continue;
+		}
+
+		g->state = JG_FLUSHING;
+		sd_mutex_unlock(&jfile_lock);
+
+		ret = journal_group_write(g);
+
+		sd_mutex_lock(&jfile_lock);
+		g->ret = ret;
+		g->state = JG_DONE;
+		jgroup_tail++;
+		sd_cond_broadcast(&g->done_cond);
+	}
+	sd_mutex_unlock(&jfile_lock);
+
+	return NULL;
+}
+
+static int journal_group_init(void)
+{
+	sd_thread_t thread;
+
+	for (int i = 0; i < JOURNAL_NR_GROUPS; i++) {
+		jgroups[i].buf = xvalloc(JOURNAL_GROUP_SIZE);
+		sd_cond_init(&jgroups[i].done_cond);
+		INIT_LIST_HEAD(&jgroups[i].obj_list);
+	}
+
+	if (sd_thread_create("journal flush", &thread, journal_flusher,
+			     NULL) != 0) {
+		sd_err("failed to create a journal flusher, %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int journal_file_write(struct journal_descriptor *jd, const char *buf,
+			      uint8_t ec_index)
 {
 	uint32_t marker = JOURNAL_END_MARKER;
-	int ret = SD_RES_SUCCESS;
+	int ret;
 	uint64_t size = jd->size;
-	ssize_t written, rusize = round_up(size, SECTOR_SIZE),
+	size_t rusize = round_up(size, SECTOR_SIZE),
 		wsize = JOURNAL_META_SIZE + rusize;
-	off_t woff;
-	char *wbuffer, *p;
+	struct journal_group *g;
+	struct journal_obj *obj;
+	char *p;
+
+	obj = xzalloc(sizeof(*obj));
+	obj->oid = jd->oid;
+	obj->ec_index = ec_index;
+	if (jd->flag == JF_REMOVE_OBJ)
+		obj->flags = JO_DIR;
+	else
+		obj->flags = jd->create ? JO_DATA | JO_DIR : JO_DATA;
 
 	sd_mutex_lock(&jfile_lock);
-	if (!jfile_enough_space(wsize))
-		switch_journal_file();
-	woff = jfile.pos;
-	jfile.pos += wsize;
+	g = get_open_group();
+	if (g->len > 0 && g->len + wsize > JOURNAL_GROUP_SIZE) {
+		seal_group(g);
+		g = get_open_group();
+	}
+	/* A huge entry gets a group of its own */
+	if (unlikely(wsize > JOURNAL_GROUP_SIZE))
+		g->data = xvalloc(wsize);
+	p = g->data + g->len;
+	g->len += wsize;
+	list_add_tail(&obj->list, &g->obj_list);
+	g->nr_copying++;
+	g->nr_refs++;
+	if (g->len >= JOURNAL_GROUP_SIZE)
+		seal_group(g);
 	sd_mutex_unlock(&jfile_lock);
 
-	p = wbuffer = xvalloc(wsize);
 	memcpy(p, jd, JOURNAL_DESC_SIZE);
 	p += JOURNAL_DESC_SIZE;
 	memcpy(p, buf, size);
@@ -397,27 +929,21 @@ static int journal_file_write(struct journal_descriptor *jd, const char *buf)
 		p += rusize - size;
 	}
 	memcpy(p, &marker, JOURNAL_MARKER_SIZE);
-	/*
-	 * Concurrent writes with the same FD is okay because we don't have any
-	 * critical sections that need lock inside kernel write path, since we
-	 * a) bypass page cache, b) don't modify i_size of this inode.
-	 *
-	 * Feel free to correct me If I am wrong.
-	 */
-	written = xpwrite(jfile.fd, wbuffer, wsize, woff);
-	if (unlikely(written != wsize)) {
-		sd_err("failed, written %zd, len %zd", written, wsize);
-		/* FIXME: teach journal file handle EIO gracefully */
-		ret = SD_RES_EIO;
-		goto out;
-	}
-out:
-	free(wbuffer);
+
+	sd_mutex_lock(&jfile_lock);
+	g->nr_copying--;
+	sd_cond_signal(&jflush_cond);
+	while (g->state != JG_DONE)
+		sd_cond_wait(&g->done_cond, &jfile_lock);
+	ret = g->ret;
+	put_group(g);
+	sd_mutex_unlock(&jfile_lock);
+
 	return ret;
 }
 
-int journal_write_store(uint64_t oid, const char *buf, size_t size,
-			off_t offset, bool create)
+int journal_write_store(uint64_t oid, uint8_t ec_index, const char *buf,
+			size_t size, off_t offset, bool create)
 {
 	struct journal_descriptor jd = {
 		.magic = JOURNAL_DESC_MAGIC,
@@ -428,10 +954,10 @@ int journal_write_store(uint64_t oid, const char *buf, size_t size,
 		.oid = oid,
 	};
 
-	return journal_file_write(&jd, buf);
+	return journal_file_write(&jd, buf, ec_index);
 }
 
-int journal_remove_object(uint64_t oid)
+int journal_remove_object(uint64_t oid, uint8_t ec_index)
 {
 	struct journal_descriptor jd = {
 		.magic = JOURNAL_DESC_MAGIC,
@@ -440,7 +966,7 @@ int journal_remove_object(uint64_t oid)
 		.oid = oid,
 	};
 
-	return journal_file_write(&jd, NULL);
+	return journal_file_write(&jd, NULL, ec_index);
 }
 
 static __attribute__((used)) void journal_c_build_bug_ons(void)
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2015 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dirty tracking of the data objects
+ *
+ * The store remembers, for each data object written on this node, the last
+ * epoch at which each of its OBJDIRTY_NR_BLOCKS blocks was modified.  A node
+ * which comes back after a short absence has a stale copy of the object, and
+ * with this information it only needs to fetch the blocks modified since the
+ * epoch of the stale copy instead of the whole object.
+ *
+ * The information is kept only in memory and the number of the tracked
+ * objects is limited, so we don't know about the writes before this sheep
+ * started or those of the evicted objects.  objdirty_get() fails if the
+ * answer could miss any of them, and the caller falls back to a full copy.
+ * It also fails for the objects which are not tracked at all, because we
+ * can't tell whether they were never written or their writes were missed.
+ */
+
+#include "sheep_priv.h"
+
+#define NR_OBJDIRTY_SHARDS 64
+#define OBJDIRTY_MAX_ENTRIES (UINT64_C(1) << 18)
+
+struct objdirty_entry {
+	struct rb_node rb;
+	struct list_node lru;
+	uint64_t oid;
+	uint32_t epoch[OBJDIRTY_NR_BLOCKS];
+};
+
+struct objdirty_shard {
+	struct sd_mutex lock;
+	struct rb_root root;
+	struct list_head lru_list;
+	uint64_t nr_entries;
+};
+
+static struct objdirty_shard objdirty_shards[NR_OBJDIRTY_SHARDS];
+static bool objdirty_enabled;
+
+/* The writes at the epochs after this are all tracked */
+static uint32_t objdirty_start_epoch;
+/* The last epoch at which the evicted objects were modified */
+static uint32_t objdirty_forgotten_epoch;
+
+static int objdirty_cmp(const struct objdirty_entry *a,
+			const struct objdirty_entry *b)
+{
+	return intcmp(a->oid, b->oid);
+}
+
+static inline struct objdirty_shard *oid_to_shard(uint64_t oid)
+{
+	return objdirty_shards + sd_hash_oid(oid) % NR_OBJDIRTY_SHARDS;
+}
+
+void objdirty_init(void)
+{
+	struct objdirty_shard *shard;
+
+	for (int i = 0; i < NR_OBJDIRTY_SHARDS; i++) {
+		shard = objdirty_shards + i;
+		sd_init_mutex(&shard->lock);
+		INIT_RB_ROOT(&shard->root);
+		INIT_LIST_HEAD(&shard->lru_list);
+	}
+	objdirty_start_epoch = sys_epoch();
+	objdirty_enabled = true;
+}
+
+/* Called with the shard lock held */
+static void evict_entry(struct objdirty_shard *shard)
+{
+	struct objdirty_entry *entry;
+	uint32_t last = 0, old;
+
+	entry = list_first_entry(&shard->lru_list, struct objdirty_entry, lru);
+	for (int i = 0; i < OBJDIRTY_NR_BLOCKS; i++)
+		last = max(last, entry->epoch[i]);
+
+	do {
+		old = uatomic_read(&objdirty_forgotten_epoch);
+		if (old >= last)
+			break;
+	} while (uatomic_cmpxchg(&objdirty_forgotten_epoch, old, last) != old);
+
+	rb_erase(&entry->rb, &shard->root);
+	list_del(&entry->lru);
+	shard->nr_entries--;
+	free(entry);
+}
+
+/*
+ * Mark the range of the object modified at the current epoch.  Pass 0 to
+ * 'length' to mark the whole object.
+ */
+void objdirty_mark(uint64_t oid, uint64_t offset, uint64_t length)
+{
+	struct objdirty_shard *shard = oid_to_shard(oid);
+	struct objdirty_entry key = { .oid = oid }, *entry;
+	uint32_t epoch = sys_epoch();
+	uint64_t bs;
+	int start = 0, end = OBJDIRTY_NR_BLOCKS;
+
+	if (!objdirty_enabled || !is_data_obj(oid))
+		return;
+
+	if (length) {
+		bs = get_store_objsize(oid) / OBJDIRTY_NR_BLOCKS;
+		start = offset / bs;
+		end = min(DIV_ROUND_UP(offset + length, bs),
+			  (uint64_t)OBJDIRTY_NR_BLOCKS);
+	}
+
+	sd_mutex_lock(&shard->lock);
+	entry = rb_search(&shard->root, &key, rb, objdirty_cmp);
+	if (entry)
+		list_move_tail(&entry->lru, &shard->lru_list);
+	else {
+		if (shard->nr_entries >=
+		    OBJDIRTY_MAX_ENTRIES / NR_OBJDIRTY_SHARDS)
+			evict_entry(shard);
+		entry = xzalloc(sizeof(*entry));
+		entry->oid = oid;
+		rb_insert(&shard->root, entry, rb, objdirty_cmp);
+		list_add_tail(&entry->lru, &shard->lru_list);
+		shard->nr_entries++;
+	}
+	for (int i = start; i < end; i++)
+		entry->epoch[i] = epoch;
+	sd_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Set the bits of the blocks modified at 'since' or later to 'map'.  Return
+ * false if we don't know.
+ */
+bool objdirty_get(uint64_t oid, uint32_t since, uint64_t *map)
+{
+	struct objdirty_shard *shard = oid_to_shard(oid);
+	struct objdirty_entry key = { .oid = oid }, *entry;
+	bool ret = false;
+
+	if (!objdirty_enabled || !is_data_obj(oid) ||
+	    since <= objdirty_start_epoch)
+		return false;
+
+	sd_mutex_lock(&shard->lock);
+	/* Check it under the lock not to miss the eviction of this object */
+	if (since <= uatomic_read(&objdirty_forgotten_epoch))
+		goto out;
+
+	entry = rb_search(&shard->root, &key, rb, objdirty_cmp);
+	if (!entry)
+		goto out;
+
+	*map = 0;
+	for (int i = 0; i < OBJDIRTY_NR_BLOCKS; i++)
+		if (entry->epoch[i] >= since)
+			*map |= UINT64_C(1) << i;
+	ret = true;
+out:
+	sd_mutex_unlock(&shard->lock);
+
+	return ret;
+}
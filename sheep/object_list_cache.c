@@ -13,18 +13,30 @@
 
 #include "sheep_priv.h"
 
-struct objlist_cache_entry {
-	uint64_t oid;
-	struct rb_node node;
-};
+/*
+ * The cache is split into shards by the range of the oids, so that the shards
+ * in order make the sorted list.  The data objects are spread over
+ * NR_DATA_SHARDS shards by the upper bits of their VDI ids, and the other ones
+ * (inodes, ledgers, etc.), whose oids are larger than any data object, go to
+ * the last shard.
+ *
+ * Each shard keeps a sorted array of the oids and the small sorted arrays of
+ * the recent insertions and removals.  The latter are merged into the former
+ * when either of them gets full, so the cost of an update is amortized to a
+ * few copies of the oids of the shard.
+ */
+#define NR_DATA_SHARDS 64
+#define NR_OBJLIST_SHARDS (NR_DATA_SHARDS + 1)
+#define OBJLIST_DELTA_MAX 256
 
-struct objlist_cache {
-	int tree_version;
-	int buf_version;
-	int cache_size;
-	uint64_t *buf;
-	struct rb_root root;
+struct objlist_shard {
 	struct sd_rw_lock lock;
+	uint64_t *oids;
+	size_t nr_oids;
+	uint64_t added[OBJLIST_DELTA_MAX];	/* not in oids */
+	size_t nr_added;
+	uint64_t removed[OBJLIST_DELTA_MAX];	/* in oids */
+	size_t nr_removed;
 };
 
 struct objlist_deletion_work {
@@ -32,123 +44,289 @@ struct objlist_deletion_work {
 	struct work work;
 };
 
-static struct objlist_cache obj_list_cache = {
-	.tree_version	= 1,
-	.root		= RB_ROOT,
-	.lock		= SD_RW_LOCK_INITIALIZER,
-};
+static struct objlist_shard objlist_shards[NR_OBJLIST_SHARDS];
 
-static int objlist_cache_cmp(const struct objlist_cache_entry *a,
-			     const struct objlist_cache_entry *b)
+static void __attribute__((constructor)) objlist_cache_init(void)
 {
-	return intcmp(a->oid, b->oid);
+	for (int i = 0; i < NR_OBJLIST_SHARDS; i++)
+		sd_init_rw_lock(&objlist_shards[i].lock);
 }
 
-static struct objlist_cache_entry *objlist_cache_rb_insert(struct rb_root *root,
-		struct objlist_cache_entry *new)
+static inline int oid_to_shard_idx(uint64_t oid)
 {
-	return rb_insert(root, new, node, objlist_cache_cmp);
+	if (oid >> (VDI_SPACE_SHIFT + 24))
+		return NR_DATA_SHARDS;
+
+	return oid >> (VDI_SPACE_SHIFT + 24 - 6);
 }
 
-static int objlist_cache_rb_remove(struct rb_root *root, uint64_t oid)
+static inline struct objlist_shard *oid_to_shard(uint64_t oid)
 {
-	struct objlist_cache_entry *entry,  key = { .oid = oid  };
+	return objlist_shards + oid_to_shard_idx(oid);
+}
 
-	entry = rb_search(root, &key, node, objlist_cache_cmp);
-	if (!entry)
-		return -1;
+/* Return the index of the first oid not less than 'oid' */
+static size_t lower_bound(const uint64_t *oids, size_t nr, uint64_t oid)
+{
+	size_t lo = 0, hi = nr, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (oids[mid] < oid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	rb_erase(&entry->node, root);
-	free(entry);
+	return lo;
+}
 
-	return 0;
+static inline bool array_has(const uint64_t *oids, size_t nr, uint64_t oid)
+{
+	size_t i = lower_bound(oids, nr, oid);
+
+	return i < nr && oids[i] == oid;
 }
 
-void objlist_cache_remove(uint64_t oid)
+/* Insert 'oid' to the sorted array which has room for it */
+static void array_insert(uint64_t *oids, size_t *nr, uint64_t oid)
 {
-	sd_write_lock(&obj_list_cache.lock);
-	if (!objlist_cache_rb_remove(&obj_list_cache.root, oid)) {
-		obj_list_cache.cache_size--;
-		obj_list_cache.tree_version++;
-	}
-	sd_rw_unlock(&obj_list_cache.lock);
+	size_t i = lower_bound(oids, *nr, oid);
+
+	memmove(oids + i + 1, oids + i, (*nr - i) * sizeof(*oids));
+	oids[i] = oid;
+	(*nr)++;
 }
 
-int objlist_cache_insert(uint64_t oid)
+/* Remove 'oid' from the sorted array, return false if it's not found */
+static bool array_remove(uint64_t *oids, size_t *nr, uint64_t oid)
 {
-	struct objlist_cache_entry *entry, *p;
+	size_t i = lower_bound(oids, *nr, oid);
+
+	if (i == *nr || oids[i] != oid)
+		return false;
 
-	entry = xzalloc(sizeof(*entry));
-	entry->oid = oid;
-	rb_init_node(&entry->node);
+	memmove(oids + i, oids + i + 1, (*nr - i - 1) * sizeof(*oids));
+	(*nr)--;
+	return true;
+}
 
-	sd_write_lock(&obj_list_cache.lock);
-	p = objlist_cache_rb_insert(&obj_list_cache.root, entry);
-	if (p)
-		free(entry);
-	else {
-		obj_list_cache.cache_size++;
-		obj_list_cache.tree_version++;
+static inline size_t shard_nr_oids(const struct objlist_shard *shard)
+{
+	return shard->nr_oids + shard->nr_added - shard->nr_removed;
+}
+
+/* Merge the recent updates into the array, called with the write lock held */
+static void merge_shard(struct objlist_shard *shard)
+{
+	size_t nr = shard_nr_oids(shard), i = 0, j = 0, k = 0, n = 0;
+	uint64_t *oids = xmalloc(nr * sizeof(*oids) ?: 1);
+
+	while (i < shard->nr_oids || j < shard->nr_added) {
+		if (j == shard->nr_added ||
+		    (i < shard->nr_oids && shard->oids[i] < shard->added[j])) {
+			if (k < shard->nr_removed &&
+			    shard->oids[i] == shard->removed[k])
+				k++;
+			else
+				oids[n++] = shard->oids[i];
+			i++;
+		} else
+			oids[n++] = shard->added[j++];
 	}
-	sd_rw_unlock(&obj_list_cache.lock);
 
-	return 0;
+	uatomic_add(&sys->stat.o.mem_size,
+		    ((int64_t)nr - (int64_t)shard->nr_oids) * sizeof(*oids));
+	free(shard->oids);
+	shard->oids = oids;
+	shard->nr_oids = nr;
+	shard->nr_added = 0;
+	shard->nr_removed = 0;
 }
 
-int get_obj_list(const struct sd_req *hdr, struct sd_rsp *rsp, void *data)
+void objlist_cache_remove(uint64_t oid)
 {
-	int nr = 0, ret = SD_RES_SUCCESS;
-	struct objlist_cache_entry *entry;
-	uint64_t *newbuf = NULL;
-
-	/* first try getting the cached buffer with only a read lock held */
-	sd_read_lock(&obj_list_cache.lock);
-	if (obj_list_cache.tree_version == obj_list_cache.buf_version)
-		goto ready;
-
-	/* if that fails grab a write lock for the usually necessary update */
-	sd_rw_unlock(&obj_list_cache.lock);
-	sd_write_lock(&obj_list_cache.lock);
-	if (obj_list_cache.tree_version == obj_list_cache.buf_version)
-		goto ready;
-
-	/* Update obj_list_cache.buf indirectly to keep previous pointer */
-	newbuf = realloc(obj_list_cache.buf,
-			 obj_list_cache.cache_size * sizeof(uint64_t));
-	if (!newbuf && errno == ENOMEM) {
-		sd_err("Failed to allocate memory for object list");
-		ret = SD_RES_NO_MEM;
+	struct objlist_shard *shard = oid_to_shard(oid);
+	bool removed = true;
+
+	sd_write_lock(&shard->lock);
+	if (array_remove(shard->added, &shard->nr_added, oid))
+		goto out;
+	if (!array_has(shard->oids, shard->nr_oids, oid) ||
+	    array_has(shard->removed, shard->nr_removed, oid)) {
+		removed = false;
 		goto out;
 	}
+	if (shard->nr_removed == OBJLIST_DELTA_MAX)
+		merge_shard(shard);
+	array_insert(shard->removed, &shard->nr_removed, oid);
+out:
+	sd_rw_unlock(&shard->lock);
 
-	obj_list_cache.buf_version = obj_list_cache.tree_version;
-	obj_list_cache.buf = newbuf;
+	if (removed)
+		uatomic_dec(&sys->stat.o.nr_objs);
+}
 
-	rb_for_each_entry(entry, &obj_list_cache.root, node) {
-		obj_list_cache.buf[nr++] = entry->oid;
-	}
+int objlist_cache_insert(uint64_t oid)
+{
+	struct objlist_shard *shard = oid_to_shard(oid);
+	bool inserted = false;
 
-ready:
-	if (hdr->data_length < obj_list_cache.cache_size * sizeof(uint64_t)) {
-		sd_err("GET_OBJ_LIST buffer too small");
-		ret = SD_RES_BUFFER_SMALL;
+	sd_write_lock(&shard->lock);
+	if (array_remove(shard->removed, &shard->nr_removed, oid)) {
+		inserted = true;
 		goto out;
 	}
+	if (array_has(shard->oids, shard->nr_oids, oid) ||
+	    array_has(shard->added, shard->nr_added, oid))
+		goto out;
+	if (shard->nr_added == OBJLIST_DELTA_MAX)
+		merge_shard(shard);
+	array_insert(shard->added, &shard->nr_added, oid);
+	inserted = true;
+out:
+	sd_rw_unlock(&shard->lock);
+
+	if (inserted)
+		uatomic_inc(&sys->stat.o.nr_objs);
+	return 0;
+}
+
+/*
+ * Call 'fn' for the oids in the shard from 'start' in ascending order until it
+ * returns false.  Return false if 'fn' stops the iteration.  Called with the
+ * lock of the shard held.
+ */
+static bool shard_for_each(const struct objlist_shard *shard, uint64_t start,
+			   bool (*fn)(uint64_t oid, void *arg), void *arg)
+{
+	size_t i = lower_bound(shard->oids, shard->nr_oids, start),
+	       j = lower_bound(shard->added, shard->nr_added, start),
+	       k = lower_bound(shard->removed, shard->nr_removed, start);
+	uint64_t oid;
+
+	while (i < shard->nr_oids || j < shard->nr_added) {
+		if (j == shard->nr_added ||
+		    (i < shard->nr_oids && shard->oids[i] < shard->added[j])) {
+			oid = shard->oids[i++];
+			if (k < shard->nr_removed && oid == shard->removed[k]) {
+				k++;
+				continue;
+			}
+		} else
+			oid = shard->added[j++];
+
+		if (!fn(oid, arg))
+			return false;
+	}
 
-	rsp->data_length = obj_list_cache.cache_size * sizeof(uint64_t);
-	memcpy(data, obj_list_cache.buf, rsp->data_length);
+	return true;
+}
 
-out:
-	sd_rw_unlock(&obj_list_cache.lock);
+struct objlist_copy {
+	uint64_t *oids;
+	size_t nr;
+	size_t max;
+	/* for get_obj_list_range(), copy only the oids placed on the node */
+	struct vnode_info *vinfo;
+	struct node_id nid;
+};
+
+static bool oid_placed_on(uint64_t oid, struct vnode_info *vinfo,
+			  const struct node_id *nid);
+
+static bool copy_oid(uint64_t oid, void *arg)
+{
+	struct objlist_copy *c = arg;
+
+	if (c->vinfo && !oid_placed_on(oid, c->vinfo, &c->nid))
+		return true;
+
+	c->oids[c->nr++] = oid;
+	return c->nr < c->max;
+}
+
+int get_obj_list(const struct sd_req *hdr, struct sd_rsp *rsp, void *data)
+{
+	struct objlist_copy c = {
+		.oids = data,
+		.max = hdr->data_length / sizeof(uint64_t),
+	};
+	struct objlist_shard *shard;
+	int ret = SD_RES_SUCCESS;
+
+	for (int i = 0; i < NR_OBJLIST_SHARDS; i++) {
+		shard = objlist_shards + i;
+		sd_read_lock(&shard->lock);
+		if (c.nr + shard_nr_oids(shard) > c.max)
+			ret = SD_RES_BUFFER_SMALL;
+		else if (shard_nr_oids(shard))
+			shard_for_each(shard, 0, copy_oid, &c);
+		sd_rw_unlock(&shard->lock);
+
+		if (ret != SD_RES_SUCCESS) {
+			sd_err("GET_OBJ_LIST buffer too small");
+			return ret;
+		}
+	}
+
+	rsp->data_length = c.nr * sizeof(uint64_t);
 	return ret;
 }
 
+static bool oid_placed_on(uint64_t oid, struct vnode_info *vinfo,
+			  const struct node_id *nid)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+	int nr_copies = get_obj_copy_number(oid, vinfo->nr_zones);
+
+	vinfo_oid_to_vnodes(oid, vinfo, nr_copies, vnodes);
+	for (int i = 0; i < nr_copies; i++)
+		if (node_id_cmp(&vnodes[i]->node->nid, nid) == 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Return the sorted oids from hdr->obj_list.start which are placed on the
+ * node hdr->obj_list.addr:port in 'vinfo'.  The list is returned in chunks
+ * of hdr->data_length, and a chunk shorter than that is the last one.
+ */
+int get_obj_list_range(const struct sd_req *hdr, struct sd_rsp *rsp,
+		       void *data, struct vnode_info *vinfo)
+{
+	struct objlist_copy c = {
+		.oids = data,
+		.max = hdr->data_length / sizeof(uint64_t),
+		.vinfo = vinfo,
+	};
+	struct objlist_shard *shard;
+	bool more = true;
+
+	memcpy(c.nid.addr, hdr->obj_list.addr, sizeof(c.nid.addr));
+	c.nid.port = hdr->obj_list.port;
+
+	for (int i = oid_to_shard_idx(hdr->obj_list.start);
+	     i < NR_OBJLIST_SHARDS && more && c.max; i++) {
+		shard = objlist_shards + i;
+		sd_read_lock(&shard->lock);
+		more = shard_for_each(shard, hdr->obj_list.start, copy_oid, &c);
+		sd_rw_unlock(&shard->lock);
+	}
+
+	rsp->data_length = c.nr * sizeof(uint64_t);
+	return SD_RES_SUCCESS;
+}
+
 static void objlist_deletion_work(struct work *work)
 {
 	struct objlist_deletion_work *ow =
 		container_of(work, struct objlist_deletion_work, work);
-	struct objlist_cache_entry *entry;
-	uint32_t vid = ow->vid, entry_vid;
+	struct objlist_shard *shard;
+	uint32_t vid = ow->vid;
+	uint64_t oid;
+	size_t j, n;
 
 	/*
 	 * Before reclaiming the cache belonging to the VDI just deleted,
@@ -163,21 +341,28 @@ static void objlist_deletion_work(struct work *work)
 		return;
 	}
 
-	sd_write_lock(&obj_list_cache.lock);
-	rb_for_each_entry(entry, &obj_list_cache.root, node) {
-		entry_vid = oid_to_vid(entry->oid);
-		if (entry_vid != vid)
-			continue;
-
-		/* VDI objects cannot be removed even after we delete images. */
-		if (is_vdi_obj(entry->oid))
-			continue;
-
-		sd_debug("delete object entry %016" PRIx64, entry->oid);
-		rb_erase(&entry->node, &obj_list_cache.root);
-		free(entry);
+	for (int i = 0; i < NR_OBJLIST_SHARDS; i++) {
+		shard = objlist_shards + i;
+		sd_write_lock(&shard->lock);
+		merge_shard(shard);
+		for (j = 0, n = 0; j < shard->nr_oids; j++) {
+			oid = shard->oids[j];
+			/*
+			 * VDI objects cannot be removed even after we delete
+			 * images.
+			 */
+			if (oid_to_vid(oid) != vid || is_vdi_obj(oid)) {
+				shard->oids[n++] = oid;
+				continue;
+			}
+			sd_debug("delete object entry %016" PRIx64, oid);
+		}
+		uatomic_sub(&sys->stat.o.nr_objs, shard->nr_oids - n);
+		uatomic_sub(&sys->stat.o.mem_size,
+			    (shard->nr_oids - n) * sizeof(oid));
+		shard->nr_oids = n;
+		sd_rw_unlock(&shard->lock);
 	}
-	sd_rw_unlock(&obj_list_cache.lock);
 }
 
 static void objlist_deletion_done(struct work *work)
@@ -210,15 +395,18 @@ int objlist_cache_cleanup(uint32_t vid)
 
 void objlist_cache_format(void)
 {
-	sd_write_lock(&obj_list_cache.lock);
-	rb_destroy(&obj_list_cache.root, struct objlist_cache_entry, node);
-	INIT_RB_ROOT(&obj_list_cache.root);
-	obj_list_cache.tree_version = 1;
-	obj_list_cache.buf_version = 0;
-	if (NULL != obj_list_cache.buf) {
-		free(obj_list_cache.buf);
-		obj_list_cache.buf = NULL;
+	struct objlist_shard *shard;
+
+	for (int i = 0; i < NR_OBJLIST_SHARDS; i++) {
+		shard = objlist_shards + i;
+		sd_write_lock(&shard->lock);
+		free(shard->oids);
+		shard->oids = NULL;
+		shard->nr_oids = 0;
+		shard->nr_added = 0;
+		shard->nr_removed = 0;
+		sd_rw_unlock(&shard->lock);
 	}
-	obj_list_cache.cache_size = 0;
-	sd_rw_unlock(&obj_list_cache.lock);
+	uatomic_set(&sys->stat.o.nr_objs, 0);
+	uatomic_set(&sys->stat.o.mem_size, 0);
 }
@@ -189,6 +189,7 @@ static int post_cluster_del_vdi(const struct sd_req *req, struct sd_rsp *rsp,
 	if (ret == SD_RES_SUCCESS) {
 		atomic_set_bit(vid, sys->vdi_deleted);
 		vdi_mark_deleted(vid);
+		readonly_cache_purge_vdi(vid);
 
 		if (sys->cinfo.flags & SD_CLUSTER_FLAG_RECYCLE_VID)
 			run_vid_gc(vid);
@@ -548,6 +549,30 @@ static int local_get_obj_list(struct request *req)
 	return get_obj_list(&req->rq, &req->rp, req->data);
 }
 
+static int local_get_obj_list_range(struct request *req)
+{
+	struct vnode_info *vinfo;
+	int ret;
+
+	if (!req->vinfo)
+		return SD_RES_NO_SUPPORT;
+
+	if (req->rq.epoch == sys_epoch())
+		vinfo = grab_vnode_info(req->vinfo);
+	else
+		vinfo = get_vnode_info_epoch(req->rq.epoch, req->vinfo);
+	if (!vinfo) {
+		sd_err("cannot get vnode info for epoch %"PRIu32,
+		       req->rq.epoch);
+		return SD_RES_INVALID_EPOCH;
+	}
+
+	ret = get_obj_list_range(&req->rq, &req->rp, req->data, vinfo);
+	put_vnode_info(vinfo);
+
+	return ret;
+}
+
 static int local_get_epoch(struct request *req)
 {
 	uint32_t epoch = req->rq.obj.tgt_epoch;
@@ -691,6 +716,7 @@ static int cluster_notify_vdi_del(const struct sd_req *req, struct sd_rsp *rsp,
 {
 	uint32_t vid = *(uint32_t *)data;
 
+	readonly_cache_purge_vdi(vid);
 	return objlist_cache_cleanup(vid);
 }
 
@@ -865,8 +891,17 @@ static int local_get_hash(struct request *request)
 static int local_sd_stat(const struct sd_req *req, struct sd_rsp *rsp,
 			 void *data, const struct sd_node *sender)
 {
-	memcpy(data, &sys->stat, sizeof(struct sd_stat));
-	rsp->data_length = sizeof(struct sd_stat);
+	struct wq_stat wq_stat;
+
+	work_queue_get_total_stat(&wq_stat);
+	sys->stat.w.done_nr = wq_stat.nr_done;
+	sys->stat.w.batch_nr = wq_stat.nr_batches;
+	sys->stat.w.total_latency = wq_stat.total_latency;
+	sys->stat.w.max_latency = wq_stat.max_latency;
+
+	/* The older dog knows only the sections at the head of struct sd_stat */
+	rsp->data_length = min((size_t)req->data_length, sizeof(struct sd_stat));
+	memcpy(data, &sys->stat, rsp->data_length);
 	return SD_RES_SUCCESS;
 }
 
@@ -967,6 +1002,28 @@ static int peer_remove_obj(struct request *req)
 	return sd_store->remove_object(oid, ec_index);
 }
 
+/*
+ * Instead of reading the object into the request buffer, pin the fd of the
+ * object to the request so that tx_work() can send the data to the socket
+ * directly.  Only the current objects in the working directory are handled
+ * here.
+ */
+static bool peer_read_obj_zero_copy(struct request *req)
+{
+	const struct sd_req *hdr = &req->rq;
+	struct siocb iocb = {};
+
+	if (hdr->flags & SD_FLAG_CMD_WILDCARD)
+		return false;
+	if (0 < hdr->epoch && hdr->epoch < sys_epoch())
+		return false;
+
+	req->ofd = objfd_cache_get(hdr->obj.oid, hdr->obj.ec_index,
+				   prepare_iocb(hdr->obj.oid, &iocb, false));
+
+	return req->ofd != NULL;
+}
+
 int peer_read_obj(struct request *req)
 {
 	struct sd_req *hdr = &req->rq;
@@ -978,6 +1035,16 @@ int peer_read_obj(struct request *req)
 	if (sys->gateway_only)
 		return SD_RES_NO_OBJ;
 
+	/* The buffer is not allocated for the zero copy read, see rx_work() */
+	if (!req->data) {
+		if (peer_read_obj_zero_copy(req)) {
+			rsp->data_length = hdr->data_length;
+			return SD_RES_SUCCESS;
+		}
+		req->data = xvalloc(hdr->data_length);
+		req->data_length = hdr->data_length;
+	}
+
 	memset(&iocb, 0, sizeof(iocb));
 	iocb.epoch = epoch;
 	iocb.buf = req->data;
@@ -995,6 +1062,161 @@ out:
 	return ret;
 }
 
+/*
+ * Read the blocks of the object modified at hdr->obj.offset (the epoch of the
+ * stale copy which the requester has) or later.  The reply is the bitmap of
+ * the blocks followed by their data.  If we don't know which blocks are
+ * modified, all of them are returned.
+ */
+static int peer_read_delta_obj(struct request *req)
+{
+	struct sd_req *hdr = &req->rq;
+	struct sd_rsp *rsp = &req->rp;
+	uint64_t oid = hdr->obj.oid, map, bs;
+	struct siocb iocb = { };
+	char *p = req->data;
+	int ret, i, j;
+
+	if (sys->gateway_only)
+		return SD_RES_NO_OBJ;
+	if (!is_data_obj(oid) || is_erasure_oid(oid))
+		return SD_RES_INVALID_PARMS;
+
+	bs = get_store_objsize(oid) / OBJDIRTY_NR_BLOCKS;
+	if (hdr->data_length < sizeof(map) + bs * OBJDIRTY_NR_BLOCKS)
+		return SD_RES_BUFFER_SMALL;
+
+	if (!objdirty_get(oid, hdr->obj.offset, &map))
+		map = ~UINT64_C(0);
+	memcpy(p, &map, sizeof(map));
+	p += sizeof(map);
+
+	/* Only the current object is tracked */
+	iocb.epoch = sys_epoch();
+	for (i = 0; i < OBJDIRTY_NR_BLOCKS; i = j) {
+		if (!(map & (UINT64_C(1) << i))) {
+			j = i + 1;
+			continue;
+		}
+		/* read the contiguous dirty blocks at once */
+		for (j = i + 1; j < OBJDIRTY_NR_BLOCKS; j++)
+			if (!(map & (UINT64_C(1) << j)))
+				break;
+
+		iocb.buf = p;
+		iocb.offset = i * bs;
+		iocb.length = (j - i) * bs;
+		ret = sd_store->read(oid, &iocb);
+		if (ret != SD_RES_SUCCESS)
+			return ret;
+		p += iocb.length;
+	}
+
+	rsp->data_length = p - (char *)req->data;
+	return SD_RES_SUCCESS;
+}
+
+/*
+ * Is the object obviously too large for 'room' bytes?  We check the allocated
+ * size of the file not to read the dense objects in vain.  The sparse ones can
+ * still fit after their zero blocks are cut.
+ */
+static bool obj_exceeds(uint64_t oid, size_t room)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (get_store_objsize(oid) <= room || !sd_store->get_path)
+		return false;
+
+	sd_store->get_path(oid, 0, path);
+	if (stat(path, &st) < 0)
+		return false;
+
+	return (size_t)st.st_blocks * 512 > room;
+}
+
+/*
+ * Read the objects listed in the request data for recovery.  hdr->obj.offset
+ * is the size of the buffer of the requester.  The reply is the sequence of
+ * struct obj_batch_entry, each followed by the data of the object without the
+ * zero blocks at its beginning and end.  SD_RES_BUFFER_SMALL is set to the
+ * objects which don't fit in the buffer, and the requester reads them one by
+ * one.
+ */
+static int peer_read_batch_obj(struct request *req)
+{
+	struct sd_req *hdr = &req->rq;
+	struct sd_rsp *rsp = &req->rp;
+	uint32_t nr = hdr->data_length / sizeof(uint64_t), len = hdr->obj.offset;
+	const uint64_t *oids = req->data;
+	struct obj_batch_entry ent;
+	struct siocb iocb = { };
+	char *buf, *p, *obj = NULL;
+	size_t size, obj_size = 0, room;
+	int ret;
+
+	if (sys->gateway_only)
+		return SD_RES_NO_OBJ;
+	if (len > SD_READ_BATCH_MAX_LEN || len < nr * sizeof(ent))
+		return SD_RES_INVALID_PARMS;
+
+	p = buf = xvalloc(len);
+	for (uint32_t i = 0; i < nr; i++) {
+		memset(&ent, 0, sizeof(ent));
+		ent.oid = oids[i];
+		size = get_store_objsize(ent.oid);
+		/* keep the room for the headers of the rest */
+		room = buf + len - p - (nr - i) * sizeof(ent);
+
+		if (is_erasure_oid(ent.oid)) {
+			ent.result = SD_RES_INVALID_PARMS;
+			goto next;
+		}
+		if (obj_exceeds(ent.oid, room)) {
+			ent.result = SD_RES_BUFFER_SMALL;
+			goto next;
+		}
+
+		if (obj_size < size) {
+			free(obj);
+			obj = xvalloc(size);
+			obj_size = size;
+		}
+		iocb.epoch = hdr->epoch;
+		iocb.buf = obj;
+		iocb.length = size;
+		iocb.offset = 0;
+		ret = sd_store->read(ent.oid, &iocb);
+		if (ret != SD_RES_SUCCESS) {
+			ent.result = ret;
+			goto next;
+		}
+
+		find_zero_blocks(obj, &ent.offset, &iocb.length);
+		if (iocb.length > room) {
+			ent.result = SD_RES_BUFFER_SMALL;
+			goto next;
+		}
+		ent.result = SD_RES_SUCCESS;
+		ent.length = iocb.length;
+		memcpy(p + sizeof(ent), obj + ent.offset, ent.length);
+next:
+		memcpy(p, &ent, sizeof(ent));
+		p += sizeof(ent) + ent.length;
+	}
+	free(obj);
+
+	/* The reply is larger than the request, replace the buffer */
+	if (!uring_free_buf(req->data))
+		free(req->data);
+	req->data = buf;
+	req->data_length = len;
+	rsp->data_length = p - buf;
+
+	return SD_RES_SUCCESS;
+}
+
 static int peer_write_obj(struct request *req)
 {
 	struct sd_req *hdr = &req->rq;
@@ -1204,8 +1426,8 @@ int peer_decref_object(struct request *req)
 		sd_mutex_unlock(&lock);
 		locked = false;
 
-		oid_to_nodes(ledger_oid, &req->vinfo->vroot, nr_copies,
-			     (const struct sd_node **)nodes);
+		vinfo_oid_to_nodes(ledger_oid, req->vinfo, nr_copies,
+				   (const struct sd_node **)nodes);
 
 		if (!node_cmp(&sys->this_node, nodes[0])) {
 			/* only first one node needs to remove the object */
@@ -1407,27 +1629,40 @@ static int cluster_inode_coherence(const struct sd_req *req,
 			       !!req->inode_coherence.validate, &sender->nid);
 }
 
+/*
+ * The older dog sends struct recovery_throttling without latency_slo, so copy
+ * only the fields in the buffer of the request.
+ */
+static inline size_t recovery_throttling_len(const struct request *req)
+{
+	return min((size_t)req->rq.data_length,
+		   sizeof(struct recovery_throttling));
+}
+
 static int local_get_recovery(struct request *req)
 {
 	struct recovery_throttling rthrottling;
+	size_t len = recovery_throttling_len(req);
 
 	rthrottling = get_recovery();
-	memcpy(req->data, &rthrottling, sizeof(rthrottling));
-	req->rp.data_length = sizeof(rthrottling);
+	memcpy(req->data, &rthrottling, len);
+	req->rp.data_length = len;
 
 	return SD_RES_SUCCESS;
 }
 
 static int local_set_recovery(struct request *req)
 {
-	struct recovery_throttling *rthrottling;
+	struct recovery_throttling rthrottling = {};
+	size_t len = recovery_throttling_len(req);
 
-	rthrottling = xmalloc(sizeof(struct recovery_throttling));
+	if (len < offsetof(struct recovery_throttling, latency_slo))
+		return SD_RES_INVALID_PARMS;
 
-	memcpy(rthrottling, req->data, sizeof(struct recovery_throttling));
-	set_recovery(rthrottling);
+	/* latency_slo is zero, which disables it, if it's not passed */
+	memcpy(&rthrottling, req->data, len);
+	set_recovery(&rthrottling);
 
-	free(rthrottling);
 	return SD_RES_SUCCESS;
 }
 
@@ -1677,6 +1912,12 @@ static struct sd_op_template sd_ops[] = {
 		.process_work = local_get_obj_list,
 	},
 
+	[SD_OP_GET_OBJ_LIST_RANGE] = {
+		.name = "GET_OBJ_LIST_RANGE",
+		.type = SD_OP_TYPE_LOCAL,
+		.process_work = local_get_obj_list_range,
+	},
+
 	[SD_OP_GET_EPOCH] = {
 		.name = "GET_EPOCH",
 		.type = SD_OP_TYPE_LOCAL,
@@ -1895,6 +2136,18 @@ static struct sd_op_template sd_ops[] = {
 		.process_work = peer_read_obj,
 	},
 
+	[SD_OP_READ_DELTA_PEER] = {
+		.name = "READ_DELTA_PEER",
+		.type = SD_OP_TYPE_PEER,
+		.process_work = peer_read_delta_obj,
+	},
+
+	[SD_OP_READ_BATCH_PEER] = {
+		.name = "READ_BATCH_PEER",
+		.type = SD_OP_TYPE_PEER,
+		.process_work = peer_read_batch_obj,
+	},
+
 	[SD_OP_WRITE_PEER] = {
 		.name = "WRITE_PEER",
 		.type = SD_OP_TYPE_PEER,
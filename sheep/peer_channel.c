@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2015 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multiplexed connections to the peers
+ *
+ * The gateway forwards requests over one long lived connection (channel) per
+ * peer instead of occupying a cached fd of the sockfd cache for each request.
+ * Requests are tagged with sd_req.id, so that any number of them can be in
+ * flight on the same channel.  The sender thread of the channel writes the
+ * queued requests to the peer, so that the requests to the different peers are
+ * sent in parallel.  The peer replies in completion order and the receiver
+ * thread of the channel dispatches the replies to the submitters by id.
+ *
+ * If something goes wrong with the connection, the channel is marked dead, all
+ * the inflight requests on it fail with SD_RES_NETWORK_ERROR and the next
+ * request to the peer creates a new channel.
+ */
+
+#include "sheep_priv.h"
+
+struct peer_channel {
+	struct rb_node rb;
+	struct node_id nid;
+	int fd;
+	refcnt_t refcnt;
+
+	/* protects the fields below */
+	struct sd_mutex lock;
+	bool dead;
+	uint32_t next_id;
+	struct rb_root inflight;
+	/* requests to be sent by the sender */
+	struct list_head send_queue;
+	struct sd_cond send_cond;
+};
+
+static struct rb_root channel_root = RB_ROOT;
+static struct sd_rw_lock channel_lock = SD_RW_LOCK_INITIALIZER;
+
+static int channel_cmp(const struct peer_channel *a,
+		       const struct peer_channel *b)
+{
+	return node_id_cmp(&a->nid, &b->nid);
+}
+
+static int peer_io_cmp(const struct peer_io *a, const struct peer_io *b)
+{
+	return intcmp(a->id, b->id);
+}
+
+static void free_channel(struct peer_channel *ch)
+{
+	close(ch->fd);
+	sd_destroy_cond(&ch->send_cond);
+	sd_destroy_mutex(&ch->lock);
+	free(ch);
+}
+
+static void put_channel(struct peer_channel *ch)
+{
+	if (refcount_dec(&ch->refcnt) > 0)
+		return;
+
+	free_channel(ch);
+}
+
+/* The request buffer is not accessed any more after this */
+static void peer_io_sent(struct peer_io *io)
+{
+	struct peer_io_batch *batch = io->batch;
+
+	sd_mutex_lock(&batch->lock);
+	batch->nr_unsent--;
+	sd_cond_signal(&batch->cond);
+	sd_mutex_unlock(&batch->lock);
+}
+
+static void peer_io_done(struct peer_io *io)
+{
+	struct peer_io_batch *batch = io->batch;
+
+	sd_mutex_lock(&batch->lock);
+	io->done = true;
+	batch->nr_inflight--;
+	if (io->rsp.result == SD_RES_SUCCESS)
+		batch->nr_succeeded++;
+	sd_cond_signal(&batch->cond);
+	sd_mutex_unlock(&batch->lock);
+}
+
+static void peer_io_fail(struct peer_io *io)
+{
+	io->rsp.result = SD_RES_NETWORK_ERROR;
+	io->rsp.data_length = 0;
+	peer_io_done(io);
+}
+
+/*
+ * Remove the channel from the cache and wake up the receiver, which fails the
+ * inflight requests of the channel.
+ */
+static void shutdown_channel(struct peer_channel *ch)
+{
+	bool removed = false;
+
+	sd_write_lock(&channel_lock);
+	if (rb_search(&channel_root, ch, rb, channel_cmp) == ch) {
+		rb_erase(&ch->rb, &channel_root);
+		removed = true;
+	}
+	sd_rw_unlock(&channel_lock);
+
+	sd_mutex_lock(&ch->lock);
+	ch->dead = true;
+	sd_cond_signal(&ch->send_cond);
+	sd_mutex_unlock(&ch->lock);
+
+	shutdown(ch->fd, SHUT_RDWR);
+
+	if (removed)
+		put_channel(ch);
+}
+
+/*
+ * Called after the channel is shut down.  The requests which are being sent
+ * are not in the send queue, and the sender tells that they are sent.
+ */
+static void fail_inflight_requests(struct peer_channel *ch)
+{
+	struct peer_io *io;
+
+	sd_mutex_lock(&ch->lock);
+	list_for_each_entry(io, &ch->send_queue, send_list) {
+		list_del(&io->send_list);
+		peer_io_sent(io);
+	}
+	rb_for_each_entry(io, &ch->inflight, rb) {
+		rb_erase(&io->rb, &ch->inflight);
+		peer_io_fail(io);
+	}
+	sd_mutex_unlock(&ch->lock);
+}
+
+static void *channel_sender(void *arg)
+{
+	struct peer_channel *ch = arg;
+	struct peer_io *io;
+	int ret;
+
+	pthread_detach(pthread_self());
+
+	for (;;) {
+		sd_mutex_lock(&ch->lock);
+		while (!ch->dead && list_empty(&ch->send_queue))
+			sd_cond_wait(&ch->send_cond, &ch->lock);
+		if (ch->dead) {
+			sd_mutex_unlock(&ch->lock);
+			break;
+		}
+		io = list_first_entry(&ch->send_queue, struct peer_io,
+				      send_list);
+		list_del(&io->send_list);
+		sd_mutex_unlock(&ch->lock);
+
+		ret = send_req(ch->fd, &io->hdr, io->buf, io->wlen,
+			       sheep_need_retry, io->hdr.epoch,
+			       MAX_RETRY_COUNT);
+		peer_io_sent(io);
+		if (ret) {
+			/* The stream is broken, let the receiver fail them */
+			shutdown_channel(ch);
+			break;
+		}
+	}
+
+	put_channel(ch);
+	return NULL;
+}
+
+static void *channel_receiver(void *arg)
+{
+	struct peer_channel *ch = arg;
+	struct peer_io key, *io;
+	struct sd_rsp rsp;
+
+	pthread_detach(pthread_self());
+
+	for (;;) {
+		if (do_read(ch->fd, &rsp, sizeof(rsp), NULL, 0, UINT32_MAX))
+			break;
+
+		key.id = rsp.id;
+		sd_mutex_lock(&ch->lock);
+		io = rb_search(&ch->inflight, &key, rb, peer_io_cmp);
+		if (io)
+			rb_erase(&io->rb, &ch->inflight);
+		sd_mutex_unlock(&ch->lock);
+
+		if (unlikely(!io || rsp.data_length > io->buf_len)) {
+			sd_err("invalid reply %"PRIu32" from %s", rsp.id,
+			       addr_to_str(ch->nid.addr, ch->nid.port));
+			if (io)
+				peer_io_fail(io);
+			break;
+		}
+
+		if (rsp.data_length &&
+		    do_read(ch->fd, io->buf, rsp.data_length, NULL, 0,
+			    UINT32_MAX)) {
+			peer_io_fail(io);
+			break;
+		}
+
+		io->rsp = rsp;
+		peer_io_done(io);
+	}
+
+	sd_debug("%s", addr_to_str(ch->nid.addr, ch->nid.port));
+	shutdown_channel(ch);
+	fail_inflight_requests(ch);
+
+	put_channel(ch);
+	return NULL;
+}
+
+/* Try to connect to the IO address first, and fall back to the non-IO one */
+static int connect_to_peer(const struct node_id *nid)
+{
+	int fd;
+
+	if (nid->io_port) {
+		fd = connect_to_addr(nid->io_addr, nid->io_port);
+		if (fd >= 0)
+			return fd;
+		sd_err("fallback to non-io connection");
+	}
+
+	return connect_to_addr(nid->addr, nid->port);
+}
+
+static struct peer_channel *create_channel(const struct node_id *nid)
+{
+	struct peer_channel *ch, *old;
+	sd_thread_t thread;
+	int fd;
+
+	fd = connect_to_peer(nid);
+	if (fd < 0)
+		return NULL;
+
+	ch = xzalloc(sizeof(*ch));
+	ch->nid = *nid;
+	ch->fd = fd;
+	INIT_RB_ROOT(&ch->inflight);
+	INIT_LIST_HEAD(&ch->send_queue);
+	sd_cond_init(&ch->send_cond);
+	sd_init_mutex(&ch->lock);
+	/* for the cache, the receiver, the sender and the caller */
+	refcount_set(&ch->refcnt, 4);
+
+	sd_write_lock(&channel_lock);
+	old = rb_insert(&channel_root, ch, rb, channel_cmp);
+	if (old)
+		refcount_inc(&old->refcnt);
+	sd_rw_unlock(&channel_lock);
+
+	if (old) {
+		/* Somebody else connected to the peer in the meantime */
+		free_channel(ch);
+		return old;
+	}
+
+	if (sd_thread_create("peer tx", &thread, channel_sender, ch) != 0) {
+		sd_err("failed to create a sender thread, %m");
+		put_channel(ch);
+		goto err;
+	}
+
+	if (sd_thread_create("peer rx", &thread, channel_receiver, ch) != 0) {
+		sd_err("failed to create a receiver thread, %m");
+		goto err;
+	}
+
+	sd_debug("%s", addr_to_str(nid->addr, nid->port));
+	return ch;
+err:
+	shutdown_channel(ch);
+	fail_inflight_requests(ch);
+	put_channel(ch);
+	put_channel(ch);
+	return NULL;
+}
+
+static struct peer_channel *get_channel(const struct node_id *nid)
+{
+	struct peer_channel key = { .nid = *nid }, *ch;
+
+	sd_read_lock(&channel_lock);
+	ch = rb_search(&channel_root, &key, rb, channel_cmp);
+	if (ch)
+		refcount_inc(&ch->refcnt);
+	sd_rw_unlock(&channel_lock);
+
+	if (ch)
+		return ch;
+
+	return create_channel(nid);
+}
+
+void peer_io_batch_init(struct peer_io_batch *batch, struct peer_io *ios)
+{
+	sd_init_mutex(&batch->lock);
+	sd_cond_init(&batch->cond);
+	batch->ios = ios;
+	batch->nr_ios = 0;
+	batch->nr_inflight = 0;
+	batch->nr_unsent = 0;
+	batch->nr_succeeded = 0;
+}
+
+/*
+ * Queue the request to the peer.  The request data is taken from io->buf if
+ * wlen is not zero.  The reply header is stored in io->rsp and the reply data
+ * in io->buf, and the completion is notified to the batch.  'io' must be the
+ * next one in the array of the batch.
+ *
+ * Return -1 if we fail to queue the request, in which case the request is
+ * completed with SD_RES_NETWORK_ERROR.
+ */
+int peer_io_submit(struct peer_io_batch *batch, struct peer_io *io,
+		   const struct node_id *nid, const struct sd_req *hdr,
+		   uint32_t wlen)
+{
+	struct peer_channel *ch;
+
+	io->batch = batch;
+	io->done = false;
+	io->hdr = *hdr;
+	io->wlen = wlen;
+	sd_mutex_lock(&batch->lock);
+	batch->nr_ios++;
+	batch->nr_inflight++;
+	batch->nr_unsent++;
+	sd_mutex_unlock(&batch->lock);
+
+	ch = get_channel(nid);
+	if (!ch)
+		goto err;
+	io->ch = ch;
+
+	sd_mutex_lock(&ch->lock);
+	if (ch->dead) {
+		sd_mutex_unlock(&ch->lock);
+		goto err;
+	}
+	io->id = io->hdr.id = ch->next_id++;
+	rb_insert(&ch->inflight, io, rb, peer_io_cmp);
+	list_add_tail(&io->send_list, &ch->send_queue);
+	sd_cond_signal(&ch->send_cond);
+	sd_mutex_unlock(&ch->lock);
+
+	return 0;
+err:
+	peer_io_sent(io);
+	peer_io_fail(io);
+	return -1;
+}
+
+static inline bool batch_completed(const struct peer_io_batch *batch,
+				   int quorum)
+{
+	if (batch->nr_unsent > 0)
+		return false;
+
+	return batch->nr_inflight == 0 || batch->nr_succeeded >= quorum;
+}
+
+/*
+ * Wait until all the requests of the batch are sent and 'quorum' requests
+ * succeed or all the requests finish.  Return the number of the requests which
+ * are still in flight.  If it is zero, the batch is released.  Otherwise, call
+ * this again later to wait for the rest.
+ *
+ * If the peers don't reply in time, their channels are torn down to fail the
+ * requests.  Even then, we have to wait for the receivers to finish with the
+ * request buffers.
+ */
+int peer_io_wait(struct peer_io_batch *batch, uint32_t epoch, int quorum)
+{
+	int repeat = MAX_RETRY_COUNT, nr_inflight;
+
+	sd_mutex_lock(&batch->lock);
+	while (!batch_completed(batch, quorum)) {
+		if (sd_cond_wait_timeout(&batch->cond, &batch->lock,
+					 POLL_TIMEOUT) != ETIMEDOUT)
+			continue;
+
+		/*
+		 * If IO NIC is down, epoch isn't incremented, so we can't retry
+		 * for ever.
+		 */
+		if (sheep_need_retry(epoch) && repeat) {
+			repeat--;
+			sd_warn("timeout %d, disks of some nodes or network is"
+				" busy. Going to wait again",
+				batch->nr_inflight);
+			continue;
+		}
+
+		sd_mutex_unlock(&batch->lock);
+		/*
+		 * XXX Blindly tear down the channels.  A request might have
+		 * just finished, but it doesn't hurt to reconnect.
+		 */
+		for (int i = 0; i < batch->nr_ios; i++)
+			if (!batch->ios[i].done && batch->ios[i].ch)
+				shutdown_channel(batch->ios[i].ch);
+		sd_mutex_lock(&batch->lock);
+
+		while (batch->nr_inflight > 0 || batch->nr_unsent > 0)
+			sd_cond_wait(&batch->cond, &batch->lock);
+	}
+	nr_inflight = batch->nr_inflight;
+	sd_mutex_unlock(&batch->lock);
+
+	if (nr_inflight > 0)
+		return nr_inflight;
+
+	for (int i = 0; i < batch->nr_ios; i++)
+		if (batch->ios[i].ch)
+			put_channel(batch->ios[i].ch);
+
+	sd_destroy_cond(&batch->cond);
+	sd_destroy_mutex(&batch->lock);
+
+	return 0;
+}
+
+/* Tear down the channel to the node, when the node leaves */
+void peer_channel_del_node(const struct node_id *nid)
+{
+	struct peer_channel key = { .nid = *nid }, *ch;
+
+	sd_read_lock(&channel_lock);
+	ch = rb_search(&channel_root, &key, rb, channel_cmp);
+	if (ch)
+		refcount_inc(&ch->refcnt);
+	sd_rw_unlock(&channel_lock);
+
+	if (!ch)
+		return;
+
+	shutdown_channel(ch);
+	put_channel(ch);
+}
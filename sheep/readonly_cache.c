@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2015 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read cache of the readonly objects
+ *
+ * The data objects of snapshots never change, so the gateway can keep them in
+ * memory and serve the reads of them without going to the disks or the peers.
+ * This helps when many VMs cloned from the same base image boot at once.
+ *
+ * The cache keeps whole objects and is split into shards to reduce the lock
+ * contention.  Each shard evicts the least recently used objects when it
+ * exceeds its share of the cache size.  The objects of a deleted VDI are
+ * dropped when the deletion is notified to this node.
+ */
+
+#include "sheep_priv.h"
+
+#define NR_RO_CACHE_SHARDS 64
+
+struct ro_cache_entry {
+	struct rb_node rb;
+	struct list_node lru;
+	uint64_t oid;
+	size_t size;
+	refcnt_t refcnt;
+	char *data;
+};
+
+struct ro_cache_shard {
+	struct sd_mutex lock;
+	struct rb_root root;
+	struct list_head lru_list;
+	uint64_t size;
+};
+
+static struct ro_cache_shard ro_cache_shards[NR_RO_CACHE_SHARDS];
+static uint64_t ro_cache_shard_size;
+
+static int ro_cache_cmp(const struct ro_cache_entry *a,
+			const struct ro_cache_entry *b)
+{
+	return intcmp(a->oid, b->oid);
+}
+
+static inline struct ro_cache_shard *oid_to_shard(uint64_t oid)
+{
+	return ro_cache_shards + sd_hash_oid(oid) % NR_RO_CACHE_SHARDS;
+}
+
+static void put_entry(struct ro_cache_entry *entry)
+{
+	if (refcount_dec(&entry->refcnt) > 0)
+		return;
+
+	free(entry->data);
+	free(entry);
+}
+
+/* Called with the shard lock held */
+static void del_entry(struct ro_cache_shard *shard,
+		      struct ro_cache_entry *entry)
+{
+	rb_erase(&entry->rb, &shard->root);
+	list_del(&entry->lru);
+	shard->size -= entry->size;
+	uatomic_sub(&sys->stat.c.cache_size, entry->size);
+	put_entry(entry);
+}
+
+void readonly_cache_init(uint64_t size)
+{
+	struct ro_cache_shard *shard;
+
+	for (int i = 0; i < NR_RO_CACHE_SHARDS; i++) {
+		shard = ro_cache_shards + i;
+		sd_init_mutex(&shard->lock);
+		INIT_RB_ROOT(&shard->root);
+		INIT_LIST_HEAD(&shard->lru_list);
+	}
+	ro_cache_shard_size = size / NR_RO_CACHE_SHARDS;
+	sys->readonly_cache = true;
+
+	sd_info("cache size %"PRIu64"MB", size / 1024 / 1024);
+}
+
+/*
+ * Copy the cached data of the object to 'buf'.  Return false if the object is
+ * not cached.
+ */
+bool readonly_cache_read(uint64_t oid, void *buf, uint32_t length,
+			 uint64_t offset)
+{
+	struct ro_cache_shard *shard = oid_to_shard(oid);
+	struct ro_cache_entry key = { .oid = oid }, *entry;
+
+	sd_mutex_lock(&shard->lock);
+	entry = rb_search(&shard->root, &key, rb, ro_cache_cmp);
+	if (entry) {
+		refcount_inc(&entry->refcnt);
+		list_move_tail(&entry->lru, &shard->lru_list);
+	}
+	sd_mutex_unlock(&shard->lock);
+
+	if (!entry || offset + length > entry->size) {
+		uatomic_inc(&sys->stat.c.miss_nr);
+		if (entry)
+			put_entry(entry);
+		return false;
+	}
+
+	memcpy(buf, entry->data + offset, length);
+	put_entry(entry);
+	uatomic_inc(&sys->stat.c.hit_nr);
+
+	return true;
+}
+
+/* The cache takes over 'data', which must be allocated with malloc */
+void readonly_cache_insert(uint64_t oid, void *data, size_t size)
+{
+	struct ro_cache_shard *shard = oid_to_shard(oid);
+	struct ro_cache_entry *entry, *old;
+
+	if (size > ro_cache_shard_size) {
+		free(data);
+		return;
+	}
+
+	entry = xzalloc(sizeof(*entry));
+	entry->oid = oid;
+	entry->size = size;
+	entry->data = data;
+	refcount_set(&entry->refcnt, 1);
+
+	sd_mutex_lock(&shard->lock);
+	old = rb_insert(&shard->root, entry, rb, ro_cache_cmp);
+	if (old) {
+		/* Somebody else read the same object in the meantime */
+		sd_mutex_unlock(&shard->lock);
+		put_entry(entry);
+		return;
+	}
+	list_add_tail(&entry->lru, &shard->lru_list);
+	shard->size += size;
+	uatomic_add(&sys->stat.c.cache_size, size);
+
+	while (shard->size > ro_cache_shard_size) {
+		old = list_first_entry(&shard->lru_list, struct ro_cache_entry,
+				       lru);
+		del_entry(shard, old);
+	}
+	sd_mutex_unlock(&shard->lock);
+}
+
+/* Drop the cached objects of the VDI */
+void readonly_cache_purge_vdi(uint32_t vid)
+{
+	struct ro_cache_shard *shard;
+	struct ro_cache_entry *entry;
+
+	if (!sys->readonly_cache)
+		return;
+
+	for (int i = 0; i < NR_RO_CACHE_SHARDS; i++) {
+		shard = ro_cache_shards + i;
+		sd_mutex_lock(&shard->lock);
+		list_for_each_entry(entry, &shard->lru_list, lru) {
+			if (oid_to_vid(entry->oid) == vid)
+				del_entry(shard, entry);
+		}
+		sd_mutex_unlock(&shard->lock);
+	}
+
+	sd_debug("%"PRIx32, vid);
+}
@@ -32,11 +32,15 @@ struct recovery_list_work {
 	uint64_t *oids;
 };
 
+/* The maximum number of the objects recovered in one work */
+#define RECOVERY_BATCH_SIZE 32
+
 /* for recovering objects */
 struct recovery_obj_work {
 	struct recovery_work base;
 
 	uint64_t oid; /* the object to be recovered */
+	uint64_t idx; /* index of oid in rinfo->oids */
 	bool stop;
 
 	/* local replica in the stale directory */
@@ -44,6 +48,13 @@ struct recovery_obj_work {
 	uint8_t local_sha1[SHA1_DIGEST_SIZE];
 
 	bool wildcard;
+
+	/*
+	 * The objects recovered in this work, rinfo->oids[idx, idx + nr_batch).
+	 * This is zero for the objects recovered on demand.
+	 */
+	int nr_batch;
+	uint64_t batch_oids[RECOVERY_BATCH_SIZE];
 };
 
 /*
@@ -66,8 +77,14 @@ struct recovery_info {
 	bool suspended;
 	bool notify_complete;
 
+	/*
+	 * The sorted list of the objects to be recovered.  oids[next, count)
+	 * are not queued yet, and oid_state[] tells whether the queued ones
+	 * are finished or not.
+	 */
 	uint64_t count;
 	uint64_t *oids;
+	uint8_t *oid_state;
 
 	struct vnode_info *old_vinfo;
 	struct vnode_info *cur_vinfo;
@@ -78,25 +95,43 @@ struct recovery_info {
 	uint32_t max_exec_count;
 	uint64_t queue_work_interval;
 	bool throttling;
+	uint64_t latency_slo;
+	/* the maximum number of the recovery works running at once */
+	uint64_t exec_limit;
+	uint64_t nr_running;
 
 	bool wildcard;
 
 	bool cancel;		/* for avoiding disk full by recovery */
 };
 
-struct recovery_timer {
-	void (*callback)(void *);
-	void *data;
-};
+/* Tick of the throttling with the latency target (msec) */
+#define RECOVERY_ADAPT_INTERVAL 100
+/* Default upper limit of the adaptive throttling per disk */
+#define RECOVERY_MAX_EXEC_PER_DISK 8
+
+#define OID_PENDING 0
+#define OID_RECOVERING 1
+#define OID_RECOVERED 2
 
 static struct recovery_info *next_rinfo;
 static main_thread(struct recovery_info *) current_rinfo;
 
+/* The timer which drives the throttled recovery, used only in main thread */
+static int recovery_timer_fd = -1;
+static unsigned int recovery_timer_interval;
+
+/* Latency of the foreground requests since the last tick, in main thread */
+static uint64_t fg_latency_total, fg_latency_nr;
+static size_t fg_queue_depth;
+
 static void queue_recovery_work(struct recovery_info *rinfo);
 static void free_recovery_obj_work(struct recovery_obj_work *row);
 
 /* Dynamically grown list buffer default as 4M (2T storage) */
 #define DEFAULT_LIST_BUFFER_SIZE (UINT64_C(1) << 22)
+/* Size of the chunks of GET_OBJ_LIST_RANGE */
+#define OBJ_LIST_CHUNK_SIZE (UINT64_C(1) << 20)
 static size_t list_buffer_size = DEFAULT_LIST_BUFFER_SIZE;
 
 static int obj_cmp(const uint64_t *oid1, const uint64_t *oid2)
@@ -209,7 +244,7 @@ again:
 		else
 			goto rollback;
 	}
-	node = oid_to_node(oid, &old->vroot, idx);
+	node = vinfo_oid_to_node(oid, old, idx);
 	sd_debug("%016"PRIx64" epoch %"PRIu32" tgt %"PRIu32" idx %d, %s",
 		 oid, epoch, tgt_epoch, idx, node_to_str(node));
 	if (invalid_node(node, rw->cur_vinfo))
@@ -250,6 +285,83 @@ done:
 	return buf;
 }
 
+/*
+ * Recover the data object from the local stale copy at row->local_epoch and
+ * the blocks modified since then on the node.
+ */
+static int recover_object_delta(struct recovery_obj_work *row,
+				const struct sd_node *node,
+				uint32_t tgt_epoch, bool wildcard)
+{
+	uint64_t oid = row->oid, map;
+	uint32_t epoch = row->base.epoch;
+	size_t objsize = get_store_objsize(oid),
+	       bs = objsize / OBJDIRTY_NR_BLOCKS;
+	struct sd_req hdr;
+	struct siocb iocb = { 0 };
+	char *buf, *obj = NULL, *p;
+	int ret, nr = 0;
+
+	buf = xvalloc(sizeof(map) + objsize);
+
+	sd_init_req(&hdr, SD_OP_READ_DELTA_PEER);
+	hdr.epoch = epoch;
+	hdr.flags = SD_FLAG_CMD_RECOVERY;
+	if (wildcard)
+		hdr.flags |= SD_FLAG_CMD_WILDCARD;
+	hdr.data_length = sizeof(map) + objsize;
+	hdr.obj.oid = oid;
+	hdr.obj.tgt_epoch = tgt_epoch;
+	hdr.obj.offset = row->local_epoch;
+
+	ret = sheep_exec_req(&node->nid, &hdr, buf);
+	if (ret != SD_RES_SUCCESS)
+		goto out;
+	memcpy(&map, buf, sizeof(map));
+
+	if (map == 0) {
+		sd_debug("use local replica at epoch %d", row->local_epoch);
+		ret = sd_store->link(oid, row->local_epoch);
+		goto out;
+	}
+
+	p = buf + sizeof(map);
+	if (map == ~UINT64_C(0)) {
+		/* The node doesn't know, it sent us the whole object */
+		obj = p;
+		nr = OBJDIRTY_NR_BLOCKS;
+	} else {
+		obj = xvalloc(objsize);
+		iocb.epoch = row->local_epoch;
+		iocb.buf = obj;
+		iocb.length = objsize;
+		ret = sd_store->read(oid, &iocb);
+		if (ret != SD_RES_SUCCESS)
+			goto out;
+
+		for (int i = 0; i < OBJDIRTY_NR_BLOCKS; i++) {
+			if (!(map & (UINT64_C(1) << i)))
+				continue;
+			memcpy(obj + i * bs, p, bs);
+			p += bs;
+			nr++;
+		}
+	}
+	sd_debug("%016"PRIx64", %d of %d blocks from %s", oid, nr,
+		 OBJDIRTY_NR_BLOCKS, node_to_str(node));
+
+	memset(&iocb, 0, sizeof(iocb));
+	iocb.epoch = epoch;
+	iocb.length = objsize;
+	iocb.buf = obj;
+	ret = sd_store->create_and_write(oid, &iocb);
+out:
+	if (obj != buf + sizeof(map))
+		free(obj);
+	free(buf);
+	return ret;
+}
+
 /*
  * Read object from targeted node and store it in the local node.
  *
@@ -271,6 +383,14 @@ static int recover_object_from(struct recovery_obj_work *row,
 	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
 	struct siocb iocb = { 0 };
 
+	/* fetch only the modified blocks if we have a stale copy */
+	if (local_epoch > 0 && !node_is_local(node) && is_data_obj(oid) &&
+	    !is_erasure_oid(oid)) {
+		ret = recover_object_delta(row, node, tgt_epoch, wildcard);
+		if (ret == SD_RES_SUCCESS)
+			return ret;
+	}
+
 	/* compare sha1 hash value first */
 	if (local_epoch > 0) {
 		sd_init_req(&hdr, SD_OP_GET_HASH);
@@ -339,7 +459,7 @@ static int recover_object_from_replica(struct recovery_obj_work *row,
 	for (int i = 0; i < nr_copies; i++) {
 		const struct sd_vnode *vnode;
 
-		vnode = oid_to_vnode(oid, &old->vroot, i);
+		vnode = vinfo_oid_to_vnode(oid, old, i);
 
 		if (vnode_is_local(vnode)) {
 			start = i;
@@ -352,7 +472,7 @@ static int recover_object_from_replica(struct recovery_obj_work *row,
 		const struct sd_node *node;
 		int idx = (i + start) % nr_copies;
 
-		node = oid_to_node(oid, &old->vroot, idx);
+		node = vinfo_oid_to_node(oid, old, idx);
 
 		if (invalid_node(node, row->base.cur_vinfo))
 			continue;
@@ -495,7 +615,7 @@ static void *rebuild_erasure_object(uint64_t oid, uint8_t idx,
 	uint32_t object_size = get_vdi_object_size(oid_to_vid(oid));
 	int ed = 0, edp;
 	edp = ec_policy_to_dp(policy, &ed, NULL);
-	struct fec *ctx = ec_init(ed, edp);
+	struct fec *ctx = ec_get(ed, edp);
 	uint8_t *bufs[ed];
 	int idxs[ed];
 
@@ -524,7 +644,6 @@ static void *rebuild_erasure_object(uint64_t oid, uint8_t idx,
 	/* Rebuild the lost replica */
 	ec_decode_buffer(ctx, bufs, idxs, lost, idx, object_size);
 out:
-	ec_destroy(ctx);
 	for (i = 0; i < ed; i++)
 		free(bufs[i]);
 	return lost;
@@ -538,7 +657,7 @@ uint8_t local_ec_index(struct vnode_info *vinfo, uint64_t oid)
 		return SD_MAX_COPIES;
 
 	for (idx = 0; idx < m; idx++) {
-		const struct sd_node *n = oid_to_node(oid, &vinfo->vroot, idx);
+		const struct sd_node *n = vinfo_oid_to_node(oid, vinfo, idx);
 		if (node_is_local(n))
 			return idx;
 	}
@@ -605,40 +724,198 @@ static int do_recover_object(struct recovery_obj_work *row)
 		return recover_replication_object(row);
 }
 
-static void recover_object_work(struct work *work)
+/* Find row->oid in the stale directory */
+static void find_stale_object(struct recovery_obj_work *row)
 {
-	struct recovery_work *rw = container_of(work, struct recovery_work,
-						work);
-	struct recovery_obj_work *row = container_of(rw,
-						     struct recovery_obj_work,
-						     base);
-	uint64_t oid = row->oid;
-	struct vnode_info *cur = rw->cur_vinfo;
 	int ret, epoch;
 
+	row->local_epoch = 0;
+	if (is_erasure_oid(row->oid))
+		return;
+
+	for (epoch = sys_epoch() - 1; epoch >= last_gathered_epoch; epoch--) {
+		ret = sd_store->get_hash(row->oid, epoch, row->local_sha1);
+		if (ret == SD_RES_SUCCESS) {
+			sd_debug("replica found in local at epoch %d", epoch);
+			row->local_epoch = epoch;
+			break;
+		}
+	}
+}
+
+static void recover_one_object(struct recovery_obj_work *row)
+{
+	uint64_t oid = row->oid;
+	struct vnode_info *cur = row->base.cur_vinfo;
+	int ret;
+
 	if (sd_store->exist(oid, local_ec_index(cur, oid))) {
 		sd_debug("the object is already recovered");
 		return;
 	}
 
-	/* find object in the stale directory */
-	if (!is_erasure_oid(oid))
-		for (epoch = sys_epoch() - 1; epoch >= last_gathered_epoch;
-		     epoch--) {
-			ret = sd_store->get_hash(oid, epoch, row->local_sha1);
-			if (ret == SD_RES_SUCCESS) {
-				sd_debug("replica found in local at epoch %d",
-					 epoch);
-				row->local_epoch = epoch;
-				break;
-			}
-		}
+	find_stale_object(row);
 
 	ret = do_recover_object(row);
 	if (ret != 0)
 		sd_err("failed to recover object %016"PRIx64, oid);
 }
 
+/*
+ * Return the node to read the replicated object from in a batch, or NULL if
+ * the object should be recovered by itself, e.g. from the local replica.
+ */
+static const struct sd_node *batch_source_node(uint64_t oid,
+					       struct vnode_info *old,
+					       struct vnode_info *cur)
+{
+	int nr_copies = get_obj_copy_number(oid, old->nr_zones);
+	const struct sd_node *n, *ret = NULL;
+
+	for (int i = 0; i < nr_copies; i++) {
+		n = vinfo_oid_to_node(oid, old, i);
+		if (node_is_local(n))
+			return NULL;
+		if (!ret && !invalid_node(n, cur))
+			ret = n;
+	}
+
+	return ret;
+}
+
+/* Store the objects in the reply of SD_OP_READ_BATCH_PEER */
+static void store_batch_objects(struct recovery_obj_work *row,
+				struct peer_io *io, bool *done)
+{
+	char *p = io->buf, *end = p + io->rsp.data_length;
+	struct obj_batch_entry ent;
+	struct siocb iocb = { };
+	int i;
+
+	while (p + sizeof(ent) <= end) {
+		memcpy(&ent, p, sizeof(ent));
+		p += sizeof(ent);
+		if (p + ent.length > end)
+			break;
+
+		for (i = 0; i < row->nr_batch; i++)
+			if (row->batch_oids[i] == ent.oid)
+				break;
+		if (i < row->nr_batch && ent.result == SD_RES_SUCCESS) {
+			iocb.epoch = row->base.epoch;
+			iocb.buf = p;
+			iocb.length = ent.length;
+			iocb.offset = ent.offset;
+			if (sd_store->create_and_write(ent.oid, &iocb) ==
+			    SD_RES_SUCCESS)
+				done[i] = true;
+		}
+		p += ent.length;
+	}
+}
+
+/*
+ * Recover the replicated objects of the work with SD_OP_READ_BATCH_PEER.
+ *
+ * The objects which we don't have in the stale directory are grouped by the
+ * node to read from, and the batches to the different nodes are in flight at
+ * once over the peer channels.  As the recovery works run in parallel,
+ * several batches are in flight to each node, too.  This saves the round
+ * trips for the small and sparse objects like inodes, ledgers and the data
+ * objects written partially.  The objects which are not recovered in the
+ * batches, e.g. the dense data objects which don't fit in the reply, go
+ * through the usual path one by one.
+ */
+static void recover_object_batch(struct recovery_obj_work *row)
+{
+	struct recovery_work *rw = &row->base;
+	const struct sd_node *src[RECOVERY_BATCH_SIZE];
+	bool done[RECOVERY_BATCH_SIZE] = {};
+	struct peer_io ios[RECOVERY_BATCH_SIZE], *io;
+	struct peer_io_batch batch;
+	struct sd_req hdr;
+	uint64_t oid, *oids;
+	int i, j, nr_ios = 0, nr;
+
+	for (i = 0; i < row->nr_batch; i++) {
+		oid = row->batch_oids[i];
+		src[i] = NULL;
+		if (sd_store->exist(oid, local_ec_index(rw->cur_vinfo, oid))) {
+			done[i] = true;
+			continue;
+		}
+
+		row->oid = oid;
+		find_stale_object(row);
+		if (row->local_epoch > 0)
+			continue;
+		src[i] = batch_source_node(oid, rw->old_vinfo, rw->cur_vinfo);
+	}
+
+	peer_io_batch_init(&batch, ios);
+	for (i = 0; i < row->nr_batch; i++) {
+		if (!src[i])
+			continue;
+
+		io = ios + nr_ios++;
+		io->buf = xvalloc(SD_READ_BATCH_MAX_LEN);
+		io->buf_len = SD_READ_BATCH_MAX_LEN;
+		oids = io->buf;
+		nr = 0;
+		for (j = i; j < row->nr_batch; j++) {
+			if (!src[j] || (j > i && node_cmp(src[j], src[i])))
+				continue;
+			oids[nr++] = row->batch_oids[j];
+			if (j > i)
+				src[j] = NULL;
+		}
+
+		sd_init_req(&hdr, SD_OP_READ_BATCH_PEER);
+		hdr.epoch = rw->epoch;
+		hdr.flags = SD_FLAG_CMD_RECOVERY | SD_FLAG_CMD_WRITE;
+		hdr.data_length = nr * sizeof(uint64_t);
+		/* for the epoch check of the peer */
+		hdr.obj.oid = oids[0];
+		hdr.obj.tgt_epoch = rw->tgt_epoch;
+		hdr.obj.offset = SD_READ_BATCH_MAX_LEN;
+		peer_io_submit(&batch, io, &src[i]->nid, &hdr,
+			       hdr.data_length);
+	}
+	peer_io_wait(&batch, rw->epoch, nr_ios);
+
+	for (i = 0; i < nr_ios; i++) {
+		io = ios + i;
+		if (io->rsp.result == SD_RES_SUCCESS)
+			store_batch_objects(row, io, done);
+		else if (io->rsp.result == SD_RES_OLD_NODE_VER)
+			/* move to the next epoch recovery */
+			row->stop = true;
+		free(io->buf);
+	}
+
+	for (i = 0; i < row->nr_batch && !row->stop; i++) {
+		if (done[i])
+			continue;
+		row->oid = row->batch_oids[i];
+		recover_one_object(row);
+	}
+	row->oid = row->batch_oids[0];
+}
+
+static void recover_object_work(struct work *work)
+{
+	struct recovery_work *rw = container_of(work, struct recovery_work,
+						work);
+	struct recovery_obj_work *row = container_of(rw,
+						     struct recovery_obj_work,
+						     base);
+
+	if (row->nr_batch > 1)
+		recover_object_batch(row);
+	else
+		recover_one_object(row);
+}
+
 bool node_in_recovery(void)
 {
 	return main_thread_get(current_rinfo) != NULL;
@@ -683,6 +960,7 @@ main_fn bool oid_in_recovery(uint64_t oid)
 {
 	struct recovery_info *rinfo = main_thread_get(current_rinfo);
 	struct vnode_info *cur;
+	uint64_t *p;
 
 	if (!node_in_recovery())
 		return false;
@@ -705,39 +983,36 @@ main_fn bool oid_in_recovery(uint64_t oid)
 		/* oid is not recovered yet */
 		break;
 	case RW_RECOVER_OBJ:
-		if (xlfind(&oid, rinfo->oids, rinfo->done, oid_cmp)) {
-			sd_debug("%016" PRIx64 " has been already recovered", oid);
+		p = xbsearch(&oid, rinfo->oids, rinfo->count, obj_cmp);
+		if (!p) {
+			/*
+			 * Newly created object after prepare_object_list()
+			 * might not be in the list
+			 */
+			sd_debug("%016"PRIx64" is not in the recovery list",
+				 oid);
 			return false;
 		}
 
-		if (xlfind(&oid, rinfo->oids + rinfo->done,
-			   rinfo->next - rinfo->done, oid_cmp)) {
+		switch (rinfo->oid_state[p - rinfo->oids]) {
+		case OID_RECOVERED:
+			sd_debug("%016" PRIx64 " has been already recovered",
+				 oid);
+			return false;
+		case OID_RECOVERING:
 			if (rinfo->suspended)
 				break;
 			/*
-			 * When recovery is not suspended,
-			 * rinfo->oids[rinfo->done .. rinfo->next) is currently
+			 * When recovery is not suspended, oid is currently
 			 * being recovered and no need to call
 			 * prepare_schedule_oid().
 			 */
 			return true;
-		}
-
-		/*
-		 * Check if oid is in the list that to be recovered later
-		 *
-		 * FIXME: do we need more efficient yet complex data structure?
-		 */
-		if (xlfind(&oid, rinfo->oids + rinfo->next,
-			   rinfo->count - rinfo->next + 1, oid_cmp))
+		case OID_PENDING:
+			/* oid is in the list that to be recovered later */
 			break;
-
-		/*
-		 * Newly created object after prepare_object_list() might not be
-		 * in the list
-		 */
-		sd_debug("%016"PRIx64" is not in the recovery list", oid);
-		return false;
+		}
+		break;
 	case RW_NOTIFY_COMPLETION:
 		sd_debug("the object %016" PRIx64 " is already recovered", oid);
 		return false;
@@ -774,6 +1049,7 @@ static void free_recovery_info(struct recovery_info *rinfo)
 	put_vnode_info(rinfo->cur_vinfo);
 	put_vnode_info(rinfo->old_vinfo);
 	free(rinfo->oids);
+	free(rinfo->oid_state);
 	for (int i = 0; i < rinfo->max_epoch; i++)
 		put_vnode_info(rinfo->vinfo_array[i]);
 	free(rinfo->vinfo_array);
@@ -840,10 +1116,21 @@ static void notify_recovery_completion_main(struct work *work)
 	free_recovery_work(rw);
 }
 
+static void stop_recovery_timer(void)
+{
+	if (recovery_timer_fd < 0)
+		return;
+
+	unregister_event(recovery_timer_fd);
+	close(recovery_timer_fd);
+	recovery_timer_fd = -1;
+}
+
 static inline void finish_recovery(struct recovery_info *rinfo)
 {
 	uint32_t recovered_epoch = rinfo->epoch;
 	main_thread_set(current_rinfo, NULL);
+	stop_recovery_timer();
 
 	wakeup_all_requests();
 
@@ -873,104 +1160,203 @@ static void recover_next_object(struct recovery_info *rinfo)
 	if (rinfo->next >= rinfo->count)
 		return;
 
-	/* Try recover next object */
+	/* Try recover next objects */
 	queue_recovery_work(rinfo);
-	rinfo->next++;
 }
 
-void resume_suspended_recovery(void)
+/*
+ * Queue the objects to be recovered until rinfo->exec_limit works are
+ * running.  This stops when the recovery is superseded or suspended.
+ */
+static void recover_next_objects(struct recovery_info *rinfo)
 {
-	struct recovery_info *rinfo = main_thread_get(current_rinfo);
+	uint64_t next;
 
-	if (rinfo && rinfo->suspended) {
-		rinfo->suspended = false;
+	while (rinfo->nr_running < rinfo->exec_limit) {
+		next = rinfo->next;
 		recover_next_object(rinfo);
+		if (main_thread_get(current_rinfo) != rinfo ||
+		    rinfo->next == next)
+			break;
 	}
 }
 
-static void recovery_timer_handler(int fd, int events, void *data)
+void resume_suspended_recovery(void)
 {
-	struct recovery_timer *t = data;
-	uint64_t val;
+	struct recovery_info *rinfo = main_thread_get(current_rinfo);
 
-	if (read(fd, &val, sizeof(val)) < 0)
-		return;
-	t->callback(t->data);
-	unregister_event(fd);
-	close(fd);
+	if (rinfo && rinfo->suspended) {
+		rinfo->suspended = false;
+		recover_next_objects(rinfo);
+	}
 }
 
-static void add_recovery_timer(struct recovery_timer *t, unsigned int mseconds)
+static void recovery_timer_handler(int fd, int events, void *data);
+
+/* Call recovery_timer_handler() every 'mseconds' until it is stopped */
+static void start_recovery_timer(unsigned int mseconds)
 {
 	struct itimerspec it;
-	int tfd;
 
-	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-	if (tfd < 0) {
-		sd_err("timerfd_create: %m");
+	if (recovery_timer_fd >= 0 && recovery_timer_interval == mseconds)
 		return;
+
+	if (recovery_timer_fd < 0) {
+		recovery_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						   TFD_NONBLOCK);
+		if (recovery_timer_fd < 0) {
+			sd_err("timerfd_create: %m");
+			return;
+		}
+		if (register_event(recovery_timer_fd, recovery_timer_handler,
+				   NULL) < 0) {
+			sd_err("failed to register timer fd");
+			close(recovery_timer_fd);
+			recovery_timer_fd = -1;
+			return;
+		}
 	}
 
 	memset(&it, 0, sizeof(it));
 	it.it_value.tv_sec = mseconds / 1000;
 	it.it_value.tv_nsec = (mseconds % 1000) * 1000000;
+	it.it_interval = it.it_value;
 
-	if (timerfd_settime(tfd, 0, &it, NULL) < 0) {
+	if (timerfd_settime(recovery_timer_fd, 0, &it, NULL) < 0) {
 		sd_err("timerfd_settime: %m");
+		stop_recovery_timer();
 		return;
 	}
+	recovery_timer_interval = mseconds;
+}
 
-	if (register_event(tfd, recovery_timer_handler, t) < 0)
-		sd_err("failed to register timer fd");
+/* Called in the main thread when a foreground request finishes */
+void recovery_account_request(uint64_t nsec)
+{
+	fg_latency_total += nsec;
+	fg_latency_nr++;
 }
 
-static void recover_next_object_delay(void *arg)
+static size_t foreground_queue_depth(void)
 {
-	struct recovery_info *rinfo = main_thread_get(current_rinfo);
-	uint32_t nr_threads = md_nr_disks() * 2;
-	double thread_unit_exec = 0;
-	double mod = 0;
+	return work_queue_length(sys->gateway_wqueue) +
+		work_queue_length(sys->io_wqueue);
+}
 
-	if (!rinfo)
-		return;
+static uint64_t max_exec_limit(struct recovery_info *rinfo)
+{
+	/* max= of the static throttling caps the adaptive one if it is set */
+	if (rinfo->max_exec_count)
+		return rinfo->max_exec_count;
 
-	thread_unit_exec = (double) rinfo->max_exec_count / nr_threads;
-	mod = rinfo->max_exec_count % nr_threads;
+	return md_nr_disks() * RECOVERY_MAX_EXEC_PER_DISK;
+}
 
-	if (rinfo->max_exec_count <= nr_threads || mod != 0) {
-		if (rand() % 100 + 1 <= (mod / nr_threads) * 100)
-			thread_unit_exec = ceil(thread_unit_exec);
-		else
-			thread_unit_exec = floor(thread_unit_exec);
-	}
+/*
+ * Apply the current throttling settings to the recovery.  There are three
+ * modes:
+ *
+ * - no throttling: md_nr_disks() * 2 works run at once
+ * - static throttling: max_exec_count objects at most are queued every
+ *   queue_work_interval msec, one object per work
+ * - adaptive throttling: the number of the works running at once is
+ *   adjusted to keep the foreground latency under latency_slo
+ */
+static void update_recovery_pace(struct recovery_info *rinfo, bool force)
+{
+	struct recovery_throttling *rt = &sys->rthrottling;
+	/*
+	 * Rationale for multi-threaded recovery:
+	 * 1. If one node is added, we find that all the VMs on other nodes will
+	 *    get noticeably affected until 50% data is transferred to the new
+	 *    node.
+	 * 2. For node failure, we might not have problems of running VM but the
+	 *    recovery process boost will benefit IO operation of VM with less
+	 *    chances to be blocked for write and also improve reliability.
+	 * 3. For disk failure in node, this is similar to adding a node. All
+	 *    the data on the broken disk will be recovered on other disks in
+	 *    this node. Speedy recovery not only improve data reliability but
+	 *    also cause less writing blocking on the lost data.
+	 *
+	 * We choose md_nr_disks() * 2 threads for recovery, no rationale.
+	 */
+	uint64_t nr_threads = md_nr_disks() * 2;
 
-	for (int i = 0; i < thread_unit_exec; i++) {
-		rinfo = main_thread_get(current_rinfo);
+	if (!force && rinfo->max_exec_count == rt->max_exec_count &&
+	    rinfo->queue_work_interval == rt->queue_work_interval &&
+	    rinfo->throttling == rt->throttling &&
+	    rinfo->latency_slo == rt->latency_slo)
+		return;
 
-		if (!rinfo)
-			return;
+	rinfo->max_exec_count = rt->max_exec_count;
+	rinfo->queue_work_interval = rt->queue_work_interval;
+	rinfo->throttling = rt->throttling;
+	rinfo->latency_slo = rt->latency_slo;
+
+	if (rinfo->latency_slo) {
+		rinfo->exec_limit = min(nr_threads, max_exec_limit(rinfo));
+		fg_latency_total = 0;
+		fg_latency_nr = 0;
+		fg_queue_depth = foreground_queue_depth();
+		start_recovery_timer(RECOVERY_ADAPT_INTERVAL);
+	} else if (rinfo->throttling) {
+		rinfo->exec_limit = rinfo->max_exec_count;
+		start_recovery_timer(rinfo->queue_work_interval);
+	} else {
+		rinfo->exec_limit = nr_threads;
+		stop_recovery_timer();
+	}
+}
 
-		if (rinfo->next - rinfo->done > rinfo->max_exec_count)
-			break;
+/*
+ * Additive increase and multiplicative decrease of the number of the recovery
+ * works running at once.  We halve it when the average latency of the foreground
+ * requests in the last tick exceeds the target, and add one when it is well
+ * under the target and the foreground queues are not growing.
+ */
+static void adjust_exec_limit(struct recovery_info *rinfo)
+{
+	uint64_t latency = 0, limit = rinfo->exec_limit;
+	size_t depth = foreground_queue_depth();
+
+	if (fg_latency_nr)
+		latency = fg_latency_total / fg_latency_nr / 1000;
+
+	if (latency > rinfo->latency_slo)
+		limit = max(limit / 2, (uint64_t)1);
+	else if (latency < rinfo->latency_slo * 3 / 4 &&
+		 depth <= fg_queue_depth && rinfo->nr_running >= limit)
+		limit++;
+	limit = min(limit, max_exec_limit(rinfo));
+
+	if (limit != rinfo->exec_limit)
+		sd_debug("latency %"PRIu64" us, queue depth %zu, limit %"
+			 PRIu64" -> %"PRIu64, latency, depth,
+			 rinfo->exec_limit, limit);
+
+	rinfo->exec_limit = limit;
+	fg_latency_total = 0;
+	fg_latency_nr = 0;
+	fg_queue_depth = depth;
+}
 
-		recover_next_object(rinfo);
-	}
+static void recovery_timer_handler(int fd, int events, void *data)
+{
+	struct recovery_info *rinfo = main_thread_get(current_rinfo);
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) < 0)
+		return;
 
-	if (rinfo->throttling != sys->rthrottling.throttling) {
-		rinfo->max_exec_count = sys->rthrottling.max_exec_count;
-		rinfo->queue_work_interval =
-				 sys->rthrottling.queue_work_interval;
-		rinfo->throttling = sys->rthrottling.throttling;
+	if (!rinfo || rinfo->state != RW_RECOVER_OBJ) {
+		stop_recovery_timer();
+		return;
 	}
 
-	if (rinfo->throttling) {
-		static struct recovery_timer rt = {
-			.callback = recover_next_object_delay,
-			.data = &rt,
-		};
-		add_recovery_timer(&rt, rinfo->queue_work_interval);
-	} else
-		recover_next_object(rinfo);
+	update_recovery_pace(rinfo, false);
+	if (rinfo->latency_slo)
+		adjust_exec_limit(rinfo);
+	recover_next_objects(rinfo);
 }
 
 static void recover_object_main(struct work *work)
@@ -981,42 +1367,35 @@ static void recover_object_main(struct work *work)
 						     struct recovery_obj_work,
 						     base);
 	struct recovery_info *rinfo = main_thread_get(current_rinfo);
+	uint64_t step = DIV_ROUND_UP(rinfo->count, 100);
 
-	/* ->oids[done, next] is out of order since finish order is random */
-	if (rinfo->oids[rinfo->done] != row->oid) {
-		uint64_t *p = xlfind(&row->oid, rinfo->oids + rinfo->done,
-				     rinfo->next - rinfo->done, oid_cmp);
-
-		*p = rinfo->oids[rinfo->done];
-		rinfo->oids[rinfo->done] = row->oid;
-	}
-	rinfo->done++;
+	for (int i = 0; i < row->nr_batch; i++)
+		rinfo->oid_state[row->idx + i] = OID_RECOVERED;
+	rinfo->done += row->nr_batch;
+	rinfo->nr_running--;
 
 	if (run_next_rw()) {
 		free_recovery_obj_work(row);
 		return;
 	}
 
-	wakeup_requests_on_oid(row->oid);
+	for (int i = 0; i < row->nr_batch; i++)
+		wakeup_requests_on_oid(row->batch_oids[i]);
 
-	if (!(rinfo->done % DIV_ROUND_UP(rinfo->count, 100)))
+	if (rinfo->done / step != (rinfo->done - row->nr_batch) / step)
 		sd_info("object recovery progress %3.0lf%% ",
 			(double)rinfo->done / rinfo->count * 100);
-	sd_debug("object %016"PRIx64" is recovered (%"PRIu64"/%"PRIu64")",
-		row->oid, rinfo->done, rinfo->count);
+	sd_debug("%d objects from %016"PRIx64" are recovered (%"PRIu64"/%"
+		 PRIu64")", row->nr_batch, row->oid, rinfo->done,
+		 rinfo->count);
 
 	if (rinfo->done >= rinfo->count)
 		goto finish_recovery;
 
-	if (!rinfo->throttling && !sys->rthrottling.throttling)
-		recover_next_object(rinfo);
-	else if (!rinfo->throttling && sys->rthrottling.throttling) {
-		static struct recovery_timer rt = {
-			.callback = recover_next_object_delay,
-			.data = &rt,
-		};
-		add_recovery_timer(&rt, sys->rthrottling.queue_work_interval);
-	}
+	update_recovery_pace(rinfo, false);
+	/* the static throttling queues the objects only at the ticks */
+	if (rinfo->latency_slo || !rinfo->throttling)
+		recover_next_objects(rinfo);
 
 	free_recovery_obj_work(row);
 	return;
@@ -1033,22 +1412,6 @@ static void finish_object_list(struct work *work)
 						      struct recovery_list_work,
 						      base);
 	struct recovery_info *rinfo = main_thread_get(current_rinfo);
-	/*
-	 * Rationale for multi-threaded recovery:
-	 * 1. If one node is added, we find that all the VMs on other nodes will
-	 *    get noticeably affected until 50% data is transferred to the new
-	 *    node.
-	 * 2. For node failure, we might not have problems of running VM but the
-	 *    recovery process boost will benefit IO operation of VM with less
-	 *    chances to be blocked for write and also improve reliability.
-	 * 3. For disk failure in node, this is similar to adding a node. All
-	 *    the data on the broken disk will be recovered on other disks in
-	 *    this node. Speedy recovery not only improve data reliability but
-	 *    also cause less writing blocking on the lost data.
-	 *
-	 * We choose md_nr_disks() * 2 threads for recovery, no rationale.
-	 */
-	uint32_t nr_threads = md_nr_disks() * 2;
 
 	if (rinfo->cancel) {
 		finish_recovery(rinfo);
@@ -1058,6 +1421,7 @@ static void finish_object_list(struct work *work)
 	rinfo->state = RW_RECOVER_OBJ;
 	rinfo->count = rlw->count;
 	rinfo->oids = rlw->oids;
+	rinfo->oid_state = xzalloc(rinfo->count ?: 1);
 	rlw->oids = NULL;
 	free_recovery_list_work(rlw);
 
@@ -1069,18 +1433,8 @@ static void finish_object_list(struct work *work)
 		return;
 	}
 
-	for (uint32_t i = 0; i < nr_threads; i++) {
-		if (rinfo->throttling) {
-			static struct recovery_timer rt = {
-				.callback = recover_next_object_delay,
-				.data = &rt,
-			};
-			add_recovery_timer(&rt, rinfo->queue_work_interval);
-		} else
-			recover_next_object(rinfo);
-	}
-
-	return;
+	update_recovery_pace(rinfo, true);
+	recover_next_objects(rinfo);
 }
 
 /* Fetch the object list from all the nodes in the cluster */
@@ -1122,6 +1476,86 @@ retry:
 	return buf;
 }
 
+/*
+ * Fetch the sorted list of the objects which the node has and are placed on
+ * this node at the epoch.  The list is streamed in chunks, so neither side
+ * needs a buffer for the whole object list of the node.
+ */
+static int fetch_local_object_list(struct sd_node *e, uint32_t epoch,
+				   uint64_t **oids, size_t *nr_oids)
+{
+	struct sd_req hdr;
+	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
+	size_t chunk = OBJ_LIST_CHUNK_SIZE / sizeof(uint64_t), nr = 0, n;
+	size_t buf_size = OBJ_LIST_CHUNK_SIZE;
+	uint64_t *buf = xmalloc(buf_size), start = 0;
+	int ret;
+
+	sd_debug("%s", addr_to_str(e->nid.addr, e->nid.port));
+
+	for (;;) {
+		if ((nr + chunk) * sizeof(uint64_t) > buf_size) {
+			buf_size *= 2;
+			buf = xrealloc(buf, buf_size);
+		}
+
+		sd_init_req(&hdr, SD_OP_GET_OBJ_LIST_RANGE);
+		hdr.data_length = chunk * sizeof(uint64_t);
+		hdr.epoch = epoch;
+		hdr.obj_list.start = start;
+		memcpy(hdr.obj_list.addr, sys->this_node.nid.addr,
+		       sizeof(hdr.obj_list.addr));
+		hdr.obj_list.port = sys->this_node.nid.port;
+		ret = sheep_exec_req(&e->nid, &hdr, buf + nr);
+		if (ret != SD_RES_SUCCESS) {
+			free(buf);
+			return ret;
+		}
+
+		n = rsp->data_length / sizeof(uint64_t);
+		nr += n;
+		if (n < chunk)
+			break;
+		start = buf[nr - 1] + 1;
+	}
+
+	sd_debug("%zu", nr);
+	*oids = buf;
+	*nr_oids = nr;
+	return SD_RES_SUCCESS;
+}
+
+/* Merge the sorted oids into the sorted list to be recovered */
+static void merge_object_list(struct recovery_list_work *rlw,
+			      const uint64_t *oids, size_t nr_oids)
+{
+	uint64_t *old = rlw->oids, *new;
+	uint64_t i = 0, j = 0, count = 0;
+
+	while (list_buffer_size < (rlw->count + nr_oids) * sizeof(uint64_t))
+		list_buffer_size *= 2;
+	new = xmalloc(list_buffer_size);
+
+	while (i < rlw->count && j < nr_oids) {
+		if (old[i] < oids[j])
+			new[count++] = old[i++];
+		else if (old[i] > oids[j])
+			new[count++] = oids[j++];
+		else {
+			new[count++] = old[i++];
+			j++;
+		}
+	}
+	while (i < rlw->count)
+		new[count++] = old[i++];
+	while (j < nr_oids)
+		new[count++] = oids[j++];
+
+	free(old);
+	rlw->oids = new;
+	rlw->count = count;
+}
+
 /* Screen out objects that don't belong to this node */
 static void screen_object_list(struct recovery_list_work *rlw,
 			       uint64_t *oids, size_t nr_oids)
@@ -1139,7 +1573,7 @@ static void screen_object_list(struct recovery_list_work *rlw,
 
 		nr_objs = get_obj_copy_number(oids[i], rw->cur_vinfo->nr_zones);
 
-		oid_to_vnodes(oids[i], &rw->cur_vinfo->vroot, nr_objs, vnodes);
+		vinfo_oid_to_vnodes(oids[i], rw->cur_vinfo, nr_objs, vnodes);
 		for (j = 0; j < nr_objs; j++) {
 			if (!vnode_is_local(vnodes[j]))
 				continue;
@@ -1217,7 +1651,7 @@ static bool check_diskfull_possibility(uint32_t epoch, struct vnode_info *vinfo,
 			}
 			rb_insert(&seen_objects, key, node, seen_object_cmp);
 
-			oid_to_vnodes(oids[j], &vinfo->vroot, nr_objs, vnodes);
+			vinfo_oid_to_vnodes(oids[j], vinfo, nr_objs, vnodes);
 
 			for (int k = 0; k < nr_objs; k++) {
 				int node_idx = vnode_to_node_idx(
@@ -1272,7 +1706,7 @@ static void prepare_object_list(struct work *work)
 						      struct recovery_list_work,
 						      base);
 	int nr_nodes = rw->cur_vinfo->nr_nodes;
-	int start = random() % nr_nodes, i, end = nr_nodes;
+	int start = random() % nr_nodes, i, end = nr_nodes, ret;
 	uint64_t *oids;
 	struct sd_node *nodes;
 
@@ -1306,6 +1740,22 @@ again:
 			goto out;
 		}
 
+		ret = fetch_local_object_list(node, rw->epoch, &oids,
+					      &nr_oids);
+		if (ret == SD_RES_SUCCESS) {
+			merge_object_list(rlw, oids, nr_oids);
+			free(oids);
+			continue;
+		}
+		if (ret != SD_RES_INVALID_PARMS) {
+			sd_alert("cannot get object list from %s",
+				 addr_to_str(node->nid.addr, node->nid.port));
+			sd_alert("some objects may be not recovered at epoch"
+				 " %d", rw->epoch);
+			continue;
+		}
+
+		/* The node doesn't support GET_OBJ_LIST_RANGE */
 		oids = fetch_object_list(node, rw->epoch, &nr_oids);
 		if (!oids)
 			continue;
@@ -1338,9 +1788,6 @@ int start_recovery(struct vnode_info *cur_vinfo, struct vnode_info *old_vinfo,
 	rinfo->max_epoch = sys->cinfo.epoch;
 	rinfo->vinfo_array = xzalloc(sizeof(struct vnode_info *) *
 				     rinfo->max_epoch);
-	rinfo->max_exec_count = sys->rthrottling.max_exec_count;
-	rinfo->queue_work_interval = sys->rthrottling.queue_work_interval;
-	rinfo->throttling = sys->rthrottling.throttling;
 	sd_init_mutex(&rinfo->vinfo_lock);
 	if (epoch_lifted)
 		rinfo->notify_complete = true; /* Reweight or node recovery */
@@ -1379,6 +1826,27 @@ int start_recovery(struct vnode_info *cur_vinfo, struct vnode_info *old_vinfo,
 	return 0;
 }
 
+/*
+ * Return the number of the objects recovered in the next work.  The adjacent
+ * replicated objects in the list are recovered together, see
+ * recover_object_batch().
+ */
+static int next_batch_size(struct recovery_info *rinfo)
+{
+	int nr = 1;
+
+	/* The static throttling counts the objects */
+	if (rinfo->wildcard || (rinfo->throttling && !rinfo->latency_slo) ||
+	    is_erasure_oid(rinfo->oids[rinfo->next]))
+		return 1;
+
+	while (nr < RECOVERY_BATCH_SIZE && rinfo->next + nr < rinfo->count &&
+	       !is_erasure_oid(rinfo->oids[rinfo->next + nr]))
+		nr++;
+
+	return nr;
+}
+
 static void queue_recovery_work(struct recovery_info *rinfo)
 {
 	struct recovery_work *rw;
@@ -1397,7 +1865,15 @@ static void queue_recovery_work(struct recovery_info *rinfo)
 	case RW_RECOVER_OBJ:
 		row = xzalloc(sizeof(*row));
 		row->oid = rinfo->oids[rinfo->next];
+		row->idx = rinfo->next;
 		row->wildcard = rinfo->wildcard;
+		row->nr_batch = next_batch_size(rinfo);
+		for (int i = 0; i < row->nr_batch; i++) {
+			row->batch_oids[i] = rinfo->oids[row->idx + i];
+			rinfo->oid_state[row->idx + i] = OID_RECOVERING;
+		}
+		rinfo->next += row->nr_batch;
+		rinfo->nr_running++;
 
 		rw = &row->base;
 		rw->work.fn = recover_object_work;
@@ -1449,6 +1925,7 @@ void set_recovery(struct recovery_throttling *rthrottling)
 		sys->rthrottling.throttling = true;
 	else
 		sys->rthrottling.throttling = false;
+	sys->rthrottling.latency_slo = rthrottling->latency_slo;
 }
 
 struct recovery_throttling get_recovery(void)
@@ -33,7 +33,7 @@ static bool is_access_local(struct request *req, uint64_t oid)
 	int i;
 
 	nr_copies = get_req_copy_number(req);
-	oid_to_vnodes(oid, &req->vinfo->vroot, nr_copies, obj_vnodes);
+	vinfo_oid_to_vnodes(oid, req->vinfo, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		if (vnode_is_local(obj_vnodes[i]))
 			return true;
@@ -290,7 +290,7 @@ static void queue_peer_request(struct request *req)
 
 	if (req->rq.opcode == SD_OP_REMOVE_PEER)
 		queue_work(sys->remove_peer_wqueue, &req->work);
-	else
+	else if (!uring_queue_request(req))
 		queue_work(sys->peer_wqueue, &req->work);
 }
 
@@ -362,6 +362,8 @@ static main_fn inline void stat_request_begin(struct request *req)
 	struct sd_req *hdr = &req->rq;
 
 	req->stat = true;
+	if (!req->start_time)
+		req->start_time = clock_get_time();
 
 	if (is_peer_op(req->op)) {
 		sys->stat.r.peer_total_nr++;
@@ -425,6 +427,19 @@ static main_fn inline void stat_request_end(struct request *req)
 		sys->stat.r.gway_active_nr--;
 }
 
+/* Feed the latency of the foreground requests to the recovery throttling */
+static main_fn inline void account_request_latency(struct request *req)
+{
+	struct sd_req *hdr = &req->rq;
+
+	if (!req->start_time)
+		return;
+
+	if (is_gateway_op(req->op) || hdr->opcode == SD_OP_FLUSH_VDI ||
+	    (is_peer_op(req->op) && !(hdr->flags & SD_FLAG_CMD_RECOVERY)))
+		recovery_account_request(clock_get_time() - req->start_time);
+}
+
 void queue_request(struct request *req)
 {
 	struct sd_req *hdr = &req->rq;
@@ -661,7 +676,9 @@ struct request *alloc_request(struct client_info *ci, uint32_t data_length)
 
 	if (data_length) {
 		req->data_length = data_length;
-		req->data = valloc(data_length);
+		req->data = uring_alloc_buf(data_length);
+		if (!req->data)
+			req->data = valloc(data_length);
 		if (!req->data) {
 			free(req);
 			return NULL;
@@ -684,7 +701,10 @@ void free_request(struct request *req)
 
 	refcount_dec(&req->ci->refcnt);
 	put_vnode_info(req->vinfo);
-	free(req->data);
+	if (req->ofd)
+		objfd_cache_put(req->ofd);
+	if (!uring_free_buf(req->data))
+		free(req->data);
 	free(req);
 }
 
@@ -696,6 +716,7 @@ main_fn void put_request(struct request *req)
 		return;
 
 	stat_request_end(req);
+	account_request_latency(req);
 
 	if (req->local)
 		eventfd_xwrite(req->local_req_efd, 1);
@@ -749,6 +770,16 @@ main_fn void get_request(struct request *req)
 	refcount_inc(&req->refcnt);
 }
 
+/*
+ * Peer reads are served from the object file directly if zero copy is enabled,
+ * so we don't need the buffer for them in most cases.
+ */
+static inline bool need_rx_buffer(const struct sd_req *hdr)
+{
+	return !sys->zero_copy || hdr->opcode != SD_OP_READ_PEER ||
+		(hdr->flags & SD_FLAG_CMD_WRITE);
+}
+
 static void rx_work(struct work *work)
 {
 	struct client_info *ci = container_of(work, struct client_info,
@@ -765,7 +796,7 @@ static void rx_work(struct work *work)
 		return;
 	}
 
-	req = alloc_request(ci, hdr.data_length);
+	req = alloc_request(ci, need_rx_buffer(&hdr) ? hdr.data_length : 0);
 	if (!req) {
 		sd_err("failed to allocate request");
 		conn->dead = true;
@@ -845,11 +876,20 @@ static void tx_work(struct work *work)
 	rsp.opcode = req->rq.opcode;
 	rsp.id = req->rq.id;
 
-	if (rsp.data_length)
-		data = req->data;
+	if (req->ofd) {
+		ret = send_req(conn->fd, (struct sd_req *)&rsp, NULL, 0,
+			       NULL, 0, UINT32_MAX);
+		if (ret == 0 && rsp.data_length)
+			ret = send_file(conn->fd, req->ofd->fd,
+					req->rq.obj.offset, rsp.data_length,
+					NULL, 0, UINT32_MAX);
+	} else {
+		if (rsp.data_length)
+			data = req->data;
 
-	ret = send_req(conn->fd, (struct sd_req *)&rsp, data, rsp.data_length,
-		       NULL, 0, UINT32_MAX);
+		ret = send_req(conn->fd, (struct sd_req *)&rsp, data,
+			       rsp.data_length, NULL, 0, UINT32_MAX);
+	}
 	if (ret != 0) {
 		sd_err("failed to send a request");
 		conn->dead = true;
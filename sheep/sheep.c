@@ -39,6 +39,18 @@ static const char ioaddr_help[] =
 "This tries to add a dedicated IO NIC of 192.168.1.1:7002 to transfer data.\n"
 "If IO NIC is down, sheep will fallback to non IO NIC to transfer data.\n";
 
+#ifdef HAVE_IO_URING
+static const char io_uring_help[] =
+"Available arguments:\n"
+"\tdepth=: number of entries of the submission queue (default: 256)\n"
+"\tbufs=: number of registered IO buffers (default: 64)\n"
+"\tbufsize=: size of each registered IO buffer (default: 1M)\n"
+"\tdefault: use the default values for all the arguments\n"
+"\nExample:\n\t$ sheep -I depth=512,bufs=128,bufsize=4M ...\n"
+"This tries to serve object reads and writes of peers with io_uring, using\n"
+"128 registered buffers of 4MB\n";
+#endif
+
 static const char journal_help[] =
 "Available arguments:\n"
 "\tsize=: size of the journal in megabyes\n"
@@ -117,7 +129,25 @@ static const char recovery_help[] =
 "Available arguments:\n"
 "\tmax=: object recovery process maximum count of each interval\n"
 "\tinterval=: object recovery interval time (millisec)\n"
-"Example:\n\t$ sheep -R max=50,interval=1000 ...\n";
+"\tslo=: foreground request latency target (microsec)\n"
+"Example:\n\t$ sheep -R max=50,interval=1000 ...\n"
+"\t$ sheep -R slo=10000 ...\n"
+"With slo=, the number of the objects recovered at once is adjusted\n"
+"automatically to keep the average latency of the foreground requests under\n"
+"the target.  max= caps it if it is given.\n";
+
+static const char readonly_cache_help[] =
+"Available arguments:\n"
+"\tsize=: size of the memory to cache the objects of snapshots\n"
+"Example:\n\t$ sheep -C size=4G ...\n"
+"This tries to cache the objects of snapshots read through this gateway in\n"
+"4GB of memory.\n";
+
+static const char write_quorum_help[] =
+"Example:\n\t$ sheep -q 2 ...\n"
+"This tries to reply to the writes of 3 copies objects after 2 replicas are\n"
+"written.  The rest is written in the background, and the later requests to\n"
+"the same object through this gateway wait for it.\n";
 
 static const char vnodes_help[] =
 "Example:\n\t$ sheep -V 128\n"
@@ -129,12 +159,18 @@ static struct sd_option sheep_options[] = {
 	{'c', "cluster", true,
 	 "specify the cluster driver (default: "DEFAULT_CLUSTER_DRIVER")",
 	 cluster_help},
+	{'C', "readcache", true, "cache the objects of snapshots in memory"
+	 " (default: disabled)", readonly_cache_help},
 	{'D', "directio", false, "use direct IO for backend store"},
 	{'f', "foreground", false, "make the program run in foreground"},
 	{'g', "gateway", false, "make the program run as a gateway mode"},
 	{'h', "help", false, "display this help and exit"},
 	{'i', "ioaddr", true, "use separate network card to handle IO requests"
 	 " (default: disabled)", ioaddr_help},
+#ifdef HAVE_IO_URING
+	{'I', "io_uring", true, "use io_uring for backend store IO"
+	 " (default: disabled)", io_uring_help},
+#endif
 	{'j', "journal", true, "use journal file to log all the write "
 	 "operations. (default: disabled)", journal_help},
 	{'l', "log", true,
@@ -148,6 +184,9 @@ static struct sd_option sheep_options[] = {
 	{'r', "http", true, "enable http service. (default: disabled)",
 	 http_help},
 #endif
+	{'q', "write-quorum", true, "reply to the replicated writes after "
+	 "the given number of replicas are written (default: all)",
+	 write_quorum_help},
 	{'R', "recovery", true, "specify the recovery speed throttling",
 	 recovery_help},
 	{'u', "upgrade", false, "upgrade to the latest data layout"},
@@ -162,6 +201,8 @@ static struct sd_option sheep_options[] = {
 	{'z', "zone", true,
 	 "specify the zone id (default: determined by listen address)",
 	 zone_help},
+	{'Z', "zerocopy", false, "send object data to peers without copying"
+	 " it to the user space"},
 	{ 0, NULL, false, NULL },
 };
 
@@ -418,6 +459,14 @@ static int wq_async_parser(const char *s)
 	return 0;
 }
 
+/* Use the lock-free work queues for the request path */
+static bool wq_lockfree;
+static int wq_lockfree_parser(const char *s)
+{
+	wq_lockfree = true;
+	return 0;
+}
+
 static struct option_parser wq_parsers[] = {
 	{ "net=", wq_net_parser },
 	{ "gway=", wq_gway_parser },
@@ -429,6 +478,8 @@ static struct option_parser wq_parsers[] = {
 	{ "remove_peer=", wq_remove_peer_parser },
 	{ "recovery=", wq_recovery_parser },
 	{ "async=", wq_async_parser },
+	{ "lockfree", wq_lockfree_parser },
+	{ NULL, NULL },
 };
 
 static const char *io_addr, *io_pt;
@@ -462,6 +513,50 @@ static struct option_parser ionic_parsers[] = {
 	{ NULL, NULL },
 };
 
+#ifdef HAVE_IO_URING
+static bool use_io_uring;
+static uint32_t uring_depth, uring_nr_bufs, uring_buf_size;
+
+static int uring_depth_parser(const char *s)
+{
+	uring_depth = strtol(s, NULL, 10);
+	return 0;
+}
+
+static int uring_nr_bufs_parser(const char *s)
+{
+	uring_nr_bufs = strtol(s, NULL, 10);
+	return 0;
+}
+
+static int uring_buf_size_parser(const char *s)
+{
+	uint64_t size;
+
+	if (option_parse_size(s, &size) < 0)
+		return -1;
+	if (size > UINT32_MAX) {
+		sd_err("invalid buffer size %s", s);
+		return -1;
+	}
+	uring_buf_size = size;
+	return 0;
+}
+
+static int uring_default_parser(const char *s)
+{
+	return 0;
+}
+
+static struct option_parser io_uring_parsers[] = {
+	{ "depth=", uring_depth_parser },
+	{ "bufs=", uring_nr_bufs_parser },
+	{ "bufsize=", uring_buf_size_parser },
+	{ "default", uring_default_parser },
+	{ NULL, NULL },
+};
+#endif
+
 static char jpath[PATH_MAX];
 static bool jskip;
 static uint64_t jsize;
@@ -498,8 +593,27 @@ static struct option_parser journal_parsers[] = {
 	{ NULL, NULL },
 };
 
+static uint64_t readonly_cache_size;
+
+static int readonly_cache_size_parser(const char *s)
+{
+	if (option_parse_size(s, &readonly_cache_size) < 0)
+		return -1;
+	if (!readonly_cache_size) {
+		sd_err("invalid size %s", s);
+		return -1;
+	}
+	return 0;
+}
+
+static struct option_parser readonly_cache_parsers[] = {
+	{ "size=", readonly_cache_size_parser },
+	{ NULL, NULL },
+};
+
 static uint32_t max_exec_count;
 static uint64_t queue_work_interval;
+static uint64_t latency_slo;
 static int max_exec_count_parser(const char *s)
 {
 	max_exec_count = strtol(s, NULL, 10);
@@ -512,9 +626,16 @@ static int queue_work_interval_parser(const char *s)
 	return 0;
 }
 
+static int latency_slo_parser(const char *s)
+{
+	latency_slo = strtoull(s, NULL, 10);
+	return 0;
+}
+
 static struct option_parser recovery_parsers[] = {
 	{ "max=", max_exec_count_parser },
 	{ "interval=", queue_work_interval_parser },
+	{ "slo=", latency_slo_parser },
 	{ NULL, NULL },
 };
 
@@ -545,21 +666,32 @@ static int create_work_queues(void)
 		sd_info("net workqueue is created as dynamic");
 		sys->net_wqueue = create_work_queue("net", WQ_DYNAMIC);
 	}
-	if (wq_gway_threads) {
+	if (wq_lockfree) {
+		sd_info("gway workqueue is created as lock-free");
+		sys->gateway_wqueue = create_lockfree_work_queue("gway",
+							wq_gway_threads);
+	} else if (wq_gway_threads) {
 		sd_info("# of threads in gway workqueue: %d", wq_gway_threads);
 		sys->gateway_wqueue = create_fixed_work_queue("gway", wq_gway_threads);
 	} else {
 		sd_info("gway workqueue is created as dynamic");
 		sys->gateway_wqueue = create_work_queue("gway", WQ_DYNAMIC);
 	}
-	if (wq_io_threads) {
+	if (wq_lockfree) {
+		sd_info("io workqueue is created as lock-free");
+		sys->io_wqueue = create_lockfree_work_queue("io", wq_io_threads);
+	} else if (wq_io_threads) {
 		sd_info("# of threads in io workqueue: %d", wq_io_threads);
 		sys->io_wqueue = create_fixed_work_queue("io", wq_io_threads);
 	} else {
 		sd_info("io workqueue is created as dynamic");
 		sys->io_wqueue = create_work_queue("io", WQ_DYNAMIC);
 	}
-	if (wq_peer_threads) {
+	if (wq_lockfree) {
+		sd_info("peer workqueue is created as lock-free");
+		sys->peer_wqueue = create_lockfree_work_queue("peer",
+							      wq_peer_threads);
+	} else if (wq_peer_threads) {
 		sd_info("# of threads in peer workqueue: %d", wq_peer_threads);
 		sys->peer_wqueue = create_fixed_work_queue("peer", wq_peer_threads);
 	} else {
@@ -611,6 +743,12 @@ static int create_work_queues(void)
 		sd_info("async_req workqueue is created as dynamic");
 		sys->areq_wqueue = create_work_queue("async_req", WQ_DYNAMIC);
 	}
+	if (sys->write_quorum) {
+		sys->straggler_wqueue = create_work_queue("straggler",
+							  WQ_DYNAMIC);
+		if (!sys->straggler_wqueue)
+			return -1;
+	}
 	if (!sys->gateway_wqueue || !sys->io_wqueue || !sys->recovery_wqueue ||
 	    !sys->deletion_wqueue || !sys->block_wqueue || !sys->md_wqueue ||
 	    !sys->areq_wqueue || !sys->peer_wqueue || !sys->reclaim_wqueue ||
@@ -797,6 +935,7 @@ int main(int argc, char **argv)
 	sys->rthrottling.max_exec_count = 0;
 	sys->rthrottling.queue_work_interval = 0;
 	sys->rthrottling.throttling = false;
+	sys->rthrottling.latency_slo = 0;
 
 	install_crash_handler(crash_handler);
 	signal(SIGPIPE, SIG_IGN);
@@ -840,6 +979,27 @@ int main(int argc, char **argv)
 		case 'D':
 			sys->backend_dio = true;
 			break;
+		case 'Z':
+			sys->zero_copy = true;
+			break;
+		case 'q':
+			sys->write_quorum = str_to_u16(optarg);
+			if (errno != 0 || sys->write_quorum < 1 ||
+			    sys->write_quorum > SD_MAX_COPIES) {
+				sd_err("Invalid write quorum '%s': must be "
+				       "an integer between 1 and %u", optarg,
+				       SD_MAX_COPIES);
+				exit(1);
+			}
+			break;
+		case 'C':
+			if (option_parse(optarg, ",", readonly_cache_parsers) < 0)
+				exit(1);
+			if (!readonly_cache_size) {
+				sd_err("you must specify size for read cache");
+				exit(1);
+			}
+			break;
 		case 'f':
 			daemonize = false;
 			break;
@@ -906,6 +1066,13 @@ int main(int argc, char **argv)
 			}
 #endif
 			break;
+#ifdef HAVE_IO_URING
+		case 'I':
+			use_io_uring = true;
+			if (option_parse(optarg, ",", io_uring_parsers) < 0)
+				exit(1);
+			break;
+#endif
 		case 'j':
 			uatomic_set_true(&sys->use_journal);
 			if (option_parse(optarg, ",", journal_parsers) < 0)
@@ -931,6 +1098,7 @@ int main(int argc, char **argv)
 						 = queue_work_interval;
 			if (max_exec_count > 0 && queue_work_interval > 0)
 				sys->rthrottling.throttling = true;
+			sys->rthrottling.latency_slo = latency_slo;
 			break;
 		case 'v':
 			fprintf(stdout, "Sheepdog daemon version %s\n",
@@ -974,6 +1142,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* sendfile() reads through the page cache which '-D' bypasses */
+	if (sys->zero_copy && sys->backend_dio) {
+		sd_err("Options '-D' and '-Z' can not be both specified");
+		exit(1);
+	}
+
 	#ifdef HAVE_DISKVNODES
 	sys->cinfo.flags |= SD_CLUSTER_FLAG_DISKMODE;
 	#endif
@@ -1149,6 +1323,12 @@ int main(int argc, char **argv)
 
 	init_fec();
 
+	if (readonly_cache_size)
+		readonly_cache_init(readonly_cache_size);
+
+	if (!sys->gateway_only)
+		objdirty_init();
+
 	/*
 	 * After this function, we are multi-threaded.
 	 *
@@ -1172,6 +1352,12 @@ int main(int argc, char **argv)
 	if (ret)
 		goto cleanup_journal;
 
+#ifdef HAVE_IO_URING
+	if (use_io_uring && !sys->gateway_only &&
+	    uring_init(uring_depth, uring_nr_bufs, uring_buf_size) != 0)
+		goto cleanup_journal;
+#endif
+
 	#ifdef HAVE_HTTP
 	if (http_options && http_init(http_options) != 0)
 		goto cleanup_journal;
@@ -1203,6 +1389,7 @@ int main(int argc, char **argv)
 
 	rc = 0;
 	sd_info("shutdown");
+	objindex_save();
 
 cleanup_pid_file:
 	if (pid_file)
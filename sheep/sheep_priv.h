@@ -117,6 +117,7 @@ struct request {
 
 	void *data;
 	unsigned int data_length;
+	struct objfd *ofd; /* data is sent from this file if set */
 
 	struct client_info *ci;
 	struct list_node request_list;
@@ -133,6 +134,7 @@ struct request {
 	struct work work;
 	enum REQUST_STATUS status;
 	bool stat; /* true if this request is during stat */
+	uint64_t start_time; /* nsec, when this request was queued first */
 };
 
 struct system_info {
@@ -176,12 +178,17 @@ struct system_info {
 	struct work_queue *block_wqueue;
 	struct work_queue *md_wqueue;
 	struct work_queue *areq_wqueue;
+	struct work_queue *straggler_wqueue;
 #ifdef HAVE_HTTP
 	struct work_queue *http_wqueue;
 #endif
 
 	uatomic_bool use_journal;
 	bool backend_dio;
+	bool zero_copy;
+	bool readonly_cache;
+	/* number of the replicas to be written before replying, 0 for all */
+	int write_quorum;
 	/* upgrade data layout before starting service if necessary*/
 	bool upgrade;
 	struct sd_stat stat;
@@ -264,6 +271,8 @@ struct store_driver {
 	int (*purge_obj)(void);
 	/* Operations for snapshot */
 	int (*cleanup)(void);
+	/* Optional, used by the asynchronous backend to locate objects */
+	int (*get_path)(uint64_t oid, uint8_t ec_index, char *path);
 };
 
 /* backend store */
@@ -304,6 +313,8 @@ int for_each_object_in_stale(int (*func)(uint64_t oid, const char *path,
 					 struct vnode_info *, void *arg),
 			     void *arg);
 int for_each_obj_path(int (*func)(const char *path));
+int objindex_load(void);
+void objindex_save(void);
 size_t get_store_objsize(uint64_t oid);
 
 extern struct list_head store_drivers;
@@ -430,6 +441,24 @@ int leave_cluster(void);
 
 void queue_cluster_request(struct request *req);
 
+struct objfd {
+	struct rb_node rb;
+	struct list_node lru;
+	uint64_t oid;
+	uint8_t ec_index;
+	int flags;
+	int fd;
+	refcnt_t refcnt;
+};
+
+struct objfd *objfd_cache_lookup(uint64_t oid, uint8_t ec_index, int flags);
+struct objfd *objfd_cache_open(uint64_t oid, uint8_t ec_index,
+			       const char *path, int flags);
+struct objfd *objfd_cache_get(uint64_t oid, uint8_t ec_index, int flags);
+void objfd_cache_put(struct objfd *ofd);
+void objfd_cache_remove(uint64_t oid, uint8_t ec_index);
+void objfd_cache_purge(void);
+
 int prepare_iocb(uint64_t oid, const struct siocb *iocb, bool create);
 int err_to_sderr(const char *path, uint64_t oid, int err);
 int discard(int fd, uint64_t start, uint32_t end);
@@ -461,6 +490,8 @@ void init_config_path(const char *base_path);
 int init_node_config_file(void);
 int init_config_file(void);
 int get_obj_list(const struct sd_req *, struct sd_rsp *, void *);
+int get_obj_list_range(const struct sd_req *, struct sd_rsp *, void *,
+		       struct vnode_info *);
 int objlist_cache_cleanup(uint32_t vid);
 void objlist_cache_format(void);
 
@@ -471,6 +502,7 @@ bool node_in_recovery(void);
 void get_recovery_state(struct recovery_state *state);
 void set_recovery(struct recovery_throttling *rthrottling);
 struct recovery_throttling get_recovery(void);
+void recovery_account_request(uint64_t nsec);
 
 int sd_write_object(uint64_t oid, char *data, unsigned int datalen,
 		    uint64_t offset, bool create);
@@ -494,6 +526,18 @@ void local_request_init(void);
 int objlist_cache_insert(uint64_t oid);
 void objlist_cache_remove(uint64_t oid);
 
+void readonly_cache_init(uint64_t size);
+bool readonly_cache_read(uint64_t oid, void *buf, uint32_t length,
+			 uint64_t offset);
+void readonly_cache_insert(uint64_t oid, void *data, size_t size);
+void readonly_cache_purge_vdi(uint32_t vid);
+
+/* object_dirty.c */
+#define OBJDIRTY_NR_BLOCKS 64
+void objdirty_init(void);
+void objdirty_mark(uint64_t oid, uint64_t offset, uint64_t length);
+bool objdirty_get(uint64_t oid, uint32_t since, uint64_t *map);
+
 void put_request(struct request *req);
 void get_request(struct request *req);
 void requeue_request(struct request *req);
@@ -578,12 +622,69 @@ void sheep_del_sockfd(const struct node_id *, struct sockfd *);
 int sheep_exec_req(const struct node_id *nid, struct sd_req *hdr, void *data);
 bool sheep_need_retry(uint32_t epoch);
 
+/* peer_channel.c */
+struct peer_io_batch {
+	struct sd_mutex lock;
+	struct sd_cond cond;
+	struct peer_io *ios;
+	int nr_ios;
+	int nr_inflight;
+	int nr_unsent;
+	int nr_succeeded;
+};
+
+struct peer_io {
+	struct rb_node rb;
+	struct list_node send_list;
+	uint32_t id;
+	struct peer_channel *ch;
+	struct peer_io_batch *batch;
+	bool done;
+
+	struct sd_req hdr;
+	uint32_t wlen;
+	void *buf;
+	uint32_t buf_len;
+	struct sd_rsp rsp;
+};
+
+void peer_io_batch_init(struct peer_io_batch *batch, struct peer_io *ios);
+int peer_io_submit(struct peer_io_batch *batch, struct peer_io *io,
+		   const struct node_id *nid, const struct sd_req *hdr,
+		   uint32_t wlen);
+int peer_io_wait(struct peer_io_batch *batch, uint32_t epoch, int quorum);
+void peer_channel_del_node(const struct node_id *nid);
+
 /* journal_file.c */
 int journal_file_init(const char *path, size_t size, bool skip);
 void clean_journal_file(const char *p);
 int
-journal_write_store(uint64_t oid, const char *buf, size_t size, off_t, bool);
-int journal_remove_object(uint64_t oid);
+journal_write_store(uint64_t oid, uint8_t ec_index, const char *buf,
+		    size_t size, off_t, bool);
+int journal_remove_object(uint64_t oid, uint8_t ec_index);
+
+/* uring.c */
+#ifdef HAVE_IO_URING
+int uring_init(uint32_t depth, uint32_t nr_bufs, uint32_t buf_size);
+bool uring_queue_request(struct request *req);
+void *uring_alloc_buf(uint32_t len);
+bool uring_free_buf(void *buf);
+#else
+static inline bool uring_queue_request(struct request *req)
+{
+	return false;
+}
+
+static inline void *uring_alloc_buf(uint32_t len)
+{
+	return NULL;
+}
+
+static inline bool uring_free_buf(void *buf)
+{
+	return false;
+}
+#endif
 
 /* md.c */
 bool md_add_disk(const char *path, bool);
@@ -47,6 +47,223 @@ int prepare_iocb(uint64_t oid, const struct siocb *iocb, bool create)
 	return flags;
 }
 
+/*
+ * Cache of open file descriptors of the objects
+ *
+ * Guest IOs are usually small and hit the same objects again and again, so
+ * opening and closing the object file on every request (plus the access()
+ * in md_exist()) dominates the cost of the backend IO.  Object fds are cached
+ * in LRU order, keyed by (oid, ec_index, open flags) because O_DIRECT and
+ * O_DSYNC cannot be changed on an open file.
+ *
+ * The cache must be invalidated whenever the object file at the store path
+ * is replaced or goes away: removal, rename to the stale directory, atomic
+ * creation over an existing object and disk plug/unplug.  Call
+ * objfd_cache_remove() after the file is changed, and the fds opened before
+ * that, which may be of the old file, are not added to the cache.
+ */
+#define OBJFD_CACHE_SHARDS	64
+#define OBJFD_CACHE_SHARD_SIZE	64
+
+struct objfd_cache_shard {
+	struct sd_mutex lock;
+	struct rb_root root;
+	struct list_head lru;
+	int nr;
+	/* bumped when the fds are dropped, not to cache the fds opened before */
+	uint64_t gen;
+};
+
+static struct objfd_cache_shard objfd_cache[OBJFD_CACHE_SHARDS];
+
+static int objfd_cmp(const struct objfd *a, const struct objfd *b)
+{
+	int ret;
+
+	ret = intcmp(a->oid, b->oid);
+	if (ret)
+		return ret;
+	ret = intcmp(a->ec_index, b->ec_index);
+	if (ret)
+		return ret;
+	return intcmp(a->flags, b->flags);
+}
+
+static inline struct objfd_cache_shard *oid_to_objfd_shard(uint64_t oid)
+{
+	return objfd_cache + sd_hash_oid(oid) % OBJFD_CACHE_SHARDS;
+}
+
+/* ec_index is meaningless for the replicated objects */
+static inline uint8_t objfd_ec_index(uint64_t oid, uint8_t ec_index)
+{
+	return is_erasure_oid(oid) ? ec_index : 0;
+}
+
+static void __attribute__((constructor)) objfd_cache_init(void)
+{
+	for (int i = 0; i < OBJFD_CACHE_SHARDS; i++) {
+		sd_init_mutex(&objfd_cache[i].lock);
+		INIT_RB_ROOT(&objfd_cache[i].root);
+		INIT_LIST_HEAD(&objfd_cache[i].lru);
+	}
+}
+
+void objfd_cache_put(struct objfd *ofd)
+{
+	if (refcount_dec(&ofd->refcnt) > 0)
+		return;
+
+	close(ofd->fd);
+	free(ofd);
+}
+
+/* Called with shard->lock held */
+static void objfd_cache_del(struct objfd_cache_shard *shard,
+			    struct objfd *ofd)
+{
+	rb_erase(&ofd->rb, &shard->root);
+	list_del(&ofd->lru);
+	shard->nr--;
+	/* drop the reference held by the cache */
+	objfd_cache_put(ofd);
+}
+
+/* Return the cached fd of the object, or NULL if it's not cached. */
+struct objfd *objfd_cache_lookup(uint64_t oid, uint8_t ec_index, int flags)
+{
+	struct objfd_cache_shard *shard = oid_to_objfd_shard(oid);
+	struct objfd key = {
+		.oid = oid,
+		.ec_index = objfd_ec_index(oid, ec_index),
+		.flags = flags,
+	}, *ofd;
+
+	sd_mutex_lock(&shard->lock);
+	ofd = rb_search(&shard->root, &key, rb, objfd_cmp);
+	if (ofd) {
+		refcount_inc(&ofd->refcnt);
+		list_move_tail(&ofd->lru, &shard->lru);
+	}
+	sd_mutex_unlock(&shard->lock);
+
+	return ofd;
+}
+
+/*
+ * Open the object file and add its fd to the cache.  Return NULL with errno
+ * set if we fail to open it.  The caller must release the returned fd with
+ * objfd_cache_put().
+ */
+struct objfd *objfd_cache_open(uint64_t oid, uint8_t ec_index,
+			       const char *path, int flags)
+{
+	struct objfd_cache_shard *shard = oid_to_objfd_shard(oid);
+	struct objfd *ofd, *old;
+	uint64_t gen;
+	int fd;
+
+again:
+	sd_mutex_lock(&shard->lock);
+	gen = shard->gen;
+	sd_mutex_unlock(&shard->lock);
+
+	fd = open(path, flags, sd_def_fmode);
+	if (fd < 0)
+		return NULL;
+
+	ofd = xzalloc(sizeof(*ofd));
+	ofd->oid = oid;
+	ofd->ec_index = objfd_ec_index(oid, ec_index);
+	ofd->flags = flags;
+	ofd->fd = fd;
+	/* one for the cache and one for the caller */
+	refcount_set(&ofd->refcnt, 2);
+
+	sd_mutex_lock(&shard->lock);
+	if (shard->gen != gen) {
+		/*
+		 * The file may have been replaced or removed after we opened
+		 * it, and the removal has missed this fd.  Open it again.
+		 */
+		sd_mutex_unlock(&shard->lock);
+		close(fd);
+		free(ofd);
+		goto again;
+	}
+	old = rb_insert(&shard->root, ofd, rb, objfd_cmp);
+	if (old) {
+		/* Somebody opened the same object in the meantime */
+		refcount_inc(&old->refcnt);
+		list_move_tail(&old->lru, &shard->lru);
+		sd_mutex_unlock(&shard->lock);
+
+		close(fd);
+		free(ofd);
+		return old;
+	}
+	list_add_tail(&ofd->lru, &shard->lru);
+	if (++shard->nr > OBJFD_CACHE_SHARD_SIZE)
+		objfd_cache_del(shard, list_first_entry(&shard->lru,
+							struct objfd, lru));
+	sd_mutex_unlock(&shard->lock);
+
+	return ofd;
+}
+
+/*
+ * Return the fd of the object in the working directory, opening it if it's not
+ * cached yet.  Return NULL if the object is not in place, in which case the
+ * caller should go through the store driver.
+ */
+struct objfd *objfd_cache_get(uint64_t oid, uint8_t ec_index, int flags)
+{
+	struct objfd *ofd;
+	char path[PATH_MAX];
+
+	ofd = objfd_cache_lookup(oid, ec_index, flags);
+	if (ofd)
+		return ofd;
+
+	if (!sd_store->get_path || !sd_store->exist(oid, ec_index))
+		return NULL;
+
+	sd_store->get_path(oid, ec_index, path);
+	return objfd_cache_open(oid, ec_index, path, flags);
+}
+
+/* Drop all the cached fds of the object */
+void objfd_cache_remove(uint64_t oid, uint8_t ec_index)
+{
+	struct objfd_cache_shard *shard = oid_to_objfd_shard(oid);
+	struct objfd *ofd;
+
+	ec_index = objfd_ec_index(oid, ec_index);
+	sd_mutex_lock(&shard->lock);
+	shard->gen++;
+	list_for_each_entry(ofd, &shard->lru, lru) {
+		if (ofd->oid == oid && ofd->ec_index == ec_index)
+			objfd_cache_del(shard, ofd);
+	}
+	sd_mutex_unlock(&shard->lock);
+}
+
+void objfd_cache_purge(void)
+{
+	struct objfd *ofd;
+
+	for (int i = 0; i < OBJFD_CACHE_SHARDS; i++) {
+		struct objfd_cache_shard *shard = objfd_cache + i;
+
+		sd_mutex_lock(&shard->lock);
+		shard->gen++;
+		list_for_each_entry(ofd, &shard->lru, lru) {
+			objfd_cache_del(shard, ofd);
+		}
+		sd_mutex_unlock(&shard->lock);
+	}
+}
+
 int err_to_sderr(const char *path, uint64_t oid, int err)
 {
 	struct stat s;
@@ -184,18 +184,68 @@ static int64_t find_string_integer(const char *str, const char *delimiter)
 	return ret;
 }
 
-/* If cleanup is true, temporary objects will be removed */
-static int for_each_object_in_path(const char *path,
-				   int (*func)(uint64_t, const char *, uint32_t,
-					       uint8_t, struct vnode_info *,
-					       void *),
-				   bool cleanup, struct vnode_info *vinfo,
-				   void *arg)
+/* The max number of the objects passed to the callback at once */
+#define SCAN_BATCH_SIZE 1024
+/* The max number of the threads which scan the directories of a disk */
+#define NR_SCAN_THREADS_PER_DISK 8
+
+struct scan_entry {
+	uint64_t oid;
+	uint32_t epoch;
+	uint8_t ec_index;
+};
+
+static bool dentry_is_dir(DIR *dir, const struct dirent *d)
+{
+	struct stat s;
+
+	if (likely(d->d_type != DT_UNKNOWN))
+		return d->d_type == DT_DIR;
+
+	/* Some file systems don't fill d_type */
+	if (fstatat(dirfd(dir), d->d_name, &s, 0) < 0)
+		return false;
+
+	return S_ISDIR(s.st_mode);
+}
+
+static int scan_object_batch(const char *path, struct scan_entry *batch,
+			     int nr,
+			     int (*func)(uint64_t, const char *, uint32_t,
+					 uint8_t, struct vnode_info *, void *),
+			     struct vnode_info *vinfo, void *arg)
+{
+	int ret;
+
+	for (int i = 0; i < nr; i++) {
+		ret = func(batch[i].oid, path, batch[i].epoch,
+			   batch[i].ec_index, vinfo, arg);
+		if (ret != SD_RES_SUCCESS)
+			return ret;
+	}
+
+	return SD_RES_SUCCESS;
+}
+
+/*
+ * Call 'func' against the objects in 'path'.  The sub directories of tree
+ * store are scanned recursively if 'descend' is true, and skipped otherwise.
+ *
+ * The dentries are collected into a batch before the callback is called, so
+ * the callbacks which rename or remove the objects don't affect the reading
+ * of the directory.  If cleanup is true, temporary objects will be removed.
+ */
+static int __for_each_object_in_path(const char *path,
+				     int (*func)(uint64_t, const char *,
+						 uint32_t, uint8_t,
+						 struct vnode_info *, void *),
+				     bool cleanup, struct vnode_info *vinfo,
+				     void *arg, bool descend)
 {
 	DIR *dir;
 	struct dirent *d;
-	uint64_t oid;
-	int ret = SD_RES_SUCCESS;
+	struct scan_entry *batch;
+	int nr = 0, ret = SD_RES_SUCCESS;
 	char file_name[PATH_MAX];
 
 	dir = opendir(path);
@@ -204,26 +254,27 @@ static int for_each_object_in_path(const char *path,
 		return SD_RES_EIO;
 	}
 
+	batch = xmalloc(SCAN_BATCH_SIZE * sizeof(*batch));
 	while ((d = readdir(dir))) {
-		uint32_t epoch = 0;
-		uint8_t ec_index = SD_MAX_COPIES;
+		uint64_t oid;
+		int64_t epoch = 0, ec_index = SD_MAX_COPIES;
 
 		/* skip ".", ".." and ".stale" */
 		if (unlikely(!strncmp(d->d_name, ".", 1)))
 			continue;
 
 		/* recursive call for tree store driver sub directories*/
-		if (store_id_match(TREE_STORE)) {
-			struct stat s;
-
+		if (store_id_match(TREE_STORE) && dentry_is_dir(dir, d)) {
+			if (!descend)
+				continue;
 			snprintf(file_name, sizeof(file_name),
 				 "%s/%s", path, d->d_name);
-			stat(file_name, &s);
-			if (S_ISDIR(s.st_mode)) {
-				ret = for_each_object_in_path(file_name,
-					func, cleanup, vinfo, arg);
-				continue;
-			}
+			ret = __for_each_object_in_path(file_name, func,
+							cleanup, vinfo, arg,
+							true);
+			if (ret != SD_RES_SUCCESS)
+				break;
+			continue;
 		}
 
 		sd_debug("%s, %s", path, d->d_name);
@@ -234,12 +285,11 @@ static int for_each_object_in_path(const char *path,
 		/* don't call callback against temporary objects */
 		if (is_tmp_dentry(d->d_name)) {
 			if (cleanup) {
-				snprintf(file_name, sizeof(file_name),
-						"%s/%s", path, d->d_name);
-				sd_debug("remove tmp object %s", file_name);
-				if (unlink(file_name) < 0)
-					sd_err("failed to unlink %s: %m",
-							file_name);
+				sd_debug("remove tmp object %s/%s", path,
+					 d->d_name);
+				if (unlinkat(dirfd(dir), d->d_name, 0) < 0)
+					sd_err("failed to unlink %s/%s: %m",
+					       path, d->d_name);
 			}
 			continue;
 		}
@@ -256,14 +306,36 @@ static int for_each_object_in_path(const char *path,
 				continue;
 		}
 
-		ret = func(oid, path, epoch, ec_index, vinfo, arg);
+		batch[nr].oid = oid;
+		batch[nr].epoch = epoch;
+		batch[nr].ec_index = ec_index;
+		if (++nr < SCAN_BATCH_SIZE)
+			continue;
+
+		ret = scan_object_batch(path, batch, nr, func, vinfo, arg);
+		nr = 0;
 		if (ret != SD_RES_SUCCESS)
 			break;
 	}
 	closedir(dir);
+
+	if (ret == SD_RES_SUCCESS)
+		ret = scan_object_batch(path, batch, nr, func, vinfo, arg);
+	free(batch);
 	return ret;
 }
 
+static int for_each_object_in_path(const char *path,
+				   int (*func)(uint64_t, const char *, uint32_t,
+					       uint8_t, struct vnode_info *,
+					       void *),
+				   bool cleanup, struct vnode_info *vinfo,
+				   void *arg)
+{
+	return __for_each_object_in_path(path, func, cleanup, vinfo, arg,
+					 true);
+}
+
 static uint64_t get_path_free_size(const char *path, uint64_t *used)
 {
 	struct statvfs fs;
@@ -359,6 +431,8 @@ bool md_add_disk(const char *path, bool purge)
 		return false;
 	}
 
+	/* Objects can be mapped to the other disk, drop the stale fds */
+	objfd_cache_purge();
 	create_vdisks(new);
 	rb_insert(&md.root, new, rb, disk_cmp);
 	md.space += new->space;
@@ -372,6 +446,7 @@ bool md_add_disk(const char *path, bool purge)
 static inline void md_remove_disk(struct disk *disk)
 {
 	sd_info("%s from multi-disk array", disk->path);
+	objfd_cache_purge();
 	rb_erase(&disk->rb, &md.root);
 	md.nr_disks--;
 	remove_vdisks(disk);
@@ -405,8 +480,16 @@ const char *md_get_object_dir(uint64_t oid)
 	return p;
 }
 
+/*
+ * The directories of a disk to scan.  dirs[0] is the disk itself, and the
+ * rest are the sub directories of tree store, which are shared among the
+ * threads of the disk.
+ */
 struct process_path_arg {
 	const char *path;
+	char **dirs;
+	int nr_dirs;
+	int next_dir;
 	struct vnode_info *vinfo;
 	int (*func)(uint64_t oid, const char *, uint32_t, uint8_t,
 		    struct vnode_info *, void *arg);
@@ -415,15 +498,52 @@ struct process_path_arg {
 	int result;
 };
 
+static void get_scan_dirs(struct process_path_arg *parg)
+{
+	DIR *dir;
+	struct dirent *d;
+	int alloc = 1;
+	char path[PATH_MAX];
+
+	parg->dirs = xmalloc(sizeof(*parg->dirs));
+	parg->dirs[0] = xstrdup(parg->path);
+	parg->nr_dirs = 1;
+
+	if (!store_id_match(TREE_STORE))
+		return;
+
+	dir = opendir(parg->path);
+	if (unlikely(!dir))
+		return; /* the thread of dirs[0] reports the error */
+
+	while ((d = readdir(dir))) {
+		if (!strncmp(d->d_name, ".", 1) || !dentry_is_dir(dir, d))
+			continue;
+		if (parg->nr_dirs == alloc) {
+			alloc *= 2;
+			parg->dirs = xrealloc(parg->dirs,
+					      alloc * sizeof(*parg->dirs));
+		}
+		snprintf(path, sizeof(path), "%s/%s", parg->path, d->d_name);
+		parg->dirs[parg->nr_dirs++] = xstrdup(path);
+	}
+	closedir(dir);
+}
+
 static void *thread_process_path(void *arg)
 {
-	int ret;
+	int ret, i;
 	struct process_path_arg *parg = (struct process_path_arg *)arg;
 
-	ret = for_each_object_in_path(parg->path, parg->func, parg->cleanup,
-				      parg->vinfo, parg->opaque);
-	if (ret != SD_RES_SUCCESS)
-		parg->result = ret;
+	while ((i = uatomic_add_return(&parg->next_dir, 1) - 1) <
+	       parg->nr_dirs) {
+		/* The sub directories of the disk are scanned separately */
+		ret = __for_each_object_in_path(parg->dirs[i], parg->func,
+						parg->cleanup, parg->vinfo,
+						parg->opaque, i > 0);
+		if (ret != SD_RES_SUCCESS)
+			uatomic_cmpxchg(&parg->result, SD_RES_SUCCESS, ret);
+	}
 
 	return arg;
 }
@@ -435,44 +555,52 @@ main_fn int for_each_object_in_wd(int (*func)(uint64_t oid, const char *path,
 {
 	int ret = SD_RES_SUCCESS;
 	const struct disk *disk;
-	struct process_path_arg *thread_args, *path_arg;
+	struct process_path_arg *path_args, *path_arg;
 	struct vnode_info *vinfo;
 	void *ret_arg;
 	sd_thread_t *thread_array;
-	int nr_thread = 0, idx = 0;
+	int nr_disks = 0, nr_thread = 0, idx = 0, nr;
 
 	sd_read_lock(&md.lock);
 
 	rb_for_each_entry(disk, &md.root, rb) {
-		nr_thread++;
+		nr_disks++;
 	}
 
-	thread_args = xmalloc(nr_thread * sizeof(struct process_path_arg));
-	thread_array = xmalloc(nr_thread * sizeof(sd_thread_t));
+	path_args = xzalloc(nr_disks * sizeof(struct process_path_arg));
+	thread_array = xmalloc(nr_disks * NR_SCAN_THREADS_PER_DISK *
+			       sizeof(sd_thread_t));
 
 	vinfo = get_vnode_info();
 
 	rb_for_each_entry(disk, &md.root, rb) {
-		thread_args[idx].path = disk->path;
-		thread_args[idx].vinfo = vinfo;
-		thread_args[idx].func = func;
-		thread_args[idx].cleanup = cleanup;
-		thread_args[idx].opaque = arg;
-		thread_args[idx].result = SD_RES_SUCCESS;
-		ret = sd_thread_create_with_idx("foreach wd",
-						thread_array + idx,
-						thread_process_path,
-						(void *)(thread_args + idx));
-		if (ret) {
-			/*
-			 * If we can't create enough threads to process
-			 * files, the data-consistent will be broken if
-			 * we continued.
-			 */
-			panic("Failed to create thread for path %s",
-			      disk->path);
+		path_arg = path_args + idx++;
+		path_arg->path = disk->path;
+		path_arg->vinfo = vinfo;
+		path_arg->func = func;
+		path_arg->cleanup = cleanup;
+		path_arg->opaque = arg;
+		path_arg->result = SD_RES_SUCCESS;
+		get_scan_dirs(path_arg);
+
+		nr = min(path_arg->nr_dirs, NR_SCAN_THREADS_PER_DISK);
+		for (int i = 0; i < nr; i++) {
+			ret = sd_thread_create_with_idx("foreach wd",
+							thread_array +
+							nr_thread,
+							thread_process_path,
+							path_arg);
+			if (ret) {
+				/*
+				 * If we can't create enough threads to process
+				 * files, the data-consistent will be broken if
+				 * we continued.
+				 */
+				panic("Failed to create thread for path %s",
+				      disk->path);
+			}
+			nr_thread++;
 		}
-		idx++;
 	}
 
 	sd_debug("Create %d threads for all path", nr_thread);
@@ -481,18 +609,22 @@ main_fn int for_each_object_in_wd(int (*func)(uint64_t oid, const char *path,
 		ret = sd_thread_join(thread_array[idx], &ret_arg);
 		if (ret)
 			sd_err("Failed to join thread");
-		if (ret_arg) {
-			path_arg = (struct process_path_arg *)ret_arg;
-			if (path_arg->result != SD_RES_SUCCESS)
-				sd_err("%s, %s", path_arg->path,
-				       sd_strerror(path_arg->result));
-		}
+	}
+
+	for (idx = 0; idx < nr_disks; idx++) {
+		path_arg = path_args + idx;
+		if (path_arg->result != SD_RES_SUCCESS)
+			sd_err("%s, %s", path_arg->path,
+			       sd_strerror(path_arg->result));
+		for (int i = 0; i < path_arg->nr_dirs; i++)
+			free(path_arg->dirs[i]);
+		free(path_arg->dirs);
 	}
 
 	put_vnode_info(vinfo);
 	sd_rw_unlock(&md.lock);
 
-	free(thread_args);
+	free(path_args);
 	free(thread_array);
 	return ret;
 }
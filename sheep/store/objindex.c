@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2015 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent object index
+ *
+ * At startup, the store walks all the object directories to build the object
+ * list cache and reads the inode headers of all the VDI objects to build the
+ * VDI state.  This takes long on a node with many objects.
+ *
+ * To skip it after a planned restart, sheep saves the objects it has, with the
+ * inode fields of the VDI objects, to the index file of each MD disk when it
+ * shuts down cleanly.  The next sheep loads the index instead of scanning the
+ * directories.
+ *
+ * The index is removed when it is loaded, before any object is modified, so it
+ * never describes a store which changed after it was written.  If sheep
+ * crashes, there is no index at the next startup and the store falls back to
+ * the full scan.  So does it if the index of any disk is missing or broken,
+ * or the disks were changed.
+ */
+
+#include "sheep_priv.h"
+
+#define OBJINDEX_FILE ".objindex"
+#define OBJINDEX_MAGIC 0x5d1d8e00
+#define OBJINDEX_VERSION 1
+
+#define OBJINDEX_SNAPSHOT 0x1
+#define OBJINDEX_DELETED 0x2
+
+struct objindex_header {
+	uint32_t magic;
+	uint32_t version;
+	/* same for the index files written at once */
+	uint64_t generation;
+	uint32_t nr_disks;
+	uint32_t pad;
+	uint64_t nr_entries;
+	uint64_t csum;
+};
+
+struct objindex_entry {
+	uint64_t oid;
+	/* the fields below are the inode header fields of the VDI objects */
+	uint32_t parent_vid;
+	uint8_t nr_copies;
+	uint8_t copy_policy;
+	uint8_t block_size_shift;
+	uint8_t flags;
+};
+
+/* The state of objindex_load() and objindex_save(), used in the main thread */
+static struct objindex_state {
+	uint64_t generation;
+	struct objindex_entry *entries;
+	const char **dirs;
+	size_t nr_entries;
+	bool valid;
+	/* md_nr_disks(), which can't be called under for_each_obj_path() */
+	uint32_t nr_disks;
+	/* for objindex_load() */
+	struct objindex_entry **loaded;
+	size_t *nr_loaded;
+	int nr_read;
+} objindex;
+
+static uint64_t objindex_csum(const struct objindex_entry *entries, size_t nr)
+{
+	return sd_hash(entries, nr * sizeof(*entries));
+}
+
+static int read_objindex(const char *path)
+{
+	char file[PATH_MAX];
+	struct objindex_header hdr;
+	struct objindex_entry *entries = NULL;
+	struct stat s;
+	int fd, idx = objindex.nr_read++;
+
+	snprintf(file, sizeof(file), "%s/%s", path, OBJINDEX_FILE);
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			sd_err("failed to open %s, %m", file);
+		goto invalid;
+	}
+
+	if (fstat(fd, &s) < 0 || xread(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		sd_err("failed to read %s, %m", file);
+		goto invalid;
+	}
+
+	if (hdr.magic != OBJINDEX_MAGIC || hdr.version != OBJINDEX_VERSION ||
+	    hdr.nr_disks != objindex.nr_disks ||
+	    s.st_size != sizeof(hdr) + hdr.nr_entries * sizeof(*entries)) {
+		sd_warn("%s doesn't match the store", file);
+		goto invalid;
+	}
+	if (idx == 0)
+		objindex.generation = hdr.generation;
+	else if (hdr.generation != objindex.generation) {
+		sd_warn("%s is not written with the other disks", file);
+		goto invalid;
+	}
+
+	entries = xmalloc(hdr.nr_entries * sizeof(*entries) ?: 1);
+	if (xread(fd, entries, hdr.nr_entries * sizeof(*entries)) !=
+	    hdr.nr_entries * sizeof(*entries) ||
+	    objindex_csum(entries, hdr.nr_entries) != hdr.csum) {
+		sd_warn("%s is broken", file);
+		goto invalid;
+	}
+	close(fd);
+
+	objindex.loaded[idx] = entries;
+	objindex.nr_loaded[idx] = hdr.nr_entries;
+	return SD_RES_SUCCESS;
+invalid:
+	if (fd >= 0)
+		close(fd);
+	free(entries);
+	objindex.valid = false;
+	return SD_RES_SUCCESS;
+}
+
+/* Remove the index persistently before the store is modified */
+static int discard_objindex(const char *path)
+{
+	char file[PATH_MAX];
+	int fd;
+
+	snprintf(file, sizeof(file), "%s/%s", path, OBJINDEX_FILE);
+	if (unlink(file) < 0) {
+		if (errno == ENOENT)
+			return SD_RES_SUCCESS;
+		sd_err("failed to unlink %s, %m", file);
+		return SD_RES_EIO;
+	}
+
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || fsync(fd) < 0) {
+		sd_err("failed to sync %s, %m", path);
+		if (fd >= 0)
+			close(fd);
+		return SD_RES_EIO;
+	}
+	close(fd);
+
+	return SD_RES_SUCCESS;
+}
+
+static void load_entry(const struct objindex_entry *e)
+{
+	uint32_t vid = oid_to_vid(e->oid);
+
+	objlist_cache_insert(e->oid);
+
+	if (!is_vdi_obj(e->oid))
+		return;
+
+	add_vdi_state_unordered(vid, e->nr_copies,
+				e->flags & OBJINDEX_SNAPSHOT, e->copy_policy,
+				e->block_size_shift, e->parent_vid);
+	if (e->flags & OBJINDEX_DELETED)
+		atomic_set_bit(vid, sys->vdi_deleted);
+	atomic_set_bit(vid, sys->vdi_inuse);
+}
+
+/*
+ * Build the object list cache and the VDI state from the index files.  Return
+ * SD_RES_SUCCESS if it's done, and the caller has to scan the object
+ * directories otherwise.
+ */
+int objindex_load(void)
+{
+	int ret, nr_disks = objindex.nr_disks = md_nr_disks();
+	uint64_t nr = 0;
+
+	if (!nr_disks)
+		return SD_RES_NO_OBJ;
+
+	objindex.loaded = xzalloc(nr_disks * sizeof(*objindex.loaded));
+	objindex.nr_loaded = xzalloc(nr_disks * sizeof(*objindex.nr_loaded));
+	objindex.nr_read = 0;
+	objindex.valid = true;
+	for_each_obj_path(read_objindex);
+
+	ret = for_each_obj_path(discard_objindex);
+	if (ret != SD_RES_SUCCESS)
+		panic("failed to discard the object index");
+
+	if (objindex.valid) {
+		for (int i = 0; i < nr_disks; i++) {
+			for (size_t j = 0; j < objindex.nr_loaded[i]; j++)
+				load_entry(objindex.loaded[i] + j);
+			nr += objindex.nr_loaded[i];
+		}
+		sd_info("loaded %" PRIu64 " objects from the index", nr);
+		ret = SD_RES_SUCCESS;
+	} else
+		ret = SD_RES_NO_OBJ;
+
+	for (int i = 0; i < nr_disks; i++)
+		free(objindex.loaded[i]);
+	free(objindex.loaded);
+	free(objindex.nr_loaded);
+
+	return ret;
+}
+
+static int fill_inode_fields(struct objindex_entry *e)
+{
+	struct sd_inode *inode = xzalloc(SD_INODE_HEADER_SIZE);
+	struct siocb iocb = {
+		.buf = inode,
+		.length = SD_INODE_HEADER_SIZE,
+	};
+	int ret;
+
+	ret = sd_store->read(e->oid, &iocb);
+	if (ret != SD_RES_SUCCESS) {
+		sd_err("failed to read inode header %016" PRIx64 ", %s",
+		       e->oid, sd_strerror(ret));
+		goto out;
+	}
+
+	e->parent_vid = inode->parent_vdi_id;
+	e->nr_copies = inode->nr_copies;
+	e->copy_policy = inode->copy_policy;
+	e->block_size_shift = inode->block_size_shift;
+	if (vdi_is_snapshot(inode))
+		e->flags |= OBJINDEX_SNAPSHOT;
+	if (inode->name[0] == '\0')
+		e->flags |= OBJINDEX_DELETED;
+out:
+	free(inode);
+	return ret;
+}
+
+static int write_objindex(const char *path)
+{
+	char file[PATH_MAX];
+	struct objindex_header *hdr;
+	struct objindex_entry *entries;
+	size_t nr = 0, len;
+	int ret;
+
+	if (!objindex.valid)
+		return SD_RES_SUCCESS;
+
+	len = sizeof(*hdr) + objindex.nr_entries * sizeof(*entries);
+	hdr = xzalloc(len);
+	entries = (struct objindex_entry *)(hdr + 1);
+	/* md_get_object_dir() returns the path of the disk itself */
+	for (size_t i = 0; i < objindex.nr_entries; i++)
+		if (objindex.dirs[i] == path)
+			entries[nr++] = objindex.entries[i];
+
+	hdr->magic = OBJINDEX_MAGIC;
+	hdr->version = OBJINDEX_VERSION;
+	hdr->generation = objindex.generation;
+	hdr->nr_disks = objindex.nr_disks;
+	hdr->nr_entries = nr;
+	hdr->csum = objindex_csum(entries, nr);
+
+	snprintf(file, sizeof(file), "%s/%s", path, OBJINDEX_FILE);
+	ret = atomic_create_and_write(file, (char *)hdr,
+				      sizeof(*hdr) + nr * sizeof(*entries),
+				      true, false);
+	if (ret < 0) {
+		sd_err("failed to write %s", file);
+		/* the index of the other disks can't be used without this */
+		objindex.valid = false;
+	}
+	free(hdr);
+
+	return SD_RES_SUCCESS;
+}
+
+/*
+ * Save the objects of this node to the index files.  Called when sheep shuts
+ * down and no request is running.
+ */
+void objindex_save(void)
+{
+	struct sd_req hdr;
+	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
+	uint64_t *oids = NULL;
+	size_t size = (uatomic_read(&sys->stat.o.nr_objs) + 1) *
+		sizeof(*oids);
+	int ret;
+
+	objindex.nr_disks = md_nr_disks();
+	if (!sd_store || !objindex.nr_disks)
+		return;
+
+	if (node_in_recovery()) {
+		sd_info("skip the object index, the node is in recovery");
+		return;
+	}
+
+	do {
+		oids = xrealloc(oids, size);
+		sd_init_req(&hdr, SD_OP_GET_OBJ_LIST);
+		hdr.data_length = size;
+		ret = get_obj_list(&hdr, rsp, oids);
+		size *= 2;
+	} while (ret == SD_RES_BUFFER_SMALL);
+
+	objindex.nr_entries = rsp->data_length / sizeof(*oids);
+	objindex.entries = xzalloc(objindex.nr_entries *
+				   sizeof(*objindex.entries) ?: 1);
+	objindex.dirs = xmalloc(objindex.nr_entries *
+				sizeof(*objindex.dirs) ?: 1);
+	objindex.generation = clock_get_time() ^ getpid();
+	objindex.valid = true;
+	for (size_t i = 0; i < objindex.nr_entries; i++) {
+		objindex.entries[i].oid = oids[i];
+		objindex.dirs[i] = md_get_object_dir(oids[i]);
+		if (is_vdi_obj(oids[i]) &&
+		    fill_inode_fields(objindex.entries + i) != SD_RES_SUCCESS) {
+			objindex.valid = false;
+			break;
+		}
+	}
+	free(oids);
+
+	for_each_obj_path(write_objindex);
+	if (objindex.valid)
+		sd_info("saved %zu objects to the index", objindex.nr_entries);
+	else
+		/* the next sheep scans the directories in this case */
+		for_each_obj_path(discard_objindex);
+
+	free(objindex.entries);
+	free(objindex.dirs);
+}
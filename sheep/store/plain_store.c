@@ -88,6 +88,7 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 {
 	int flags = prepare_iocb(oid, iocb, false), fd,
 	    ret = SD_RES_SUCCESS;
+	struct objfd *ofd;
 	char path[PATH_MAX];
 	ssize_t size;
 	uint32_t len = iocb->length;
@@ -100,8 +101,8 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 	}
 
 	if (uatomic_is_true(&sys->use_journal) &&
-	    unlikely(journal_write_store(oid, iocb->buf, iocb->length,
-					 iocb->offset, false))
+	    unlikely(journal_write_store(oid, iocb->ec_index, iocb->buf,
+					 iocb->length, iocb->offset, false))
 	    != SD_RES_SUCCESS) {
 		sd_err("turn off journaling");
 		uatomic_set_false(&sys->use_journal);
@@ -109,6 +110,8 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 		sync();
 	}
 
+	objdirty_mark(oid, iocb->offset, iocb->length);
+
 	get_store_path(oid, iocb->ec_index, path);
 
 	/*
@@ -116,12 +119,16 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 	 * in a wrong place, due to 'shutdown/restart with less/more disks' or
 	 * any bugs. We need call err_to_sderr() to return EIO if disk is broken
 	 */
-	if (!default_exist(oid, iocb->ec_index))
-		return err_to_sderr(path, oid, ENOENT);
-
-	fd = open(path, flags, sd_def_fmode);
-	if (unlikely(fd < 0))
-		return err_to_sderr(path, oid, errno);
+	ofd = objfd_cache_lookup(oid, iocb->ec_index, flags);
+	if (!ofd) {
+		if (!default_exist(oid, iocb->ec_index))
+			return err_to_sderr(path, oid, ENOENT);
+
+		ofd = objfd_cache_open(oid, iocb->ec_index, path, flags);
+		if (unlikely(!ofd))
+			return err_to_sderr(path, oid, errno);
+	}
+	fd = ofd->fd;
 
 	if (trim_is_supported && is_sparse_object(oid)) {
 		if (default_trim(fd, oid, iocb, &offset, &len) < 0) {
@@ -137,10 +144,11 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 		       PRId32", size=%"PRId32", result=%zd, %m", oid, path,
 		       iocb->offset, iocb->length, size);
 		ret = err_to_sderr(path, oid, errno);
+		objfd_cache_remove(oid, iocb->ec_index);
 		goto out;
 	}
 out:
-	close(fd);
+	objfd_cache_put(ofd);
 	return ret;
 }
 
@@ -245,6 +253,9 @@ int default_init(void)
 	if (ret != SD_RES_SUCCESS)
 		return ret;
 
+	if (objindex_load() == SD_RES_SUCCESS)
+		return SD_RES_SUCCESS;
+
 	for_each_object_in_stale(init_objlist_and_vdi_bitmap, NULL);
 
 	return for_each_object_in_wd(init_objlist_and_vdi_bitmap, true, NULL);
@@ -255,6 +266,7 @@ static int default_read_from_path(uint64_t oid, const char *path,
 {
 	int flags = prepare_iocb(oid, iocb, false), fd,
 	    ret = SD_RES_SUCCESS;
+	struct objfd *ofd = NULL;
 	ssize_t size;
 
 	/*
@@ -264,12 +276,23 @@ static int default_read_from_path(uint64_t oid, const char *path,
 	 *
 	 * For stale path, get_store_stale_path already does default_exist job.
 	 */
-	if (!is_stale_path(path) && !default_exist(oid, iocb->ec_index))
-		return err_to_sderr(path, oid, ENOENT);
-
-	fd = open(path, flags);
-	if (fd < 0)
-		return err_to_sderr(path, oid, errno);
+	if (is_stale_path(path)) {
+		fd = open(path, flags);
+		if (fd < 0)
+			return err_to_sderr(path, oid, errno);
+	} else {
+		ofd = objfd_cache_lookup(oid, iocb->ec_index, flags);
+		if (!ofd) {
+			if (!default_exist(oid, iocb->ec_index))
+				return err_to_sderr(path, oid, ENOENT);
+
+			ofd = objfd_cache_open(oid, iocb->ec_index, path,
+					       flags);
+			if (!ofd)
+				return err_to_sderr(path, oid, errno);
+		}
+		fd = ofd->fd;
+	}
 
 	size = xpread(fd, iocb->buf, iocb->length, iocb->offset);
 	if (size < 0) {
@@ -277,8 +300,13 @@ static int default_read_from_path(uint64_t oid, const char *path,
 		       PRId32", size=%"PRId32", result=%zd, %m", oid, path,
 		       iocb->offset, iocb->length, size);
 		ret = err_to_sderr(path, oid, errno);
+		if (ofd)
+			objfd_cache_remove(oid, iocb->ec_index);
 	}
-	close(fd);
+	if (ofd)
+		objfd_cache_put(ofd);
+	else
+		close(fd);
 	return ret;
 }
 
@@ -318,9 +346,11 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 	get_store_path(oid, iocb->ec_index, path);
 	get_store_tmp_path(oid, iocb->ec_index, tmp_path);
 
+	objdirty_mark(oid, 0, 0);
+
 	if (uatomic_is_true(&sys->use_journal) &&
-	    journal_write_store(oid, iocb->buf, iocb->length,
-				iocb->offset, true)
+	    journal_write_store(oid, iocb->ec_index, iocb->buf,
+				iocb->length, iocb->offset, true)
 	    != SD_RES_SUCCESS) {
 		sd_err("turn off journaling");
 		uatomic_set_false(&sys->use_journal);
@@ -376,6 +406,8 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 		ret = err_to_sderr(path, oid, errno);
 		goto out;
 	}
+	/* The cached fds point to the replaced object, if any */
+	objfd_cache_remove(oid, iocb->ec_index);
 
 	close(fd);
 
@@ -415,6 +447,8 @@ int default_link(uint64_t oid, uint32_t tgt_epoch)
 {
 	char path[PATH_MAX], stale_path[PATH_MAX];
 
+	objdirty_mark(oid, 0, 0);
+
 	sd_debug("try link %016"PRIx64" from snapshot with epoch %d", oid,
 		 tgt_epoch);
 
@@ -452,7 +486,7 @@ static bool oid_stale(uint64_t oid, int ec_index, struct vnode_info *vinfo)
 	const struct sd_vnode *obj_vnodes[SD_MAX_COPIES];
 
 	nr_copies = get_obj_copy_number(oid, vinfo->nr_zones);
-	oid_to_vnodes(oid, &vinfo->vroot, nr_copies, obj_vnodes);
+	vinfo_oid_to_vnodes(oid, vinfo, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		v = obj_vnodes[i];
 		if (vnode_is_local(v)) {
@@ -495,6 +529,8 @@ static int move_object_to_stale_dir(uint64_t oid, const char *wd,
 		       path);
 		return SD_RES_EIO;
 	}
+	/* After the rename, not to cache the fds of the moved file */
+	objfd_cache_remove(oid, ec_index);
 
 	sd_debug("moved object %016"PRIx64, oid);
 	return SD_RES_SUCCESS;
@@ -520,6 +556,7 @@ int default_update_epoch(uint32_t epoch)
 int default_format(void)
 {
 	sd_debug("try get a clean store");
+	objfd_cache_purge();
 	return for_each_obj_path(purge_dir);
 }
 
@@ -527,8 +564,10 @@ int default_remove_object(uint64_t oid, uint8_t ec_index)
 {
 	char path[PATH_MAX];
 
+	objdirty_mark(oid, 0, 0);
+
 	if (uatomic_is_true(&sys->use_journal))
-		journal_remove_object(oid);
+		journal_remove_object(oid, ec_index);
 
 	get_store_path(oid, ec_index, path);
 
@@ -539,6 +578,7 @@ int default_remove_object(uint64_t oid, uint8_t ec_index)
 		sd_err("failed, %s, %m", path);
 		return SD_RES_EIO;
 	}
+	objfd_cache_remove(oid, ec_index);
 
 	return SD_RES_SUCCESS;
 }
@@ -659,6 +699,7 @@ static struct store_driver plain_store = {
 	.format = default_format,
 	.remove_object = default_remove_object,
 	.get_hash = default_get_hash,
+	.get_path = get_store_path,
 	.purge_obj = default_purge_obj,
 };
 
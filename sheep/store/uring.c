@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2015 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous backend IO based on io_uring
+ *
+ * READ_PEER and WRITE_PEER requests against objects which are already in
+ * place are served by the main thread without going through peer_wqueue:
+ * the object file is opened, read or written and closed by io_uring, and the
+ * completions are reaped in the main event loop via an eventfd.  If the fd of
+ * the object is cached, the open and close stages are skipped.  Request
+ * buffers are allocated from a pool which is registered to the ring, so the
+ * kernel doesn't have to map the user pages on every IO.
+ *
+ * Anything unusual (misplaced or missing objects, stale objects, journaling,
+ * trimming of sparse objects, IO errors) is handed back to the synchronous
+ * store driver on peer_wqueue, which knows how to deal with it.
+ */
+
+#include <liburing.h>
+/* linux/fs.h pulled by liburing has its own definition of BLOCK_SIZE */
+#undef BLOCK_SIZE
+
+#include "sheep_priv.h"
+
+#define URING_DEFAULT_DEPTH	256
+#define URING_DEFAULT_NR_BUFS	64
+#define URING_DEFAULT_BUF_SIZE	(1024 * 1024)
+
+enum uring_stage {
+	URING_OPEN,
+	URING_RW,
+	URING_CLOSE,
+};
+
+struct uring_iocb {
+	struct request *req;
+	struct objfd *ofd;
+	enum uring_stage stage;
+	char path[PATH_MAX];
+	int flags;
+	int fd;
+	int result;
+};
+
+struct uring_buf_pool {
+	struct sd_mutex lock;
+	char *base;
+	uint32_t buf_size;
+	uint32_t nr_bufs;
+	unsigned long *used;
+};
+
+static struct io_uring ring;
+static int uring_efd = -1;
+static struct uring_buf_pool pool = {
+	.lock = SD_MUTEX_INITIALIZER,
+};
+
+void *uring_alloc_buf(uint32_t len)
+{
+	unsigned long idx;
+
+	if (!pool.base || len > pool.buf_size)
+		return NULL;
+
+	sd_mutex_lock(&pool.lock);
+	idx = find_next_zero_bit(pool.used, pool.nr_bufs, 0);
+	if (idx < pool.nr_bufs)
+		set_bit(idx, pool.used);
+	sd_mutex_unlock(&pool.lock);
+
+	if (idx >= pool.nr_bufs)
+		return NULL;
+
+	return pool.base + idx * pool.buf_size;
+}
+
+static int uring_buf_index(const void *buf)
+{
+	const char *p = buf;
+
+	if (!pool.base || p < pool.base ||
+	    p >= pool.base + (size_t)pool.nr_bufs * pool.buf_size)
+		return -1;
+
+	return (p - pool.base) / pool.buf_size;
+}
+
+bool uring_free_buf(void *buf)
+{
+	int idx = uring_buf_index(buf);
+
+	if (idx < 0)
+		return false;
+
+	sd_mutex_lock(&pool.lock);
+	clear_bit(idx, pool.used);
+	sd_mutex_unlock(&pool.lock);
+
+	return true;
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&ring);
+	if (unlikely(!sqe)) {
+		/* The submission queue is full, flush it and try again */
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	return sqe;
+}
+
+static int uring_prep_rw(struct uring_iocb *iocb)
+{
+	struct request *req = iocb->req;
+	const struct sd_req *hdr = &req->rq;
+	struct io_uring_sqe *sqe;
+	int idx = uring_buf_index(req->data);
+
+	sqe = uring_get_sqe();
+	if (unlikely(!sqe))
+		return -1;
+
+	if (hdr->opcode == SD_OP_READ_PEER) {
+		if (idx >= 0)
+			io_uring_prep_read_fixed(sqe, iocb->fd, req->data,
+						 hdr->data_length,
+						 hdr->obj.offset, idx);
+		else
+			io_uring_prep_read(sqe, iocb->fd, req->data,
+					   hdr->data_length, hdr->obj.offset);
+	} else {
+		if (idx >= 0)
+			io_uring_prep_write_fixed(sqe, iocb->fd, req->data,
+						  hdr->data_length,
+						  hdr->obj.offset, idx);
+		else
+			io_uring_prep_write(sqe, iocb->fd, req->data,
+					    hdr->data_length, hdr->obj.offset);
+	}
+	io_uring_sqe_set_data(sqe, iocb);
+	iocb->stage = URING_RW;
+
+	return 0;
+}
+
+static int uring_prep_close(struct uring_iocb *iocb)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe();
+	if (unlikely(!sqe))
+		return -1;
+
+	io_uring_prep_close(sqe, iocb->fd);
+	io_uring_sqe_set_data(sqe, iocb);
+	iocb->stage = URING_CLOSE;
+
+	return 0;
+}
+
+/* Let the synchronous store driver retry the request on peer_wqueue */
+static void uring_fallback(struct uring_iocb *iocb)
+{
+	struct request *req = iocb->req;
+
+	sd_debug("%016"PRIx64", %s", req->rq.obj.oid, strerror(-iocb->result));
+	free(iocb);
+	queue_work(sys->peer_wqueue, &req->work);
+}
+
+static void uring_request_done(struct uring_iocb *iocb)
+{
+	struct request *req = iocb->req;
+
+	if (iocb->result != req->rq.data_length) {
+		uring_fallback(iocb);
+		return;
+	}
+
+	if (req->rq.opcode == SD_OP_READ_PEER)
+		req->rp.data_length = req->rq.data_length;
+	req->rp.result = SD_RES_SUCCESS;
+
+	free(iocb);
+	req->work.done(&req->work);
+}
+
+static void uring_complete(struct uring_iocb *iocb, int res)
+{
+	switch (iocb->stage) {
+	case URING_OPEN:
+		if (res < 0) {
+			iocb->result = res;
+			uring_fallback(iocb);
+			return;
+		}
+		iocb->fd = res;
+		if (uring_prep_rw(iocb) < 0) {
+			close(iocb->fd);
+			iocb->result = -EAGAIN;
+			uring_fallback(iocb);
+		}
+		break;
+	case URING_RW:
+		iocb->result = res;
+		if (iocb->ofd) {
+			objfd_cache_put(iocb->ofd);
+			uring_request_done(iocb);
+		} else if (uring_prep_close(iocb) < 0) {
+			close(iocb->fd);
+			uring_request_done(iocb);
+		}
+		break;
+	case URING_CLOSE:
+		if (res < 0)
+			sd_err("failed to close %s, %s", iocb->path,
+			       strerror(-res));
+		uring_request_done(iocb);
+		break;
+	default:
+		panic("invalid stage %d", iocb->stage);
+	}
+}
+
+static void uring_handler(int fd, int events, void *data)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_iocb *iocb;
+	int res;
+
+	eventfd_xread(fd);
+
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		iocb = io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+
+		uring_complete(iocb, res);
+	}
+
+	io_uring_submit(&ring);
+}
+
+static bool can_queue_async(const struct request *req)
+{
+	const struct sd_req *hdr = &req->rq;
+
+	if (uring_efd < 0 || sys->gateway_only || !sd_store->get_path)
+		return false;
+
+	switch (hdr->opcode) {
+	case SD_OP_READ_PEER:
+		/* Wildcard reads might have to look into the stale dir */
+		if (hdr->flags & SD_FLAG_CMD_WILDCARD)
+			return false;
+		if (0 < hdr->epoch && hdr->epoch < sys->cinfo.epoch)
+			return false;
+		break;
+	case SD_OP_WRITE_PEER:
+		if (uatomic_is_true(&sys->use_journal))
+			return false;
+		/* Sparse objects have to be trimmed by the store driver */
+		if (is_sparse_object(hdr->obj.oid))
+			return false;
+		if (hdr->epoch < sys->cinfo.epoch)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	if (hdr->flags & SD_FLAG_CMD_RECOVERY)
+		return false;
+
+	/* Zero copy reads are served by peer_read_obj() */
+	if (!req->data)
+		return false;
+
+	return hdr->data_length > 0;
+}
+
+/*
+ * Return true if the request is queued to io_uring.  Otherwise, the caller is
+ * responsible for processing the request in the worker thread.
+ */
+main_fn bool uring_queue_request(struct request *req)
+{
+	const struct sd_req *hdr = &req->rq;
+	struct uring_iocb *iocb;
+	struct io_uring_sqe *sqe;
+	struct objfd *ofd;
+	struct siocb siocb = {
+		.buf = req->data,
+		.length = hdr->data_length,
+		.offset = hdr->obj.offset,
+	};
+
+	if (!can_queue_async(req))
+		return false;
+
+	/* The store drivers do this for the writes in the worker threads */
+	if (hdr->opcode == SD_OP_WRITE_PEER)
+		objdirty_mark(hdr->obj.oid, hdr->obj.offset,
+			      hdr->data_length);
+
+	iocb = xzalloc(sizeof(*iocb));
+	iocb->req = req;
+	iocb->fd = -1;
+	iocb->flags = prepare_iocb(hdr->obj.oid, &siocb, false);
+
+	ofd = objfd_cache_lookup(hdr->obj.oid, hdr->obj.ec_index, iocb->flags);
+	if (ofd) {
+		iocb->ofd = ofd;
+		iocb->fd = ofd->fd;
+		if (unlikely(uring_prep_rw(iocb) < 0)) {
+			objfd_cache_put(ofd);
+			free(iocb);
+			return false;
+		}
+		io_uring_submit(&ring);
+		return true;
+	}
+
+	sqe = uring_get_sqe();
+	if (unlikely(!sqe)) {
+		free(iocb);
+		return false;
+	}
+
+	iocb->stage = URING_OPEN;
+	if (hdr->opcode == SD_OP_READ_PEER)
+		iocb->flags = (iocb->flags & ~O_ACCMODE) | O_RDONLY;
+	sd_store->get_path(hdr->obj.oid, hdr->obj.ec_index, iocb->path);
+
+	io_uring_prep_openat(sqe, AT_FDCWD, iocb->path, iocb->flags, 0);
+	io_uring_sqe_set_data(sqe, iocb);
+	io_uring_submit(&ring);
+
+	return true;
+}
+
+static int uring_init_buf_pool(uint32_t nr_bufs, uint32_t buf_size)
+{
+	struct iovec *iov;
+	int ret;
+
+	buf_size = round_up(buf_size, getpagesize());
+	pool.base = mmap(NULL, (size_t)nr_bufs * buf_size,
+			 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1, 0);
+	if (pool.base == MAP_FAILED) {
+		sd_err("failed to allocate io_uring buffers, %m");
+		pool.base = NULL;
+		return -1;
+	}
+
+	iov = xcalloc(nr_bufs, sizeof(*iov));
+	for (uint32_t i = 0; i < nr_bufs; i++) {
+		iov[i].iov_base = pool.base + (size_t)i * buf_size;
+		iov[i].iov_len = buf_size;
+	}
+
+	ret = io_uring_register_buffers(&ring, iov, nr_bufs);
+	free(iov);
+	if (ret < 0) {
+		sd_err("failed to register io_uring buffers, %s",
+		       strerror(-ret));
+		munmap(pool.base, (size_t)nr_bufs * buf_size);
+		pool.base = NULL;
+		return -1;
+	}
+
+	pool.nr_bufs = nr_bufs;
+	pool.buf_size = buf_size;
+	pool.used = alloc_bitmap(NULL, 0, nr_bufs);
+
+	return 0;
+}
+
+int uring_init(uint32_t depth, uint32_t nr_bufs, uint32_t buf_size)
+{
+	int ret;
+
+	if (!depth)
+		depth = URING_DEFAULT_DEPTH;
+	if (!nr_bufs)
+		nr_bufs = URING_DEFAULT_NR_BUFS;
+	if (!buf_size)
+		buf_size = URING_DEFAULT_BUF_SIZE;
+
+	ret = io_uring_queue_init(depth, &ring, 0);
+	if (ret < 0) {
+		sd_err("failed to initialize io_uring, %s", strerror(-ret));
+		return -1;
+	}
+
+	/* Registered buffers are optional, fall back to unregistered ones */
+	if (uring_init_buf_pool(nr_bufs, buf_size) < 0)
+		sd_warn("io_uring runs without registered buffers");
+
+	uring_efd = eventfd(0, EFD_NONBLOCK);
+	if (uring_efd < 0) {
+		sd_err("failed to create event fd: %m");
+		goto err;
+	}
+
+	ret = io_uring_register_eventfd(&ring, uring_efd);
+	if (ret < 0) {
+		sd_err("failed to register event fd, %s", strerror(-ret));
+		goto err;
+	}
+
+	ret = register_event(uring_efd, uring_handler, NULL);
+	if (ret) {
+		sd_err("failed to register io_uring event handler");
+		goto err;
+	}
+
+	sd_info("io_uring backend, depth %"PRIu32", %"PRIu32" buffers of %"
+		PRIu32" bytes", depth, pool.nr_bufs, pool.buf_size);
+	return 0;
+err:
+	if (uring_efd >= 0)
+		close(uring_efd);
+	uring_efd = -1;
+	io_uring_queue_exit(&ring);
+	return -1;
+}
+
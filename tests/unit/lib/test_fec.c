@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <cmock.h>
+
+#include "fec.h"
+#include "Mocklogger.h"
+
+/* 4:2, the policy of our typical erasure coded VDIs */
+#define EC_D 4
+#define EC_DP 6
+#define OBJECT_SIZE (64 * 1024)
+#define STRIP_LEN (OBJECT_SIZE / EC_D)
+
+static struct fec *ctx;
+static uint8_t *strips[EC_DP];
+
+static void prepare_strips(void)
+{
+	ctx = ec_init(EC_D, EC_DP);
+	for (int i = 0; i < EC_DP; i++)
+		strips[i] = malloc(STRIP_LEN);
+	for (int i = 0; i < EC_D; i++)
+		for (int j = 0; j < STRIP_LEN; j++)
+			strips[i][j] = random();
+	ec_encode_buffer(ctx, (const uint8_t **)strips, strips + EC_D,
+			 STRIP_LEN);
+}
+
+static void release_strips(void)
+{
+	for (int i = 0; i < EC_DP; i++)
+		free(strips[i]);
+	ec_destroy(ctx);
+}
+
+static void test_ec_encode_buffer_equals_ec_encode(void)
+{
+	uint8_t p0[SD_EC_DATA_STRIPE_SIZE], p1[SD_EC_DATA_STRIPE_SIZE];
+	uint8_t *ps[] = { p0, p1 };
+	int strip_size = SD_EC_DATA_STRIPE_SIZE / EC_D;
+
+	prepare_strips();
+	for (int i = 0; i < STRIP_LEN / strip_size; i++) {
+		const uint8_t *ds[EC_D];
+
+		for (int j = 0; j < EC_D; j++)
+			ds[j] = strips[j] + strip_size * i;
+		ec_encode(ctx, ds, ps);
+		TEST_ASSERT_EQUAL_MEMORY(strips[EC_D] + strip_size * i, p0,
+					 strip_size);
+		TEST_ASSERT_EQUAL_MEMORY(strips[EC_D + 1] + strip_size * i, p1,
+					 strip_size);
+	}
+	release_strips();
+}
+
+static void test_ec_decode_buffer_rebuilds_any_strip(void)
+{
+	char *buf = malloc(STRIP_LEN);
+
+	prepare_strips();
+	/* decode twice to use the cached coefficients too */
+	for (int n = 0; n < 2; n++) {
+		for (int lost = 0; lost < EC_DP; lost++) {
+			uint8_t *input[EC_D];
+			int idx[EC_D], k = 0;
+
+			for (int i = 0; i < EC_DP && k < EC_D; i++) {
+				if (i == lost)
+					continue;
+				input[k] = strips[i];
+				idx[k++] = i;
+			}
+			memset(buf, 0, STRIP_LEN);
+			ec_decode_buffer(ctx, input, idx, buf, lost,
+					 OBJECT_SIZE);
+			TEST_ASSERT_EQUAL_MEMORY(strips[lost], buf, STRIP_LEN);
+		}
+	}
+	release_strips();
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	init_fec();
+
+	UNITY_BEGIN();
+	RUN_TEST(test_ec_encode_buffer_equals_ec_encode);
+	RUN_TEST(test_ec_decode_buffer_rebuilds_any_strip);
+	return UNITY_END();
+}
@@ -39,6 +39,63 @@ static void test_queue_work(void)
 	TEST_ASSERT_EQUAL_PTR(&w, wq->pending_list.n.next);
 }
 
+#define NR_LOCKFREE_WORKS 8192
+
+static int nr_lockfree_executed;
+static int nr_lockfree_done;
+
+static void lockfree_work_fn(struct work *work)
+{
+	uatomic_inc(&nr_lockfree_executed);
+}
+
+static void lockfree_work_done(struct work *work)
+{
+	nr_lockfree_done++;
+}
+
+static void test_lockfree_work_queue(void)
+{
+	struct work_queue *lfq;
+	struct wq_stat stat, total;
+	struct work *works;
+	int i;
+
+	lfq = create_lockfree_work_queue("wq_lockfree", 4);
+	TEST_ASSERT_NOT_NULL(lfq);
+
+	/* more works than the rings can hold, to use the overflow list */
+	works = calloc(NR_LOCKFREE_WORKS, sizeof(*works));
+	for (i = 0; i < NR_LOCKFREE_WORKS; i++) {
+		works[i].fn = lockfree_work_fn;
+		works[i].done = lockfree_work_done;
+		queue_work(lfq, &works[i]);
+	}
+
+	/* the done callbacks are called in batches, loop enough times */
+	for (i = 0; i < 1000 && nr_lockfree_done < NR_LOCKFREE_WORKS; i++)
+		event_loop(100);
+
+	TEST_ASSERT_EQUAL_INT(NR_LOCKFREE_WORKS,
+			      uatomic_read(&nr_lockfree_executed));
+	TEST_ASSERT_EQUAL_INT(NR_LOCKFREE_WORKS, nr_lockfree_done);
+	TEST_ASSERT_TRUE(work_queue_empty(lfq));
+	TEST_ASSERT_EQUAL_INT(0, work_queue_length(lfq));
+
+	work_queue_get_stat(lfq, &stat);
+	TEST_ASSERT_EQUAL_UINT64(NR_LOCKFREE_WORKS, stat.nr_done);
+	TEST_ASSERT_TRUE(stat.nr_batches > 0);
+	TEST_ASSERT_TRUE(stat.max_latency * stat.nr_batches >=
+			 stat.total_latency);
+
+	/* the sum of all the queues includes this one */
+	work_queue_get_total_stat(&total);
+	TEST_ASSERT_TRUE(total.nr_done >= stat.nr_done);
+	TEST_ASSERT_TRUE(total.nr_batches >= stat.nr_batches);
+	TEST_ASSERT_TRUE(total.max_latency >= stat.max_latency);
+	free(works);
+}
+
 int main(int argc, char **argv)
 {
 	UNITY_BEGIN();
@@ -50,6 +107,7 @@ int main(int argc, char **argv)
 	 * Because test_queue_work use work_queue
 	 */
 	RUN_TEST(test_queue_work);
+	RUN_TEST(test_lockfree_work_queue);
 
 	return UNITY_END();
 }
@@ -17,3 +17,5 @@
 
 MOCK_METHOD(get_vdi_object_size, uint32_t, 0, uint32_t vid)
 MOCK_METHOD(get_vdi_copy_policy, int, 0, uint32_t vid)
+MOCK_METHOD(get_obj_copy_number, int, 1, uint64_t oid, int nr_zones)
+MOCK_METHOD(vdi_exist, int, 0, uint32_t vid)
@@ -54,11 +54,111 @@ static void test_sd_accept_handler()
 	TEST_ASSERT_EQUAL_HEX8(SD_CLUSTER_FLAG_USE_LOCK, __sys.cinfo.flags);
 }
 
+#define NR_PLACEMENT_NODES 48
+#define NR_PLACEMENT_OIDS 256
+
+static struct system_info placement_sys;
+static struct sd_node placement_nodes[NR_PLACEMENT_NODES];
+
+/*
+ * Add the nodes to 'nroot'.  Each zone has at least one node, and the rest are
+ * put in the zones at random, so the zones have different numbers of vnodes.
+ */
+static void gen_placement_nodes(struct rb_root *nroot, int nr_nodes,
+				int nr_zones, bool diskmode)
+{
+	struct sd_node *n;
+
+	INIT_RB_ROOT(nroot);
+	for (int i = 0; i < nr_nodes; i++) {
+		n = placement_nodes + i;
+		memset(n, 0, sizeof(*n));
+		/* IPv4 10.0.x.y */
+		n->nid.addr[12] = 10;
+		n->nid.addr[14] = i / 256;
+		n->nid.addr[15] = i % 256;
+		n->nid.port = 7000;
+		n->zone = i < nr_zones ? i : random() % nr_zones;
+		n->nr_vnodes = 16 * (1 + i % 4);
+#ifdef HAVE_DISKVNODES
+		if (diskmode)
+			for (int j = 0; j <= i % 3; j++) {
+				n->disks[j].disk_id = j + 1;
+				n->disks[j].disk_space = WEIGHT_MIN * (j + 1);
+			}
+#endif
+		rb_insert(nroot, n, rb, node_cmp);
+	}
+}
+
+/* The placement table must give the same vnodes as the walk of the ring */
+static void check_vnode_placement(int nr_nodes, int nr_zones, bool diskmode)
+{
+	const struct sd_vnode *expect[SD_MAX_COPIES], *got[SD_MAX_COPIES];
+	int width = min(nr_zones, SD_MAX_COPIES);
+	struct vnode_info *vinfo;
+	struct rb_root nroot;
+	uint64_t oid;
+
+	sys = &placement_sys;
+	memset(&placement_sys, 0, sizeof(placement_sys));
+	if (diskmode)
+		placement_sys.cinfo.flags = SD_CLUSTER_FLAG_DISKMODE;
+
+	gen_placement_nodes(&nroot, nr_nodes, nr_zones, diskmode);
+	vinfo = alloc_vnode_info(&nroot);
+	TEST_ASSERT_EQUAL_INT(width, vinfo->nr_zones);
+	TEST_ASSERT_EQUAL_INT(width, vinfo->width);
+
+	for (int i = 0; i < NR_PLACEMENT_OIDS; i++) {
+		oid = ((uint64_t)random() << 32) | random();
+
+		for (int nr_copies = 1; nr_copies <= width; nr_copies++) {
+			oid_to_vnodes(oid, &vinfo->vroot, nr_copies, expect);
+			vinfo_oid_to_vnodes(oid, vinfo, nr_copies, got);
+			TEST_ASSERT_EQUAL_MEMORY(expect, got,
+						 nr_copies * sizeof(*got));
+		}
+
+		for (int idx = 0; idx < width; idx++)
+			TEST_ASSERT_EQUAL_PTR(oid_to_vnode(oid, &vinfo->vroot,
+							   idx),
+					      vinfo_oid_to_vnode(oid, vinfo,
+								 idx));
+	}
+
+	put_vnode_info(vinfo);
+}
+
+static void test_vnode_placement_few_zones(void)
+{
+	check_vnode_placement(16, 3, false);
+	check_vnode_placement(NR_PLACEMENT_NODES, 8, false);
+}
+
+static void test_vnode_placement_many_zones(void)
+{
+	check_vnode_placement(NR_PLACEMENT_NODES, SD_MAX_COPIES + 9, false);
+}
+
+#ifdef HAVE_DISKVNODES
+static void test_vnode_placement_diskmode(void)
+{
+	check_vnode_placement(16, 4, true);
+	check_vnode_placement(NR_PLACEMENT_NODES, SD_MAX_COPIES + 9, true);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	UNITY_BEGIN();
 
 	RUN_TEST(test_sd_accept_handler);
+	RUN_TEST(test_vnode_placement_few_zones);
+	RUN_TEST(test_vnode_placement_many_zones);
+#ifdef HAVE_DISKVNODES
+	RUN_TEST(test_vnode_placement_diskmode);
+#endif
 
 	return UNITY_END();
 }
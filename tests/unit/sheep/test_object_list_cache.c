@@ -0,0 +1,336 @@
+#include <check.h>
+
+#include "object_list_cache.c"
+
+#define NR_TEST_OIDS (OBJLIST_DELTA_MAX * 3 + 5)
+#define TEST_VID 0x5a5a
+
+static uint64_t list_buf[NR_TEST_OIDS * 4];
+
+/* vid of the data objects which go to the 'idx'-th shard */
+static inline uint32_t shard_vid(int idx, uint32_t vid)
+{
+	return (uint32_t)idx << 18 | vid;
+}
+
+static size_t get_all_oids(uint64_t *oids)
+{
+	struct sd_req hdr;
+	struct sd_rsp rsp;
+
+	sd_init_req(&hdr, SD_OP_GET_OBJ_LIST);
+	hdr.data_length = sizeof(list_buf);
+	ck_assert_int_eq(get_obj_list(&hdr, &rsp, oids), SD_RES_SUCCESS);
+
+	return rsp.data_length / sizeof(*oids);
+}
+
+/* Check that the cache has the data objects of TEST_VID in 'present' */
+static void check_cache(const bool *present)
+{
+	size_t nr, n = 0;
+
+	nr = get_all_oids(list_buf);
+	for (int i = 0; i < NR_TEST_OIDS; i++) {
+		if (!present[i])
+			continue;
+		ck_assert_uint_lt(n, nr);
+		ck_assert_uint_eq(list_buf[n], vid_to_data_oid(TEST_VID, i));
+		n++;
+	}
+	ck_assert_uint_eq(n, nr);
+	ck_assert_uint_eq(uatomic_read(&sys->stat.o.nr_objs), nr);
+}
+
+static void setup(void)
+{
+	objlist_cache_format();
+}
+
+START_TEST(test_delta_max)
+{
+	bool present[NR_TEST_OIDS] = {};
+	int i;
+
+	/* in the reverse order to insert every oid to the head of 'added' */
+	for (i = NR_TEST_OIDS - 1; i >= 0; i--) {
+		objlist_cache_insert(vid_to_data_oid(TEST_VID, i));
+		present[i] = true;
+	}
+	check_cache(present);
+
+	/* cross OBJLIST_DELTA_MAX with the removals */
+	for (i = 0; i < NR_TEST_OIDS; i += 2) {
+		objlist_cache_remove(vid_to_data_oid(TEST_VID, i));
+		present[i] = false;
+	}
+	check_cache(present);
+
+	/* the oids already inserted or removed don't change anything */
+	for (i = 0; i < NR_TEST_OIDS; i++) {
+		if (present[i])
+			objlist_cache_insert(vid_to_data_oid(TEST_VID, i));
+		else
+			objlist_cache_remove(vid_to_data_oid(TEST_VID, i));
+	}
+	check_cache(present);
+
+	for (i = 0; i < NR_TEST_OIDS; i += 4) {
+		objlist_cache_insert(vid_to_data_oid(TEST_VID, i));
+		present[i] = true;
+	}
+	check_cache(present);
+}
+END_TEST
+
+START_TEST(test_remove_added)
+{
+	struct objlist_shard *shard = oid_to_shard(vid_to_data_oid(TEST_VID, 0));
+	bool present[NR_TEST_OIDS] = {};
+
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 0));
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 1));
+	ck_assert_uint_eq(shard->nr_added, 2);
+
+	/* drop it from 'added' instead of adding it to 'removed' */
+	objlist_cache_remove(vid_to_data_oid(TEST_VID, 0));
+	ck_assert_uint_eq(shard->nr_added, 1);
+	ck_assert_uint_eq(shard->nr_removed, 0);
+	present[1] = true;
+	check_cache(present);
+
+	objlist_cache_remove(vid_to_data_oid(TEST_VID, 0));
+	check_cache(present);
+
+	merge_shard(shard);
+	ck_assert_uint_eq(shard->nr_oids, 1);
+	check_cache(present);
+}
+END_TEST
+
+START_TEST(test_reinsert_removed)
+{
+	struct objlist_shard *shard = oid_to_shard(vid_to_data_oid(TEST_VID, 0));
+	bool present[NR_TEST_OIDS] = {};
+
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 0));
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 1));
+	merge_shard(shard);
+
+	objlist_cache_remove(vid_to_data_oid(TEST_VID, 0));
+	ck_assert_uint_eq(shard->nr_removed, 1);
+	present[1] = true;
+	check_cache(present);
+
+	/* drop it from 'removed' instead of adding it to 'added' */
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 0));
+	ck_assert_uint_eq(shard->nr_removed, 0);
+	ck_assert_uint_eq(shard->nr_added, 0);
+	present[0] = true;
+	check_cache(present);
+
+	objlist_cache_insert(vid_to_data_oid(TEST_VID, 0));
+	check_cache(present);
+}
+END_TEST
+
+static bool count_oid(uint64_t oid, void *arg)
+{
+	size_t *nr = arg;
+
+	(*nr)++;
+	return true;
+}
+
+/*
+ * Fill the shards 0, 1, 2, 5 and the last one with the oids, some of them in
+ * 'added' and 'removed'.  Return the oids in 'oids' in ascending order.
+ */
+static size_t fill_shards(uint64_t *oids)
+{
+	static const int shards[] = { 0, 1, 2, 5 };
+	size_t nr = 0, n;
+
+	for (int i = 0; i < ARRAY_SIZE(shards); i++) {
+		for (int j = 0; j < 40; j++)
+			objlist_cache_insert(vid_to_data_oid(
+					shard_vid(shards[i], TEST_VID), j));
+		merge_shard(objlist_shards + shards[i]);
+		for (int j = 40; j < 50; j++)
+			objlist_cache_insert(vid_to_data_oid(
+					shard_vid(shards[i], TEST_VID), j));
+		for (int j = 0; j < 50; j += 3)
+			objlist_cache_remove(vid_to_data_oid(
+					shard_vid(shards[i], TEST_VID), j));
+		for (int j = 0; j < 50; j++)
+			if (j % 3)
+				oids[nr++] = vid_to_data_oid(
+					shard_vid(shards[i], TEST_VID), j);
+
+		n = 0;
+		shard_for_each(objlist_shards + shards[i], 0, count_oid, &n);
+		ck_assert_uint_eq(n, shard_nr_oids(objlist_shards +
+						   shards[i]));
+	}
+	for (int i = 0; i < 10; i++) {
+		objlist_cache_insert(vid_to_vdi_oid(TEST_VID + i));
+		oids[nr++] = vid_to_vdi_oid(TEST_VID + i);
+	}
+
+	return nr;
+}
+
+/* A vnode_info of two nodes in the different zones, without placement table */
+static struct vnode_info *alloc_test_vnode_info(struct sd_node *nodes)
+{
+	struct vnode_info *vinfo = xzalloc(sizeof(*vinfo));
+
+	INIT_RB_ROOT(&vinfo->vroot);
+	INIT_RB_ROOT(&vinfo->nroot);
+	for (int i = 0; i < 2; i++) {
+		/* IPv4 10.0.0.x */
+		nodes[i].nid.addr[12] = 10;
+		nodes[i].nid.addr[15] = i + 1;
+		nodes[i].nid.port = 7000;
+		nodes[i].zone = i;
+		nodes[i].nr_vnodes = 64;
+		node_to_vnodes(nodes + i, &vinfo->vroot);
+	}
+	vinfo->nr_nodes = 2;
+	vinfo->nr_zones = 2;
+
+	return vinfo;
+}
+
+/* Get the oids from 'start' on the node in the chunks of 'chunk' oids */
+static size_t get_range_oids(uint64_t start, const struct sd_node *node,
+			     struct vnode_info *vinfo, size_t chunk,
+			     uint64_t *oids)
+{
+	struct sd_req hdr;
+	struct sd_rsp rsp;
+	size_t nr = 0, n;
+
+	sd_init_req(&hdr, SD_OP_GET_OBJ_LIST_RANGE);
+	hdr.data_length = chunk * sizeof(uint64_t);
+	memcpy(hdr.obj_list.addr, node->nid.addr, sizeof(hdr.obj_list.addr));
+	hdr.obj_list.port = node->nid.port;
+	hdr.obj_list.start = start;
+
+	do {
+		ck_assert_int_eq(get_obj_list_range(&hdr, &rsp, oids + nr,
+						    vinfo), SD_RES_SUCCESS);
+		n = rsp.data_length / sizeof(uint64_t);
+		ck_assert_uint_le(n, chunk);
+		nr += n;
+		if (n)
+			hdr.obj_list.start = oids[nr - 1] + 1;
+	} while (n == chunk);
+
+	return nr;
+}
+
+START_TEST(test_get_obj_list_range)
+{
+	static uint64_t all[NR_TEST_OIDS], expect[NR_TEST_OIDS];
+	static const size_t chunks[] = { 1, 7, 32, 33, NR_TEST_OIDS };
+	struct sd_node nodes[2] = {};
+	struct vnode_info *vinfo;
+	size_t nr_all, nr, nr_expect;
+	uint64_t start;
+
+	nr_all = fill_shards(all);
+	vinfo = alloc_test_vnode_info(nodes);
+
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < ARRAY_SIZE(chunks); j++) {
+			/* from the head, and from the middle of the shard 1 */
+			for (int k = 0; k < 2; k++) {
+				start = k ? all[50] + 1 : 0;
+				nr_expect = 0;
+				for (int l = 0; l < nr_all; l++) {
+					if (all[l] < start ||
+					    oid_to_vnode(all[l], &vinfo->vroot,
+							 0)->node !=
+					    nodes + i)
+						continue;
+					expect[nr_expect++] = all[l];
+				}
+				ck_assert_uint_gt(nr_expect, 0);
+
+				nr = get_range_oids(start, nodes + i, vinfo,
+						    chunks[j], list_buf);
+				ck_assert_uint_eq(nr, nr_expect);
+				ck_assert(memcmp(list_buf, expect,
+						 nr * sizeof(*expect)) == 0);
+			}
+		}
+	}
+
+	rb_destroy(&vinfo->vroot, struct sd_vnode, rb);
+	free(vinfo);
+}
+END_TEST
+
+START_TEST(test_deletion_work)
+{
+	static uint64_t all[NR_TEST_OIDS];
+	struct objlist_deletion_work ow = { .vid = shard_vid(1, TEST_VID) };
+	size_t nr_all, nr;
+
+	nr_all = fill_shards(all);
+	objlist_cache_insert(vid_to_vdi_oid(shard_vid(1, TEST_VID)));
+	nr_all++;
+	ck_assert_uint_eq(uatomic_read(&sys->stat.o.nr_objs), nr_all);
+
+	objlist_deletion_work(&ow.work);
+
+	/* only the data objects of the VDI are deleted */
+	nr = get_all_oids(list_buf);
+	for (int i = 0; i < nr; i++)
+		ck_assert(oid_to_vid(list_buf[i]) != ow.vid ||
+			  is_vdi_obj(list_buf[i]));
+	ck_assert_uint_eq(nr, nr_all - 33);
+	ck_assert_uint_eq(uatomic_read(&sys->stat.o.nr_objs), nr);
+	ck_assert_uint_eq(uatomic_read(&sys->stat.o.mem_size),
+			  nr * sizeof(uint64_t));
+}
+END_TEST
+
+static Suite *test_suite(void)
+{
+	Suite *s = suite_create("test object list cache");
+
+	TCase *tc_update = tcase_create("insert and remove");
+	TCase *tc_range = tcase_create("get_obj_list_range");
+	TCase *tc_deletion = tcase_create("deletion work");
+
+	tcase_add_checked_fixture(tc_update, setup, NULL);
+	tcase_add_checked_fixture(tc_range, setup, NULL);
+	tcase_add_checked_fixture(tc_deletion, setup, NULL);
+
+	tcase_add_test(tc_update, test_delta_max);
+	tcase_add_test(tc_update, test_remove_added);
+	tcase_add_test(tc_update, test_reinsert_removed);
+	tcase_add_test(tc_range, test_get_obj_list_range);
+	tcase_add_test(tc_deletion, test_deletion_work);
+
+	suite_add_tcase(s, tc_update);
+	suite_add_tcase(s, tc_range);
+	suite_add_tcase(s, tc_deletion);
+
+	return s;
+}
+
+int main(void)
+{
+	struct system_info __sys = {};
+	int number_failed;
+	sys = &__sys;
+	Suite *s = test_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}